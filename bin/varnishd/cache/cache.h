@@ -122,7 +122,9 @@ struct objhead;
 struct pool;
 struct req_step;
 struct sess;
+struct tag_ref;
 struct transport;
+struct vbf_park;
 struct vcf;
 struct VSC_lck;
 struct VSC_main;
@@ -168,6 +170,7 @@ struct http {
 
 	/* NB: ->nhd and below zeroed/initialized by http_Teardown */
 	uint16_t		nhd;		/* Next free hd */
+	uint16_t		hdm;		/* see http_IndexHdr() */
 
 	enum VSL_tag_e		logtag;		/* Must be SLT_*Method */
 	struct vsl_log		*vsl;
@@ -175,6 +178,10 @@ struct http {
 	struct ws		*ws;
 	uint16_t		status;
 	uint8_t			protover;
+
+	/* First hd[] slot of the hot headers, see http_IndexHdr() */
+#define HTTP_HDX_HOT		5
+	uint8_t			hdx[HTTP_HDX_HOT];
 };
 
 /*--------------------------------------------------------------------*/
@@ -354,6 +361,10 @@ struct objcore {
 
 	uint16_t		oa_present;
 
+	uint8_t			lru_freq;	// touched without lock
+	uint8_t			lru_queue;	// under LRU shard lock
+	uint16_t		timer_slot;	// expiry_wheel only
+
 	unsigned		timer_idx;	// XXX 4Gobj limit
 	vtim_real		last_lru;
 	VTAILQ_ENTRY(objcore)	hsh_list;
@@ -361,6 +372,7 @@ struct objcore {
 	VTAILQ_ENTRY(objcore)	ban_list;
 	VSTAILQ_ENTRY(objcore)	exp_list;
 	struct ban		*ban;
+	struct tag_ref		*tags;
 };
 
 /* Busy Object structure ---------------------------------------------
@@ -413,6 +425,7 @@ struct busyobj {
 	struct http_conn	*htc;
 
 	struct pool_task	fetch_task[1];
+	struct vbf_park		*park;
 
 #define BERESP_FLAG(l, r, w, f, d) unsigned	l:1;
 #define BEREQ_FLAG(l, r, w, d) BERESP_FLAG(l, r, w, 0, d)
@@ -434,6 +447,8 @@ struct busyobj {
 	struct acct_bereq	acct;
 
 	const struct stevedore	*storage;
+	int			admit;		/* -1: ask storage */
+	const struct stevedore	*admit_stv;	/* admit is for this one */
 	const struct director	*director_req;
 	const struct director	*director_resp;
 	enum director_state_e	director_state;
@@ -50,6 +50,8 @@
 #include "vtcp.h"
 #include "vtim.h"
 
+#include "VSC_acc.h"
+
 static pthread_t	VCA_thread;
 static vtim_dur vca_pace = 0.0;
 static struct lock pace_mtx;
@@ -74,6 +76,8 @@ struct poolsock {
 	struct listen_sock		*lsock;
 	struct pool_task		task[1];
 	struct pool			*pool;
+	struct VSC_acc			*vsc;
+	struct vsc_seg			*vsc_seg;
 };
 
 /*--------------------------------------------------------------------
@@ -113,6 +117,10 @@ static struct sock_opt {
 	SOCK_OPT(IPPROTO_TCP, TCP_KEEPALIVE, int)
 #endif
 
+#if defined(HAVE_TCP_NOTSENT_LOWAT)
+	SOCK_OPT(IPPROTO_TCP, TCP_NOTSENT_LOWAT, int)
+#endif
+
 #undef SOCK_OPT
 };
 
@@ -218,6 +226,10 @@ vca_sock_opt_init(void)
 #elif defined(HAVE_TCP_KEEPALIVE)
 		NEW_VAL(TCP_KEEPALIVE, so, i,
 		    (int)cache_param->tcp_keepalive_time);
+#endif
+#if defined(HAVE_TCP_NOTSENT_LOWAT)
+		NEW_VAL(TCP_NOTSENT_LOWAT, so, i,
+		    (int)cache_param->tcp_notsent_lowat);
 #endif
 	}
 	return (chg);
@@ -524,6 +536,7 @@ vca_accept_task(struct worker *wrk, void *arg)
 		}
 
 		if (i < 0) {
+			ps->vsc->fail++;
 			switch (errno) {
 			case ECONNABORTED:
 				wrk->stats->sess_fail_econnaborted++;
@@ -569,6 +582,7 @@ vca_accept_task(struct worker *wrk, void *arg)
 		}
 
 		wa.acceptsock = i;
+		ps->vsc->conn++;
 
 		if (!Pool_Task_Arg(wrk, TASK_QUEUE_REQ,
 		    vca_make_session, &wa, sizeof wa)) {
@@ -590,27 +604,58 @@ vca_accept_task(struct worker *wrk, void *arg)
 	}
 
 	VSL(SLT_Debug, NO_VXID, "XXX Accept thread dies %p", ps);
+	VSC_acc_Destroy(&ps->vsc_seg);
 	FREE_OBJ(ps);
 }
 
+/*--------------------------------------------------------------------
+ * With -a ...,reuseport=N, there are N listen sockets for the address,
+ * and the kernel spreads the connections over them.  Each pool accepts
+ * on the socket(s) matching its number, and if there are more sockets
+ * than pools, the surplus is shared out so none is left unattended.
+ */
+
+static int
+vca_reuseport_match(const struct listen_sock *ls, unsigned pool_no)
+{
+
+	CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+	if (ls->reuseport_n == 0)
+		return (1);
+	assert(ls->reuseport_idx < ls->reuseport_n);
+	if (pool_no % ls->reuseport_n == ls->reuseport_idx)
+		return (1);
+	assert(cache_param->wthread_pools > 0);
+	return (ls->reuseport_idx % cache_param->wthread_pools == pool_no);
+}
+
 /*--------------------------------------------------------------------
  * Called when a worker and attached thread pool is created, to
  * allocate the tasks which will listen to sockets for that pool.
  */
 
 void
-VCA_NewPool(struct pool *pp)
+VCA_NewPool(struct pool *pp, unsigned pool_no)
 {
 	struct listen_sock *ls;
 	struct poolsock *ps;
 
 	VTAILQ_FOREACH(ls, &heritage.socks, list) {
+		if (!vca_reuseport_match(ls, pool_no))
+			continue;
 		ALLOC_OBJ(ps, POOLSOCK_MAGIC);
 		AN(ps);
 		ps->lsock = ls;
 		ps->task->func = vca_accept_task;
 		ps->task->priv = ps;
 		ps->pool = pp;
+		if (ls->reuseport_n > 0)
+			ps->vsc = VSC_acc_New(NULL, &ps->vsc_seg,
+			    "%u.%s.%u", pool_no, ls->name, ls->reuseport_idx);
+		else
+			ps->vsc = VSC_acc_New(NULL, &ps->vsc_seg,
+			    "%u.%s", pool_no, ls->name);
+		AN(ps->vsc);
 		VTAILQ_INSERT_TAIL(&pp->poolsocks, ps, list);
 		AZ(Pool_Task(pp, ps->task, TASK_QUEUE_VCA));
 	}
@@ -739,6 +784,8 @@ ccf_listen_address(struct cli *cli, const char * const *av, void *priv)
 
 	PTOK(pthread_mutex_lock(&shut_mtx));
 	VTAILQ_FOREACH(ls, &heritage.socks, list) {
+		if (ls->reuseport_idx > 0)
+			continue;	// reuseport siblings
 		if (!ls->uds) {
 			VTCP_myname(ls->sock, h, sizeof h, p, sizeof p);
 			VCLI_Out(cli, "%s %s %s\n", ls->name, h, p);
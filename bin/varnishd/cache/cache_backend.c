@@ -34,6 +34,7 @@
 
 #include "config.h"
 
+#include <poll.h>
 #include <stdlib.h>
 
 #include "cache_varnishd.h"
@@ -48,6 +49,7 @@
 #include "cache_transport.h"
 #include "cache_vcl.h"
 #include "http1/cache_http1.h"
+#include "http2/cache_http2.h"
 #include "proxy/cache_proxy.h"
 
 #include "VSC_vbe.h"
@@ -182,10 +184,12 @@ vbe_connwait_fini(struct connwait *cw)
 
 static struct pfd *
 vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
-    unsigned force_fresh)
+    unsigned force_fresh, unsigned h2)
 {
 	struct busyobj *bo;
 	struct pfd *pfd;
+	struct h2f_stream *hs = NULL;
+	unsigned reused = 0;
 	int *fdp, err;
 	vtim_dur tmod;
 	char abuf1[VTCP_ADDRBUFSIZE], abuf2[VTCP_ADDRBUFSIZE];
@@ -264,7 +268,13 @@ vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
 	CHECK_OBJ_NOTNULL(bo->htc->doclose, STREAM_CLOSE_MAGIC);
 
 	FIND_TMO(connect_timeout, tmod, bo, bp);
-	pfd = VCP_Get(bp->conn_pool, tmod, wrk, force_fresh, &err);
+	if (h2) {
+		AN(bp->h2f);
+		pfd = H2F_Get(bp->h2f, tmod, wrk, &hs, &reused, &err);
+	} else {
+		pfd = VCP_Get(bp->conn_pool, tmod, wrk, force_fresh, &err);
+		reused = pfd != NULL && PFD_State(pfd) == PFD_STATE_STOLEN;
+	}
 	if (pfd == NULL) {
 		Lck_Lock(bp->director->mtx);
 		VBE_Connect_Error(bp->vsc, err);
@@ -300,8 +310,10 @@ vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
 	CHECK_OBJ_NOTNULL(bo->htc->doclose, STREAM_CLOSE_MAGIC);
 
 	err = 0;
-	if (bp->proxy_header != 0)
+	if (bp->proxy_header != 0) {
+		AZ(h2);
 		err += VPX_Send_Proxy(*fdp, bp->proxy_header, bo->sp);
+	}
 	if (err < 0) {
 		VSLb(bo->vsl, SLT_FetchError,
 		     "backend %s: proxy write errno %d (%s)",
@@ -327,10 +339,13 @@ vbe_dir_getfd(VRT_CTX, struct worker *wrk, VCL_BACKEND dir, struct backend *bp,
 	PFD_RemoteName(pfd, abuf2, sizeof abuf2, pbuf2, sizeof pbuf2);
 	VSLb(bo->vsl, SLT_BackendOpen, "%d %s %s %s %s %s %s",
 	    *fdp, VRT_BACKEND_string(dir), abuf2, pbuf2, abuf1, pbuf1,
-	    PFD_State(pfd) == PFD_STATE_STOLEN ? "reuse" : "connect");
+	    reused ? "reuse" : "connect");
 
 	INIT_OBJ(bo->htc, HTTP_CONN_MAGIC);
-	bo->htc->priv = pfd;
+	if (h2)
+		bo->htc->priv = hs;
+	else
+		bo->htc->priv = pfd;
 	bo->htc->rfd = fdp;
 	bo->htc->doclose = SC_NULL;
 	FIND_TMO(first_byte_timeout,
@@ -347,6 +362,7 @@ vbe_dir_finish(VRT_CTX, VCL_BACKEND d)
 	struct backend *bp;
 	struct busyobj *bo;
 	struct pfd *pfd;
+	int fd;
 
 	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
 	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
@@ -357,9 +373,25 @@ vbe_dir_finish(VRT_CTX, VCL_BACKEND d)
 	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
 	CHECK_OBJ_NOTNULL(bo->htc->doclose, STREAM_CLOSE_MAGIC);
 
-	pfd = bo->htc->priv;
-	bo->htc->priv = NULL;
-	if (bo->htc->doclose != SC_NULL || bp->proxy_header != 0) {
+	pfd = H2F_Pfd(bo->htc);
+	if (pfd != NULL) {
+		/* The stream goes, the connection stays unless it failed */
+		fd = *PFD_Fd(pfd);
+		if (H2F_Finish(bo))
+			VSLb(bo->vsl, SLT_BackendClose, "%d %s close %s", fd,
+			    VRT_BACKEND_string(d), bo->htc->doclose->name);
+		else
+			VSLb(bo->vsl, SLT_BackendClose, "%d %s recycle", fd,
+			    VRT_BACKEND_string(d));
+		AZ(bo->htc->priv);
+		pfd = NULL;
+	} else {
+		pfd = bo->htc->priv;
+		bo->htc->priv = NULL;
+	}
+	if (pfd == NULL) {
+		Lck_Lock(bp->director->mtx);
+	} else if (bo->htc->doclose != SC_NULL || bp->proxy_header != 0) {
 		VSLb(bo->vsl, SLT_BackendClose, "%d %s close %s", *PFD_Fd(pfd),
 		    VRT_BACKEND_string(d), bo->htc->doclose->name);
 		VCP_Close(&pfd);
@@ -384,10 +416,75 @@ vbe_dir_finish(VRT_CTX, VCL_BACKEND d)
 	bo->htc = NULL;
 }
 
-static int v_matchproto_(vdi_gethdrs_f)
-vbe_dir_gethdrs(VRT_CTX, VCL_BACKEND d)
+static vbf_resume_f vbe_dir_resume;
+
+/*--------------------------------------------------------------------
+ * With fetch_evented, the fetch is parked once the backend request is
+ * sent, unless the response has already started to arrive.
+ */
+
+static int
+vbe_dir_park(struct busyobj *bo, int fd, int extrachance)
+{
+	struct pollfd pfd[1];
+
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
+
+	if (!cache_param->fetch_evented)
+		return (-1);
+	pfd->fd = fd;
+	pfd->events = POLLIN;
+	pfd->revents = 0;
+	if (poll(pfd, 1, 0) != 0)
+		return (-1);
+	return (VBF_Park(bo, fd, VTIM_real() + bo->htc->first_byte_timeout,
+	    vbe_dir_resume, extrachance));
+}
+
+/*--------------------------------------------------------------------
+ * HTTP/2 backends get bodyless requests as a stream on a shared
+ * connection.  A stream refused by the backend, or lost with a reused
+ * connection before any response, is retried once like an HTTP/1
+ * request on a recycled connection.
+ */
+
+static int
+vbe_dir_gethdrs_h2(VRT_CTX, VCL_BACKEND d, struct backend *bp,
+    int extrachance)
 {
-	int i, extrachance = 1;
+	struct busyobj *bo;
+	struct worker *wrk;
+	int i;
+
+	bo = ctx->bo;
+	wrk = bo->wrk;
+	do {
+		if (vbe_dir_getfd(ctx, wrk, d, bp, 0, 1) == NULL)
+			return (-1);
+		AN(bo->htc);
+		i = H2F_SendReq(wrk, bo);
+		if (i == 0)
+			i = H2F_FetchRespHdr(bo);
+		if (i == 0) {
+			/* The headers were logged as they were set */
+			AN(bo->htc->priv);
+			return (0);
+		}
+		CHECK_OBJ_NOTNULL(bo->htc->doclose, STREAM_CLOSE_MAGIC);
+		vbe_dir_finish(ctx, d);
+		AZ(bo->htc);
+		if (i < 0 || extrachance == 0 || bo->no_retry != NULL)
+			break;
+		VSC_C_main->backend_retry++;
+	} while (extrachance--);
+	return (-1);
+}
+
+static int
+vbe_dir_gethdrs_int(VRT_CTX, VCL_BACKEND d, int extrachance)
+{
+	int i;
 	struct backend *bp;
 	struct pfd *pfd;
 	struct busyobj *bo;
@@ -398,24 +495,20 @@ vbe_dir_gethdrs(VRT_CTX, VCL_BACKEND d)
 	bo = ctx->bo;
 	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 	CHECK_OBJ_NOTNULL(bo->bereq, HTTP_MAGIC);
-	if (bo->htc != NULL)
-		CHECK_OBJ_NOTNULL(bo->htc->doclose, STREAM_CLOSE_MAGIC);
 	wrk = ctx->bo->wrk;
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CAST_OBJ_NOTNULL(bp, d->priv, BACKEND_MAGIC);
 
-	/*
-	 * Now that we know our backend, we can set a default Host:
-	 * header if one is necessary.  This cannot be done in the VCL
-	 * because the backend may be chosen by a director.
-	 */
-	if (!http_GetHdr(bo->bereq, H_Host, NULL) && bp->hosthdr != NULL)
-		http_PrintfHeader(bo->bereq, "Host: %s", bp->hosthdr);
+	if (bp->h2f != NULL && bp->proxy_header == 0 &&
+	    bo->bereq_body == NULL &&
+	    (bo->req == NULL || bo->req->req_body_status == BS_NONE))
+		return (vbe_dir_gethdrs_h2(ctx, d, bp, extrachance));
 
 	do {
 		if (bo->htc != NULL)
 			CHECK_OBJ_NOTNULL(bo->htc->doclose, STREAM_CLOSE_MAGIC);
-		pfd = vbe_dir_getfd(ctx, wrk, d, bp, extrachance == 0 ? 1 : 0);
+		pfd = vbe_dir_getfd(ctx, wrk, d, bp, extrachance == 0 ? 1 : 0,
+		    0);
 		if (pfd == NULL)
 			return (-1);
 		AN(bo->htc);
@@ -438,6 +531,9 @@ vbe_dir_gethdrs(VRT_CTX, VCL_BACKEND d)
 
 		if (bo->htc->doclose == SC_NULL) {
 			assert(PFD_State(pfd) == PFD_STATE_USED);
+			if (i == 0 &&
+			    !vbe_dir_park(bo, *PFD_Fd(pfd), extrachance))
+				return (0);
 			if (i == 0)
 				i = V1F_FetchRespHdr(bo);
 			if (i == 0) {
@@ -464,6 +560,78 @@ vbe_dir_gethdrs(VRT_CTX, VCL_BACKEND d)
 	return (-1);
 }
 
+static int v_matchproto_(vdi_gethdrs_f)
+vbe_dir_gethdrs(VRT_CTX, VCL_BACKEND d)
+{
+	struct backend *bp;
+	struct busyobj *bo;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
+	bo = ctx->bo;
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->bereq, HTTP_MAGIC);
+	if (bo->htc != NULL)
+		CHECK_OBJ_NOTNULL(bo->htc->doclose, STREAM_CLOSE_MAGIC);
+	CAST_OBJ_NOTNULL(bp, d->priv, BACKEND_MAGIC);
+
+	/*
+	 * Now that we know our backend, we can set a default Host:
+	 * header if one is necessary.  This cannot be done in the VCL
+	 * because the backend may be chosen by a director.
+	 */
+	if (!http_GetHdr(bo->bereq, H_Host, NULL) && bp->hosthdr != NULL)
+		http_PrintfHeader(bo->bereq, "Host: %s", bp->hosthdr);
+
+	return (vbe_dir_gethdrs_int(ctx, d, 1));
+}
+
+/*--------------------------------------------------------------------
+ * A parked fetch is resumed, pick up where vbe_dir_gethdrs_int() left
+ * off, including the retry of a recycled connection.
+ */
+
+static int v_matchproto_(vbf_resume_f)
+vbe_dir_resume(struct busyobj *bo, int timedout, unsigned extrachance)
+{
+	struct vrt_ctx ctx[1];
+	VCL_BACKEND d;
+	int i;
+
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->htc, HTTP_CONN_MAGIC);
+	d = bo->director_resp;
+	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
+	assert(bo->director_state == DIR_S_HDRS);
+
+	if (timedout) {
+		VSLb(bo->vsl, SLT_FetchError, "first byte timeout");
+		bo->htc->doclose = SC_RX_TIMEOUT;
+		i = -1;
+	} else {
+		i = V1F_FetchRespHdr(bo);
+	}
+	if (i == 0) {
+		AN(bo->htc->priv);
+		http_VSL_log(bo->beresp);
+		return (0);
+	}
+	CHECK_OBJ_NOTNULL(bo->htc->doclose, STREAM_CLOSE_MAGIC);
+
+	INIT_OBJ(ctx, VRT_CTX_MAGIC);
+	VCL_Bo2Ctx(ctx, bo);
+	vbe_dir_finish(ctx, d);
+	AZ(bo->htc);
+	if (i > 0 && extrachance && bo->no_retry == NULL) {
+		VSC_C_main->backend_retry++;
+		i = vbe_dir_gethdrs_int(ctx, d, 0);
+		if (i == 0)
+			return (0);
+	}
+	bo->director_state = DIR_S_NULL;
+	return (-1);
+}
+
 static VCL_IP v_matchproto_(vdi_getip_f)
 vbe_dir_getip(VRT_CTX, VCL_BACKEND d)
 {
@@ -473,7 +641,9 @@ vbe_dir_getip(VRT_CTX, VCL_BACKEND d)
 	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
 	CHECK_OBJ_NOTNULL(ctx->bo, BUSYOBJ_MAGIC);
 	CHECK_OBJ_NOTNULL(ctx->bo->htc, HTTP_CONN_MAGIC);
-	pfd = ctx->bo->htc->priv;
+	pfd = H2F_Pfd(ctx->bo->htc);
+	if (pfd == NULL)
+		pfd = ctx->bo->htc->priv;
 
 	return (VCP_GetIp(pfd));
 }
@@ -505,7 +675,7 @@ vbe_dir_http1pipe(VRT_CTX, VCL_BACKEND d)
 	ctx->req->res_mode = RES_PIPE;
 
 	retval = SC_TX_ERROR;
-	pfd = vbe_dir_getfd(ctx, ctx->req->wrk, d, bp, 0);
+	pfd = vbe_dir_getfd(ctx, ctx->req->wrk, d, bp, 0, 0);
 
 	if (pfd != NULL) {
 		CHECK_OBJ_NOTNULL(ctx->bo->htc, HTTP_CONN_MAGIC);
@@ -568,6 +738,8 @@ vbe_free(struct backend *be)
 	Lck_Lock(&backends_mtx);
 	VSC_C_main->n_backend--;
 	Lck_Unlock(&backends_mtx);
+	if (be->h2f != NULL)
+		H2F_Destroy(&be->h2f);
 	VCP_Rel(&be->conn_pool);
 
 #define DA(x)	do { if (be->x != NULL) free(be->x); } while (0)
@@ -860,6 +1032,8 @@ VRT_new_backend_clustered(VRT_CTX, struct vsmw_cluster *vc,
 	AN(vep);
 	be->conn_pool = VCP_Ref(vep, vbe_proto_ident);
 	AN(be->conn_pool);
+	if (be->http2)
+		be->h2f = H2F_New(be->conn_pool);
 
 	vbp = vrt->probe;
 	if (vbp == NULL)
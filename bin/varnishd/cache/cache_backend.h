@@ -44,6 +44,7 @@ struct vrt_ctx;
 struct vrt_backend_probe;
 struct conn_pool;
 struct connwait;
+struct h2f_pool;
 
 /*--------------------------------------------------------------------
  * An instance of a backend from a VCL program.
@@ -68,6 +69,7 @@ struct backend {
 	struct VSC_vbe		*vsc;
 
 	struct conn_pool	*conn_pool;
+	struct h2f_pool		*h2f;
 
 	VCL_BACKEND		director;
 
@@ -94,6 +94,7 @@ BAN_Free(struct ban *b)
 	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
 	AZ(b->refcount);
 	assert(VTAILQ_EMPTY(&b->objcore));
+	AZ(b->ix);
 
 	if (b->spec != NULL)
 		free(b->spec);
@@ -182,6 +183,7 @@ ban_mark_completed(struct ban *b)
 	AN(b->spec);
 	if (!(b->flags & BANS_FLAG_COMPLETED)) {
 		ln = ban_len(b->spec);
+		ban_ix_remove(b);
 		b->flags |= BANS_FLAG_COMPLETED;
 		b->spec[BANS_FLAGS] |= BANS_FLAG_COMPLETED;
 		VWMB();
@@ -242,6 +244,33 @@ ban_iter(const uint8_t **bs, struct ban_test *bt)
 		bt->arg2_spec = ban_get_lump(bs);
 }
 
+/*--------------------------------------------------------------------
+ * Check if a ban is a single obj.http.* equality test, which is what
+ * the ban index can handle.
+ */
+
+int
+ban_get_objhttp_eq(const uint8_t *bs, const char **hdr, const char **val)
+{
+	struct ban_test bt;
+	const uint8_t *be;
+
+	AN(hdr);
+	AN(val);
+	be = bs + ban_len(bs);
+	bs += BANS_HEAD_LEN;
+	if (bs >= be)
+		return (0);
+	ban_iter(&bs, &bt);
+	if (bs < be)
+		return (0);
+	if (bt.arg1 != BANS_ARG_OBJHTTP || bt.oper != BANS_OPER_EQ)
+		return (0);
+	*hdr = bt.arg1_spec;
+	*val = bt.arg2;
+	return (1);
+}
+
 /*--------------------------------------------------------------------
  * A new object is created, grab a reference to the newest ban
  */
@@ -428,6 +457,7 @@ ban_reload(const uint8_t *ban, unsigned len)
 		VTAILQ_INSERT_TAIL(&ban_head, b2, list);
 	else
 		VTAILQ_INSERT_BEFORE(b, b2, list);
+	ban_ix_insert(b2);
 	bans_persisted_bytes += len;
 	VSC_C_main->bans_persisted_bytes = bans_persisted_bytes;
 
@@ -450,6 +480,7 @@ void
 BAN_Reload(const uint8_t *ptr, unsigned len)
 {
 	const uint8_t *pe;
+	struct ban *b;
 	unsigned l;
 
 	AZ(ban_shutdown);
@@ -464,6 +495,9 @@ BAN_Reload(const uint8_t *ptr, unsigned len)
 		ban_reload(ptr, l);
 		ptr += l;
 	}
+	/* Bans went in out of order, redo the ban index chain */
+	VTAILQ_FOREACH_REVERSE(b, &ban_head, banhead_s, list)
+		ban_ix_link(b);
 	Lck_Unlock(&ban_mtx);
 }
 
@@ -630,6 +664,7 @@ BAN_CheckObject(struct worker *wrk, struct objcore *oc, struct req *req)
 	struct ban *b;
 	struct vsl_log *vsl;
 	struct ban *b0, *bn;
+	struct ban_ix_snap snap;
 	unsigned tests;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
@@ -653,8 +688,10 @@ BAN_CheckObject(struct worker *wrk, struct objcore *oc, struct req *req)
 	Lck_Lock(&ban_mtx);
 	b0 = ban_start;
 	bn = oc->ban;
-	if (b0 != bn)
+	if (b0 != bn) {
 		bn->refcount++;
+		ban_ix_snapshot(&snap);
+	}
 	Lck_Unlock(&ban_mtx);
 
 	AN(bn);
@@ -666,17 +703,25 @@ BAN_CheckObject(struct worker *wrk, struct objcore *oc, struct req *req)
 	AN(bn);
 
 	/*
+	 * Indexed bans are checked with one lookup per header, the
+	 * rest one by one.
+	 *
 	 * This loop is safe without locks, because we know we hold
 	 * a refcount on a ban somewhere in the list and we do not
 	 * inspect the list past that ban.
 	 */
 	tests = 0;
-	for (b = b0; b != bn; b = VTAILQ_NEXT(b, list)) {
-		CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
-		if (b->flags & BANS_FLAG_COMPLETED)
-			continue;
-		if (ban_evaluate(wrk, b->spec, oc, req->http, &tests))
-			break;
+	if (ban_ix_check(wrk, oc, &snap, ban_time(bn->spec), INFINITY,
+	    &tests)) {
+		b = b0;
+	} else {
+		for (b = b0; b != bn; b = ban_ix_next(b, bn)) {
+			CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+			if (b->indexed || b->flags & BANS_FLAG_COMPLETED)
+				continue;
+			if (ban_evaluate(wrk, b->spec, oc, req->http, &tests))
+				break;
+		}
 	}
 
 	Lck_Lock(&ban_mtx);
@@ -130,6 +130,13 @@ struct ban {
 
 	VTAILQ_HEAD(,objcore)	objcore;
 	uint8_t			*spec;
+
+	/* see cache_ban_index.c */
+	unsigned		indexed;
+	struct ban_ix		*ix;
+	VTAILQ_ENTRY(ban)	ix_list;
+	struct ban		*nx;
+	vtim_real		nx_time;
 };
 
 VTAILQ_HEAD(banhead_s,ban);
@@ -155,3 +162,23 @@ vtim_real ban_time(const uint8_t *banspec);
 int ban_equal(const uint8_t *bs1, const uint8_t *bs2);
 void BAN_Free(struct ban *b);
 void ban_kick_lurker(void);
+int ban_get_objhttp_eq(const uint8_t *bs, const char **hdr, const char **val);
+
+/* cache_ban_index.c */
+#define BAN_IX_MAXHDR		8
+#define BAN_IX_HDRLEN		64
+
+struct ban_ix_snap {
+	unsigned		n;
+	unsigned		slot[BAN_IX_MAXHDR];
+	char			hdr[BAN_IX_MAXHDR][BAN_IX_HDRLEN];
+};
+
+void ban_ix_insert(struct ban *);
+void ban_ix_remove(struct ban *);
+void ban_ix_link(struct ban *);
+struct ban *ban_ix_next(const struct ban *b, const struct ban *bn);
+void ban_ix_snapshot(struct ban_ix_snap *);
+int ban_ix_check(struct worker *, struct objcore *,
+    const struct ban_ix_snap *, vtim_real t_lo, vtim_real t_hi,
+    unsigned *tests);
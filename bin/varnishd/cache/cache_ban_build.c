@@ -366,6 +366,8 @@ BAN_Commit(struct ban_proto *bp)
 	}
 	bi = VTAILQ_FIRST(&ban_head);
 	VTAILQ_INSERT_HEAD(&ban_head, b, list);
+	ban_ix_insert(b);
+	ban_ix_link(b);
 	ban_start = b;
 
 	VSC_C_main->bans++;
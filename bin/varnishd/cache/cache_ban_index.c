@@ -0,0 +1,312 @@
+/*-
+ * Copyright (c) 2026 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Ban index
+ *
+ * Bans consisting of a single "obj.http.<hdr> == <value>" test are kept
+ * in a tree keyed by header and value, so an object can be checked
+ * against all of them with one lookup per header, instead of evaluating
+ * them one by one.  This is what tag based invalidation schemes produce
+ * by the thousands.
+ *
+ * A ban is in the tree from when it is added until it is completed, all
+ * under ban_mtx.  Whether a ban is indexed never changes, and every ban
+ * has a shortcut (nx) to the next older ban which is not indexed, so the
+ * unlocked walk in BAN_CheckObject() only visits bans it must evaluate.
+ * The time of that ban is kept alongside, so we can tell if it is past
+ * the ban we hold a reference on, and may be gone, without looking.
+ *
+ * Only BAN_IX_MAXHDR different headers are indexed at a time, bans on
+ * further headers are evaluated the normal way.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache_varnishd.h"
+#include "cache_ban.h"
+
+#include "vtree.h"
+
+struct ban_ix {
+	unsigned		magic;
+#define BAN_IX_MAGIC		0x3f1b95a6
+	unsigned		slot;
+	char			*val;
+	VRBT_ENTRY(ban_ix)	entry;
+	struct banhead_s	bans;		/* newest first */
+};
+
+static struct ban_ixhdr {
+	unsigned		nban;
+	char			hdr[BAN_IX_HDRLEN];
+} ban_ixhdr[BAN_IX_MAXHDR];
+
+static VRBT_HEAD(ban_ix_tree, ban_ix) ban_ix_tree =
+    VRBT_INITIALIZER(&ban_ix_tree);
+
+static inline int
+ban_ix_cmp(const struct ban_ix *a, const struct ban_ix *b)
+{
+	if (a->slot != b->slot)
+		return (a->slot < b->slot ? -1 : 1);
+	return (strcmp(a->val, b->val));
+}
+
+VRBT_GENERATE_INSERT_COLOR(ban_ix_tree, ban_ix, entry, static)
+VRBT_GENERATE_INSERT_FINISH(ban_ix_tree, ban_ix, entry, static)
+VRBT_GENERATE_INSERT(ban_ix_tree, ban_ix, entry, ban_ix_cmp, static)
+VRBT_GENERATE_REMOVE_COLOR(ban_ix_tree, ban_ix, entry, static)
+VRBT_GENERATE_REMOVE(ban_ix_tree, ban_ix, entry, static)
+VRBT_GENERATE_FIND(ban_ix_tree, ban_ix, entry, ban_ix_cmp, static)
+
+static struct ban_ix *
+ban_ix_find(unsigned slot, const char *val)
+{
+	struct ban_ix k;
+
+	INIT_OBJ(&k, BAN_IX_MAGIC);
+	k.slot = slot;
+	k.val = TRUST_ME(val);
+	return (VRBT_FIND(ban_ix_tree, &ban_ix_tree, &k));
+}
+
+/*--------------------------------------------------------------------
+ * Find the header slot, claiming a free one if need be.
+ * The header is in ban spec format: length, "name:", NUL.
+ */
+
+static int
+ban_ix_slot(const char *hdr)
+{
+	int u, f = -1;
+
+	for (u = 0; u < BAN_IX_MAXHDR; u++) {
+		if (ban_ixhdr[u].nban == 0) {
+			if (f < 0)
+				f = u;
+			continue;
+		}
+		if (!strcasecmp(ban_ixhdr[u].hdr + 1, hdr + 1))
+			return (u);
+	}
+	if (f >= 0)
+		memcpy(ban_ixhdr[f].hdr, hdr, hdr[0] + 2L);
+	return (f);
+}
+
+void
+ban_ix_insert(struct ban *b)
+{
+	const char *hdr, *val;
+	struct ban_ix *ix;
+	struct ban *bi;
+	vtim_real t;
+	int slot;
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	Lck_AssertHeld(&ban_mtx);
+	AZ(b->indexed);
+	AZ(b->ix);
+
+	if (!cache_param->ban_index)
+		return;
+	if (b->flags & (BANS_FLAG_REQ | BANS_FLAG_COMPLETED))
+		return;
+	if (!ban_get_objhttp_eq(b->spec, &hdr, &val))
+		return;
+	if (hdr[0] + 2 > BAN_IX_HDRLEN)
+		return;
+	slot = ban_ix_slot(hdr);
+	if (slot < 0)
+		return;
+
+	ix = ban_ix_find(slot, val);
+	if (ix == NULL) {
+		ALLOC_OBJ(ix, BAN_IX_MAGIC);
+		if (ix == NULL)
+			return;
+		ix->slot = slot;
+		REPLACE(ix->val, val);
+		VTAILQ_INIT(&ix->bans);
+		AZ(VRBT_INSERT(ban_ix_tree, &ban_ix_tree, ix));
+	}
+
+	t = ban_time(b->spec);
+	VTAILQ_FOREACH(bi, &ix->bans, ix_list)
+		if (ban_time(bi->spec) < t)
+			break;
+	if (bi != NULL)
+		VTAILQ_INSERT_BEFORE(bi, b, ix_list);
+	else
+		VTAILQ_INSERT_TAIL(&ix->bans, b, ix_list);
+
+	ban_ixhdr[slot].nban++;
+	b->ix = ix;
+	b->indexed = 1;
+	VSC_C_main->bans_indexed++;
+}
+
+void
+ban_ix_remove(struct ban *b)
+{
+	struct ban_ix *ix;
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	Lck_AssertHeld(&ban_mtx);
+
+	ix = b->ix;
+	if (ix == NULL)
+		return;
+	CHECK_OBJ(ix, BAN_IX_MAGIC);
+	AN(b->indexed);
+	VTAILQ_REMOVE(&ix->bans, b, ix_list);
+	b->ix = NULL;
+	assert(ban_ixhdr[ix->slot].nban > 0);
+	ban_ixhdr[ix->slot].nban--;
+	VSC_C_main->bans_indexed--;
+	if (VTAILQ_EMPTY(&ix->bans)) {
+		VRBT_REMOVE(ban_ix_tree, &ban_ix_tree, ix);
+		free(ix->val);
+		FREE_OBJ(ix);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Set up the shortcut to the next older unindexed ban, the older bans
+ * must already have theirs.
+ */
+
+void
+ban_ix_link(struct ban *b)
+{
+	struct ban *nb;
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	Lck_AssertHeld(&ban_mtx);
+
+	nb = VTAILQ_NEXT(b, list);
+	if (nb == NULL) {
+		b->nx = NULL;
+		b->nx_time = 0;
+	} else if (!nb->indexed) {
+		b->nx = nb;
+		b->nx_time = ban_time(nb->spec);
+	} else {
+		b->nx = nb->nx;
+		b->nx_time = nb->nx_time;
+	}
+}
+
+struct ban *
+ban_ix_next(const struct ban *b, const struct ban *bn)
+{
+
+	CHECK_OBJ_NOTNULL(b, BAN_MAGIC);
+	CHECK_OBJ_NOTNULL(bn, BAN_MAGIC);
+	if (b->nx == NULL || b->nx_time <= ban_time(bn->spec))
+		return (TRUST_ME(bn));
+	return (b->nx);
+}
+
+/*--------------------------------------------------------------------
+ * Take note of the indexed headers, so we can get them from the object
+ * without holding ban_mtx.
+ */
+
+void
+ban_ix_snapshot(struct ban_ix_snap *snap)
+{
+	unsigned u;
+
+	AN(snap);
+	Lck_AssertHeld(&ban_mtx);
+	snap->n = 0;
+	for (u = 0; u < BAN_IX_MAXHDR; u++) {
+		if (ban_ixhdr[u].nban == 0)
+			continue;
+		snap->slot[snap->n] = u;
+		memcpy(snap->hdr[snap->n], ban_ixhdr[u].hdr,
+		    ban_ixhdr[u].hdr[0] + 2L);
+		snap->n++;
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Check if an indexed ban newer than t_lo, but not newer than t_hi
+ * matches the object.
+ */
+
+int
+ban_ix_check(struct worker *wrk, struct objcore *oc,
+    const struct ban_ix_snap *snap, vtim_real t_lo, vtim_real t_hi,
+    unsigned *tests)
+{
+	const char *val[BAN_IX_MAXHDR];
+	const struct ban_ix *ix;
+	const struct ban *b;
+	unsigned u, slot;
+	vtim_real t;
+	int r = 0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AN(snap);
+	AN(tests);
+
+	if (snap->n == 0)
+		return (0);
+	for (u = 0; u < snap->n; u++)
+		val[u] = HTTP_GetHdrPack(wrk, oc, snap->hdr[u]);
+
+	Lck_Lock(&ban_mtx);
+	for (u = 0; u < snap->n && r == 0; u++) {
+		if (val[u] == NULL)
+			continue;
+		slot = snap->slot[u];
+		/* The slot may have been recycled for another header */
+		if (ban_ixhdr[slot].nban == 0 ||
+		    strcasecmp(ban_ixhdr[slot].hdr + 1, snap->hdr[u] + 1))
+			continue;
+		(*tests)++;
+		ix = ban_ix_find(slot, val[u]);
+		if (ix == NULL)
+			continue;
+		CHECK_OBJ(ix, BAN_IX_MAGIC);
+		VTAILQ_FOREACH(b, &ix->bans, ix_list) {
+			AZ(b->flags & BANS_FLAG_COMPLETED);
+			t = ban_time(b->spec);
+			if (t > t_hi)
+				continue;
+			r = t > t_lo;
+			break;
+		}
+	}
+	Lck_Unlock(&ban_mtx);
+	return (r);
+}
@@ -32,6 +32,8 @@
 
 #include "config.h"
 
+#include <stdlib.h>
+
 #include "cache_varnishd.h"
 
 #include "cache_ban.h"
@@ -39,11 +41,47 @@
 
 #include "vtim.h"
 
-static struct objcore oc_mark_cnt = { .magic = OBJCORE_MAGIC, };
-static struct objcore oc_mark_end = { .magic = OBJCORE_MAGIC, };
-static unsigned ban_batch;
+/*
+ * The lurker thread walks the ban list and makes a job for each ban it
+ * needs to test the objects of.  The jobs are run by the lurker thread
+ * and ban_lurker_threads - 1 helpers, the objects of one ban are only
+ * ever tested by one of them.  Everything else, notably ban completion
+ * and ban_cleantail(), is done by the lurker thread once all jobs are
+ * done.
+ */
+
+struct ban_lurker_wrk {
+	unsigned		magic;
+#define BAN_LURKER_WRK_MAGIC	0x1d2cb5a8
+	unsigned		batch;
+	struct worker		*wrk;
+	struct vsl_log		vsl;
+	struct objcore		mark_cnt;
+	struct objcore		mark_end;
+	pthread_t		thread;
+};
+
+struct ban_lurker_job {
+	struct ban		*bt;
+	struct ban		*bd;
+	struct ban		*ostart;	/* oldest oban newer than bt */
+	vtim_real		t_hi;		/* newest iban, 0 if none */
+	int			kill;
+};
+
 static unsigned ban_generation;
 
+static struct ban_lurker_wrk *ban_lurker_wrks;
+static unsigned ban_lurker_nwrk;
+static struct ban_lurker_job *ban_lurker_jobs;
+static unsigned ban_lurker_njob;
+static unsigned ban_lurker_ljob;
+static unsigned ban_lurker_runjob;	/* njob, once the helpers may run */
+static unsigned ban_lurker_nextjob;
+static unsigned ban_lurker_busy;
+static pthread_cond_t ban_lurker_helper_cond;
+static pthread_cond_t ban_lurker_done_cond;
+
 pthread_cond_t	ban_lurker_cond;
 
 void
@@ -55,16 +93,40 @@ ban_kick_lurker(void)
 	PTOK(pthread_cond_signal(&ban_lurker_cond));
 }
 
+static void
+ban_cleantail_list(const struct banhead_s *freelist, struct banhead_s *obans)
+{
+	struct ban *b, *bt;
+
+	/* oban order is head to tail, freelist tail to head */
+	if (obans != NULL)
+		bt = VTAILQ_LAST(obans, banhead_s);
+	else
+		bt = NULL;
+
+	if (bt != NULL) {
+		AN(obans);
+		VTAILQ_FOREACH(b, freelist, list) {
+			if (b != bt)
+				continue;
+			VTAILQ_REMOVE(obans, b, l_list);
+			bt = VTAILQ_LAST(obans, banhead_s);
+			if (bt == NULL)
+				break;
+		}
+	}
+}
+
 /*
  * ban_cleantail: clean the tail of the ban list up to the first ban which is
  * still referenced. For already completed bans, we update statistics
  * accordingly, but otherwise just skip the completion step and remove directly
  *
- * if an obans list is passed, we clean its tail as well
+ * if obans lists are passed, we clean their tails as well
  */
 
 static void
-ban_cleantail(struct banhead_s *obans)
+ban_cleantail(struct banhead_s *obans, struct banhead_s *ibans)
 {
 	struct ban *b, *bt;
 	struct banhead_s freelist = VTAILQ_HEAD_INITIALIZER(freelist);
@@ -86,6 +148,7 @@ ban_cleantail(struct banhead_s *obans)
 				VSC_C_main->bans_req--;
 			VSC_C_main->bans--;
 			VSC_C_main->bans_deleted++;
+			ban_ix_remove(b);
 			VTAILQ_REMOVE(&ban_head, b, list);
 			VTAILQ_INSERT_TAIL(&freelist, b, list);
 			bans_persisted_fragmentation +=
@@ -100,23 +163,8 @@ ban_cleantail(struct banhead_s *obans)
 
 	Lck_Unlock(&ban_mtx);
 
-	/* oban order is head to tail, freelist tail to head */
-	if (obans != NULL)
-		bt = VTAILQ_LAST(obans, banhead_s);
-	else
-		bt = NULL;
-
-	if (bt != NULL) {
-		AN(obans);
-		VTAILQ_FOREACH(b, &freelist, list) {
-			if (b != bt)
-				continue;
-			VTAILQ_REMOVE(obans, b, l_list);
-			bt = VTAILQ_LAST(obans, banhead_s);
-			if (bt == NULL)
-				break;
-		}
-	}
+	ban_cleantail_list(&freelist, obans);
+	ban_cleantail_list(&freelist, ibans);
 
 	VTAILQ_FOREACH_SAFE(b, &freelist, list, bt)
 		BAN_Free(b);
@@ -137,24 +185,29 @@ ban_cleantail(struct banhead_s *obans)
  */
 
 static struct objcore *
-ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
+ban_lurker_getfirst(struct ban_lurker_wrk *lw, struct ban *bt)
 {
 	struct objhead *oh;
 	struct objcore *oc, *noc;
+	struct objcore *oc_mark_cnt, *oc_mark_end;
 	int move_oc = 1;
 
+	CHECK_OBJ_NOTNULL(lw, BAN_LURKER_WRK_MAGIC);
+	oc_mark_cnt = &lw->mark_cnt;
+	oc_mark_end = &lw->mark_end;
+
 	Lck_Lock(&ban_mtx);
 
 	oc = VTAILQ_FIRST(&bt->objcore);
 	while (1) {
 		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
-		if (oc == &oc_mark_cnt) {
-			if (VTAILQ_NEXT(oc, ban_list) == &oc_mark_end) {
+		if (oc == oc_mark_cnt) {
+			if (VTAILQ_NEXT(oc, ban_list) == oc_mark_end) {
 				/* done with this ban's oc list */
-				VTAILQ_REMOVE(&bt->objcore, &oc_mark_cnt,
+				VTAILQ_REMOVE(&bt->objcore, oc_mark_cnt,
 				    ban_list);
-				VTAILQ_REMOVE(&bt->objcore, &oc_mark_end,
+				VTAILQ_REMOVE(&bt->objcore, oc_mark_end,
 				    ban_list);
 				oc = NULL;
 				break;
@@ -162,23 +215,23 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 			oc = VTAILQ_NEXT(oc, ban_list);
 			CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 			move_oc = 0;
-		} else if (oc == &oc_mark_end) {
+		} else if (oc == oc_mark_end) {
 			assert(move_oc == 0);
 
 			/* hold off to give lookup a chance and reiterate */
 			VSC_C_main->bans_lurker_contention++;
 			Lck_Unlock(&ban_mtx);
-			VSL_Flush(vsl, 0);
+			VSL_Flush(&lw->vsl, 0);
 			VTIM_sleep(cache_param->ban_lurker_holdoff);
 			Lck_Lock(&ban_mtx);
 
 			oc = VTAILQ_FIRST(&bt->objcore);
-			assert(oc == &oc_mark_cnt);
+			assert(oc == oc_mark_cnt);
 			continue;
 		}
 
-		assert(oc != &oc_mark_cnt);
-		assert(oc != &oc_mark_end);
+		assert(oc != oc_mark_cnt);
+		assert(oc != oc_mark_end);
 
 		oh = oc->objhead;
 		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
@@ -219,7 +272,7 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 		if (move_oc) {
 			/* contested ocs go between the two markers */
 			VTAILQ_REMOVE(&bt->objcore, oc, ban_list);
-			VTAILQ_INSERT_BEFORE(&oc_mark_end, oc, ban_list);
+			VTAILQ_INSERT_BEFORE(oc_mark_end, oc, ban_list);
 		}
 
 		oc = noc;
@@ -228,17 +281,35 @@ ban_lurker_getfirst(struct vsl_log *vsl, struct ban *bt)
 	return (oc);
 }
 
+/*
+ * The obans from job->ostart up are the bans to evaluate one by one,
+ * indexed bans up to job->t_hi are checked with a lookup.
+ */
+
 static void
-ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
-    struct banhead_s *obans, struct ban *bd, int kill)
+ban_lurker_test_ban(struct ban_lurker_wrk *lw,
+    const struct ban_lurker_job *job)
 {
-	struct ban *bl, *bln;
+	struct worker *wrk;
+	struct vsl_log *vsl;
+	struct ban *bl, *bt, *bd;
 	struct objcore *oc;
+	struct ban_ix_snap snap;
+	vtim_real t_lo;
 	unsigned tests;
-	int i;
+	int i, kill;
 	uint64_t tested = 0, tested_tests = 0, lok = 0, lokc = 0;
 
+	CHECK_OBJ_NOTNULL(lw, BAN_LURKER_WRK_MAGIC);
+	wrk = lw->wrk;
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	vsl = &lw->vsl;
+	AN(job);
+	bt = job->bt;
+	CHECK_OBJ_NOTNULL(bt, BAN_MAGIC);
+	bd = job->bd;
+	CHECK_OBJ_NOTNULL(bd, BAN_MAGIC);
+	kill = job->kill;
 
 	/*
 	 * First see if there is anything to do, and if so, insert markers
@@ -246,19 +317,22 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
 	Lck_Lock(&ban_mtx);
 	oc = VTAILQ_FIRST(&bt->objcore);
 	if (oc != NULL) {
-		VTAILQ_INSERT_TAIL(&bt->objcore, &oc_mark_cnt, ban_list);
-		VTAILQ_INSERT_TAIL(&bt->objcore, &oc_mark_end, ban_list);
+		VTAILQ_INSERT_TAIL(&bt->objcore, &lw->mark_cnt, ban_list);
+		VTAILQ_INSERT_TAIL(&bt->objcore, &lw->mark_end, ban_list);
 	}
+	ban_ix_snapshot(&snap);
 	Lck_Unlock(&ban_mtx);
 	if (oc == NULL)
 		return;
 
+	t_lo = ban_time(bt->spec);
+
 	while (1) {
-		if (++ban_batch > cache_param->ban_lurker_batch) {
+		if (++lw->batch > cache_param->ban_lurker_batch) {
 			VTIM_sleep(cache_param->ban_lurker_sleep);
-			ban_batch = 0;
+			lw->batch = 0;
 		}
-		oc = ban_lurker_getfirst(vsl, bt);
+		oc = ban_lurker_getfirst(lw, bt);
 		if (oc == NULL) {
 			if (tested == 0 && lokc == 0) {
 				AZ(tested_tests);
@@ -274,8 +348,20 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
 			return;
 		}
 		i = 0;
-		VTAILQ_FOREACH_REVERSE_SAFE(bl, obans, banhead_s, l_list, bln) {
-			if (oc->ban != bt) {
+		if (job->t_hi > 0. && oc->ban == bt) {
+			if (kill == 1)
+				i = 1;
+			else {
+				tests = 0;
+				i = ban_ix_check(wrk, oc, &snap, t_lo,
+				    job->t_hi, &tests);
+				tested++;
+				tested_tests += tests;
+			}
+		}
+		for (bl = job->ostart; bl != NULL;
+		    bl = VTAILQ_PREV(bl, banhead_s, l_list)) {
+			if (i || oc->ban != bt) {
 				/*
 				 * HSH_Lookup() grabbed this oc, killed
 				 * it or tested it to top.  We're done.
@@ -284,7 +370,6 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
 			}
 			if (bl->flags & BANS_FLAG_COMPLETED) {
 				/* Ban was overtaken by new (dup) ban */
-				VTAILQ_REMOVE(obans, bl, l_list);
 				continue;
 			}
 			if (kill == 1)
@@ -297,21 +382,20 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
 				tested++;
 				tested_tests += tests;
 			}
-			if (i) {
-				if (kill) {
-					VSLb(vsl, SLT_ExpBan,
-					    "%ju killed for lurker cutoff",
-					    VXID(ObjGetXID(wrk, oc)));
-					lokc++;
-				} else {
-					VSLb(vsl, SLT_ExpBan,
-					    "%ju banned by lurker",
-					    VXID(ObjGetXID(wrk, oc)));
-					lok++;
-				}
-				HSH_Kill(oc);
-				break;
+		}
+		if (i) {
+			if (kill) {
+				VSLb(vsl, SLT_ExpBan,
+				    "%ju killed for lurker cutoff",
+				    VXID(ObjGetXID(wrk, oc)));
+				lokc++;
+			} else {
+				VSLb(vsl, SLT_ExpBan,
+				    "%ju banned by lurker",
+				    VXID(ObjGetXID(wrk, oc)));
+				lok++;
 			}
+			HSH_Kill(oc);
 		}
 		if (i == 0 && oc->ban == bt) {
 			Lck_Lock(&ban_mtx);
@@ -336,6 +420,93 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Run jobs until there are none left, called with ban_mtx held.
+ */
+
+static void
+ban_lurker_run(struct ban_lurker_wrk *lw)
+{
+	struct ban_lurker_job *job;
+
+	CHECK_OBJ_NOTNULL(lw, BAN_LURKER_WRK_MAGIC);
+	Lck_AssertHeld(&ban_mtx);
+	while (ban_lurker_nextjob < ban_lurker_runjob) {
+		job = &ban_lurker_jobs[ban_lurker_nextjob++];
+		ban_lurker_busy++;
+		Lck_Unlock(&ban_mtx);
+		ban_lurker_test_ban(lw, job);
+		Lck_Lock(&ban_mtx);
+		assert(ban_lurker_busy > 0);
+		ban_lurker_busy--;
+	}
+	if (ban_lurker_busy == 0)
+		PTOK(pthread_cond_signal(&ban_lurker_done_cond));
+}
+
+static void
+ban_lurker_add_job(struct ban *bt, struct ban *bd,
+    const struct banhead_s *obans, const struct banhead_s *ibans, int kill)
+{
+	struct ban_lurker_job *job;
+
+	if (ban_lurker_njob == ban_lurker_ljob) {
+		ban_lurker_ljob = ban_lurker_ljob ? ban_lurker_ljob * 2 : 64;
+		ban_lurker_jobs = realloc(ban_lurker_jobs,
+		    ban_lurker_ljob * sizeof *ban_lurker_jobs);
+		AN(ban_lurker_jobs);
+	}
+	job = &ban_lurker_jobs[ban_lurker_njob++];
+	job->bt = bt;
+	job->bd = bd;
+	job->ostart = VTAILQ_LAST(obans, banhead_s);
+	if (VTAILQ_EMPTY(ibans))
+		job->t_hi = 0.;
+	else
+		job->t_hi = ban_time(VTAILQ_FIRST(ibans)->spec);
+	job->kill = kill;
+}
+
+static void
+ban_lurker_run_jobs(struct ban_lurker_wrk *lw)
+{
+
+	Lck_Lock(&ban_mtx);
+	AZ(ban_lurker_busy);
+	AZ(ban_lurker_nextjob);
+	ban_lurker_runjob = ban_lurker_njob;
+	if (ban_lurker_njob > 1)
+		PTOK(pthread_cond_broadcast(&ban_lurker_helper_cond));
+	ban_lurker_run(lw);
+	while (ban_lurker_busy > 0)
+		(void)Lck_CondWait(&ban_lurker_done_cond, &ban_mtx);
+	ban_lurker_runjob = ban_lurker_nextjob = 0;
+	Lck_Unlock(&ban_mtx);
+	ban_lurker_njob = 0;
+}
+
+static void * v_matchproto_(bgthread_t)
+ban_lurker_helper(struct worker *wrk, void *priv)
+{
+	struct ban_lurker_wrk *lw;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(lw, priv, BAN_LURKER_WRK_MAGIC);
+	lw->wrk = wrk;
+	VSL_Setup(&lw->vsl, NULL, 0);
+
+	Lck_Lock(&ban_mtx);
+	while (!ban_shutdown) {
+		ban_lurker_run(lw);
+		VSL_Flush(&lw->vsl, 0);
+		Pool_Sumstat(wrk);
+		(void)Lck_CondWait(&ban_lurker_helper_cond, &ban_mtx);
+		lw->batch = 0;
+	}
+	Lck_Unlock(&ban_mtx);
+	return (NULL);
+}
+
 /*--------------------------------------------------------------------
  * Ban lurker thread:
  *
@@ -347,19 +518,19 @@ ban_lurker_test_ban(struct worker *wrk, struct vsl_log *vsl, struct ban *bt,
  */
 
 static vtim_dur
-ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
+ban_lurker_work(struct ban_lurker_wrk *lw)
 {
 	struct ban *b, *bd;
-	struct banhead_s obans;
+	struct banhead_s obans, ibans;
 	vtim_real d;
 	vtim_dur dt, n;
 	unsigned count = 0, cutoff = UINT_MAX;
 
-	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(lw, BAN_LURKER_WRK_MAGIC);
 
 	dt = 49.62;		// Random, non-magic
 	if (cache_param->ban_lurker_sleep == 0) {
-		ban_cleantail(NULL);
+		ban_cleantail(NULL, NULL);
 		return (dt);
 	}
 	if (cache_param->ban_cutoff > 0)
@@ -371,9 +542,10 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 	d = VTIM_real() - cache_param->ban_lurker_age;
 	bd = NULL;
 	VTAILQ_INIT(&obans);
+	VTAILQ_INIT(&ibans);
 	for (; b != NULL; b = VTAILQ_NEXT(b, list), count++) {
 		if (bd != NULL)
-			ban_lurker_test_ban(wrk, vsl, b, &obans, bd,
+			ban_lurker_add_job(b, bd, &obans, &ibans,
 			    count > cutoff ? 1 : 0);
 		if (b->flags & BANS_FLAG_COMPLETED)
 			continue;
@@ -384,7 +556,8 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 		}
 		n = ban_time(b->spec) - d;
 		if (n < 0) {
-			VTAILQ_INSERT_TAIL(&obans, b, l_list);
+			VTAILQ_INSERT_TAIL(b->indexed ? &ibans : &obans,
+			    b, l_list);
 			if (bd == NULL)
 				bd = b;
 		} else if (n < dt) {
@@ -392,19 +565,28 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 		}
 	}
 
+	ban_lurker_run_jobs(lw);
+
 	/*
 	 * conceptually, all obans are now completed. Remove the tail.
 	 * If any bans to be completed remain after the tail is cut,
 	 * mark them completed
 	 */
-	ban_cleantail(&obans);
-
-	if (VTAILQ_FIRST(&obans) == NULL)
-		return (dt);
+	ban_cleantail(&obans, &ibans);
 
 	Lck_Lock(&ban_mtx);
 	VTAILQ_FOREACH(b, &obans, l_list)
 		ban_mark_completed(b);
+	VTAILQ_FOREACH(b, &ibans, l_list)
+		ban_mark_completed(b);
+
+	/*
+	 * Completed bans still held by objects on their way out, come
+	 * back for them soon rather than when the next ban is due.
+	 */
+	b = VTAILQ_LAST(&ban_head, banhead_s);
+	if (b != VTAILQ_FIRST(&ban_head) && b->flags & BANS_FLAG_COMPLETED)
+		dt = vmin_t(vtim_dur, dt, cache_param->ban_lurker_sleep);
 	Lck_Unlock(&ban_mtx);
 	return (dt);
 }
@@ -412,29 +594,57 @@ ban_lurker_work(struct worker *wrk, struct vsl_log *vsl)
 void * v_matchproto_(bgthread_t)
 ban_lurker(struct worker *wrk, void *priv)
 {
-	struct vsl_log vsl;
+	struct ban_lurker_wrk *lw;
 	vtim_dur dt;
 	unsigned gen = ban_generation + 1;
+	unsigned u;
+	void *status;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	AZ(priv);
 
-	VSL_Setup(&vsl, NULL, 0);
+	ban_lurker_nwrk = cache_param->ban_lurker_threads;
+	assert(ban_lurker_nwrk > 0);
+	ban_lurker_wrks = calloc(ban_lurker_nwrk, sizeof *ban_lurker_wrks);
+	AN(ban_lurker_wrks);
+	PTOK(pthread_cond_init(&ban_lurker_helper_cond, NULL));
+	PTOK(pthread_cond_init(&ban_lurker_done_cond, NULL));
+	for (u = 0; u < ban_lurker_nwrk; u++) {
+		lw = &ban_lurker_wrks[u];
+		INIT_OBJ(lw, BAN_LURKER_WRK_MAGIC);
+		lw->mark_cnt.magic = OBJCORE_MAGIC;
+		lw->mark_end.magic = OBJCORE_MAGIC;
+		if (u > 0)
+			WRK_BgThread(&lw->thread, "ban-lurker-helper",
+			    ban_lurker_helper, lw);
+	}
+
+	lw = &ban_lurker_wrks[0];
+	lw->wrk = wrk;
+	VSL_Setup(&lw->vsl, NULL, 0);
 
 	while (!ban_shutdown) {
-		dt = ban_lurker_work(wrk, &vsl);
+		dt = ban_lurker_work(lw);
 		if (DO_DEBUG(DBG_LURKER))
-			VSLb(&vsl, SLT_Debug, "lurker: sleep = %lf", dt);
+			VSLb(&lw->vsl, SLT_Debug, "lurker: sleep = %lf", dt);
 		Lck_Lock(&ban_mtx);
 		if (gen == ban_generation) {
 			Pool_Sumstat(wrk);
 			(void)Lck_CondWaitTimeout(
 			    &ban_lurker_cond, &ban_mtx, dt);
-			ban_batch = 0;
+			lw->batch = 0;
 		}
 		gen = ban_generation;
 		Lck_Unlock(&ban_mtx);
 	}
+
+	Lck_Lock(&ban_mtx);
+	PTOK(pthread_cond_broadcast(&ban_lurker_helper_cond));
+	Lck_Unlock(&ban_mtx);
+	for (u = 1; u < ban_lurker_nwrk; u++) {
+		PTOK(pthread_join(ban_lurker_wrks[u].thread, &status));
+		AZ(status);
+	}
 	pthread_exit(0);
 	NEEDLESS(return (NULL));
 }
@@ -34,6 +34,7 @@
 
 #include "config.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "cache_varnishd.h"
@@ -41,25 +42,60 @@
 
 #include "vbh.h"
 #include "vtim.h"
+#include "vtw.h"
+
+#include "VSC_exp.h"
+
+/*
+ * The expiry work is split over cache_param->expiry_shards shards, each
+ * with their own inbox, timer structure and thread.  An objcore always
+ * maps to the same shard, so it only ever lives in one of them.
+ *
+ * The timer structure is a binary heap, or a timing wheel if the
+ * expiry_wheel parameter is set.  The wheel has O(1) insert and rearm,
+ * but expires objects with EXP_WHEEL_TICK resolution.
+ */
+
+#define EXP_WHEEL_TICK	0.01
 
 struct exp_priv {
 	unsigned			magic;
 #define EXP_PRIV_MAGIC			0x9db22482
+	char				name[16];
+
 	/* shared */
 	struct lock			mtx;
 	VSTAILQ_HEAD(,objcore)		inbox;
 	pthread_cond_t			condvar;
+	struct VSC_exp			*stats;
 
 	/* owned by exp thread */
 	struct worker			*wrk;
 	struct vsl_log			vsl;
 	struct vbh			*heap;
+	struct vtw			*wheel;
 	pthread_t			thread;
+	struct vsc_seg			*vsc_seg;
+	uint64_t			summed_mailed;
+	uint64_t			summed_received;
+	uint64_t			summed_superseded;
 };
 
 static struct exp_priv *exphdl;
+static unsigned exp_nshard;
 static int exp_shutdown = 0;
 
+static inline struct exp_priv *
+exp_shard(const struct objcore *oc)
+{
+	struct exp_priv *ep;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	ep = &exphdl[((uintptr_t)oc / sizeof *oc) % exp_nshard];
+	CHECK_OBJ(ep, EXP_PRIV_MAGIC);
+	return (ep);
+}
+
 /*--------------------------------------------------------------------
  * Calculate an object's effective ttl time, taking req.ttl into account
  * if it is available.
@@ -101,26 +137,27 @@ EXP_Ttl_grace(const struct req *req, const struct objcore *oc)
  */
 
 static void
-exp_mail_it(struct objcore *oc, uint8_t cmds)
+exp_mail_it(struct exp_priv *ep, struct objcore *oc, uint8_t cmds)
 {
+	CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	assert(oc->refcnt > 0);
 	AZ(cmds & OC_EF_REFD);
 
-	Lck_AssertHeld(&exphdl->mtx);
+	Lck_AssertHeld(&ep->mtx);
 
 	if (oc->exp_flags & OC_EF_REFD) {
 		if (!(oc->exp_flags & OC_EF_POSTED)) {
 			if (cmds & OC_EF_REMOVE)
-				VSTAILQ_INSERT_HEAD(&exphdl->inbox,
+				VSTAILQ_INSERT_HEAD(&ep->inbox,
 				    oc, exp_list);
 			else
-				VSTAILQ_INSERT_TAIL(&exphdl->inbox,
+				VSTAILQ_INSERT_TAIL(&ep->inbox,
 				    oc, exp_list);
-			VSC_C_main->exp_mailed++;
+			ep->stats->c_mailed++;
 		}
 		oc->exp_flags |= cmds | OC_EF_POSTED;
-		PTOK(pthread_cond_signal(&exphdl->condvar));
+		PTOK(pthread_cond_signal(&ep->condvar));
 	}
 }
 
@@ -151,14 +188,16 @@ EXP_RefNewObjcore(struct objcore *oc)
 void
 EXP_Remove(struct objcore *oc, const struct objcore *new_oc)
 {
+	struct exp_priv *ep;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	CHECK_OBJ_ORNULL(new_oc, OBJCORE_MAGIC);
 
 	if (oc->exp_flags & OC_EF_REFD) {
-		Lck_Lock(&exphdl->mtx);
+		ep = exp_shard(oc);
+		Lck_Lock(&ep->mtx);
 		if (new_oc != NULL)
-			VSC_C_main->n_superseded++;
+			ep->stats->c_superseded++;
 		if (oc->exp_flags & OC_EF_NEW) {
 			/* EXP_Insert has not been called for this object
 			 * yet. Mark it for removal, and EXP_Insert will
@@ -166,8 +205,8 @@ EXP_Remove(struct objcore *oc, const struct objcore *new_oc)
 			AZ(oc->exp_flags & OC_EF_POSTED);
 			oc->exp_flags |= OC_EF_REMOVE;
 		} else
-			exp_mail_it(oc, OC_EF_REMOVE);
-		Lck_Unlock(&exphdl->mtx);
+			exp_mail_it(ep, oc, OC_EF_REMOVE);
+		Lck_Unlock(&ep->mtx);
 	}
 }
 
@@ -182,6 +221,7 @@ EXP_Insert(struct worker *wrk, struct objcore *oc)
 {
 	unsigned remove_race = 0;
 	struct objcore *tmpoc;
+	struct exp_priv *ep;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -197,7 +237,8 @@ EXP_Insert(struct worker *wrk, struct objcore *oc)
 
 	ObjSendEvent(wrk, oc, OEV_INSERT);
 
-	Lck_Lock(&exphdl->mtx);
+	ep = exp_shard(oc);
+	Lck_Lock(&ep->mtx);
 	AN(oc->exp_flags & OC_EF_NEW);
 	oc->exp_flags &= ~OC_EF_NEW;
 	AZ(oc->exp_flags & (OC_EF_INSERT | OC_EF_MOVE | OC_EF_POSTED));
@@ -206,8 +247,8 @@ EXP_Insert(struct worker *wrk, struct objcore *oc)
 		remove_race = 1;
 		oc->exp_flags &= ~(OC_EF_REFD | OC_EF_REMOVE);
 	} else
-		exp_mail_it(oc, OC_EF_INSERT | OC_EF_MOVE);
-	Lck_Unlock(&exphdl->mtx);
+		exp_mail_it(ep, oc, OC_EF_INSERT | OC_EF_MOVE);
+	Lck_Unlock(&ep->mtx);
 
 	if (remove_race) {
 		ObjSendEvent(wrk, oc, OEV_EXPIRE);
@@ -251,6 +292,7 @@ EXP_Rearm(struct objcore *oc, vtim_real now,
     vtim_dur ttl, vtim_dur grace, vtim_dur keep)
 {
 	vtim_real when;
+	struct exp_priv *ep;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	assert(oc->refcnt > 0);
@@ -271,17 +313,80 @@ EXP_Rearm(struct objcore *oc, vtim_real now,
 	    oc->timer_when, when, oc->flags);
 
 	if (when < oc->t_origin || when < oc->timer_when) {
-		Lck_Lock(&exphdl->mtx);
+		ep = exp_shard(oc);
+		Lck_Lock(&ep->mtx);
 		if (oc->exp_flags & OC_EF_NEW) {
 			/* EXP_Insert has not been called yet, do nothing
 			 * as the initial insert will execute the move
 			 * operation. */
 		} else
-			exp_mail_it(oc, OC_EF_MOVE);
-		Lck_Unlock(&exphdl->mtx);
+			exp_mail_it(ep, oc, OC_EF_MOVE);
+		Lck_Unlock(&ep->mtx);
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Timer structure wrappers
+ */
+
+static void
+exp_timer_insert(const struct exp_priv *ep, struct objcore *oc)
+{
+
+	assert(oc->timer_idx == VBH_NOIDX);
+	if (ep->wheel != NULL)
+		VTW_insert(ep->wheel, oc, oc->timer_when);
+	else
+		VBH_insert(ep->heap, oc);
+	assert(oc->timer_idx != VBH_NOIDX);
+	ep->stats->g_objects++;
+}
+
+static void
+exp_timer_reorder(const struct exp_priv *ep, const struct objcore *oc)
+{
+
+	assert(oc->timer_idx != VBH_NOIDX);
+	if (ep->wheel != NULL)
+		VTW_reorder(ep->wheel, oc->timer_slot, oc->timer_idx,
+		    oc->timer_when);
+	else
+		VBH_reorder(ep->heap, oc->timer_idx);
+	assert(oc->timer_idx != VBH_NOIDX);
+}
+
+static void
+exp_timer_delete(const struct exp_priv *ep, const struct objcore *oc)
+{
+
+	assert(oc->timer_idx != VBH_NOIDX);
+	if (ep->wheel != NULL)
+		VTW_delete(ep->wheel, oc->timer_slot, oc->timer_idx);
+	else
+		VBH_delete(ep->heap, oc->timer_idx);
+	assert(oc->timer_idx == VBH_NOIDX);
+	ep->stats->g_objects--;
+}
+
+/*
+ * Return the next objcore to look at, or NULL and when to look again.
+ */
+
+static struct objcore *
+exp_timer_root(const struct exp_priv *ep, vtim_real now, vtim_real *tnext)
+{
+	struct objcore *oc;
+	vtim_real t;
+
+	*tnext = now + 355. / 113.;
+	if (ep->wheel == NULL)
+		return (VBH_root(ep->heap));
+	oc = VTW_root(ep->wheel, now, &t);
+	if (oc == NULL && t < *tnext)
+		*tnext = t;
+	return (oc);
+}
+
 /*--------------------------------------------------------------------
  * Handle stuff in the inbox
  */
@@ -298,10 +403,8 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags, double now)
 	    flags, oc, oc->timer_when, oc->flags);
 
 	if (flags & OC_EF_REMOVE) {
-		if (!(flags & OC_EF_INSERT)) {
-			assert(oc->timer_idx != VBH_NOIDX);
-			VBH_delete(ep->heap, oc->timer_idx);
-		}
+		if (!(flags & OC_EF_INSERT))
+			exp_timer_delete(ep, oc);
 		assert(oc->timer_idx == VBH_NOIDX);
 		assert(oc->refcnt > 0);
 		AZ(oc->exp_flags);
@@ -328,32 +431,29 @@ exp_inbox(struct exp_priv *ep, struct objcore *oc, unsigned flags, double now)
 	 */
 
 	if (flags & OC_EF_INSERT) {
-		assert(oc->timer_idx == VBH_NOIDX);
-		VBH_insert(exphdl->heap, oc);
-		assert(oc->timer_idx != VBH_NOIDX);
+		exp_timer_insert(ep, oc);
 	} else if (flags & OC_EF_MOVE) {
-		assert(oc->timer_idx != VBH_NOIDX);
-		VBH_reorder(exphdl->heap, oc->timer_idx);
-		assert(oc->timer_idx != VBH_NOIDX);
+		exp_timer_reorder(ep, oc);
 	} else {
 		WRONG("Objcore state wrong in inbox");
 	}
 }
 
 /*--------------------------------------------------------------------
- * Expire stuff from the binheap
+ * Expire stuff from the heap or wheel
  */
 
 static vtim_real
 exp_expire(struct exp_priv *ep, vtim_real now)
 {
 	struct objcore *oc;
+	vtim_real tnext;
 
 	CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
 
-	oc = VBH_root(ep->heap);
+	oc = exp_timer_root(ep, now, &tnext);
 	if (oc == NULL)
-		return (now + 355. / 113.);
+		return (tnext);
 	VSLb(&ep->vsl, SLT_ExpKill, "EXP_Inspect p=%p e=%.6f f=0x%x", oc,
 	    oc->timer_when - now, oc->flags);
 
@@ -363,7 +463,8 @@ exp_expire(struct exp_priv *ep, vtim_real now)
 	if (oc->timer_when > now)
 		return (oc->timer_when);
 
-	VSC_C_main->n_expired++;
+	ep->wrk->stats->n_expired++;
+	ep->stats->c_expired++;
 
 	Lck_Lock(&ep->mtx);
 	if (oc->exp_flags & OC_EF_POSTED) {
@@ -377,10 +478,8 @@ exp_expire(struct exp_priv *ep, vtim_real now)
 		if (!(oc->flags & OC_F_DYING))
 			HSH_Kill(oc);
 
-		/* Remove from binheap */
-		assert(oc->timer_idx != VBH_NOIDX);
-		VBH_delete(ep->heap, oc->timer_idx);
-		assert(oc->timer_idx == VBH_NOIDX);
+		/* Remove from heap or wheel */
+		exp_timer_delete(ep, oc);
 
 		CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
 		VSLb(&ep->vsl, SLT_ExpKill, "EXP_Expired x=%ju t=%.0f h=%jd",
@@ -418,28 +517,78 @@ object_update(void *priv, void *p, unsigned u)
 	oc->timer_idx = u;
 }
 
+static void v_matchproto_(vtw_update_t)
+object_update_wheel(void *priv, void *p, unsigned slot, unsigned u)
+{
+	struct objcore *oc;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(oc, p, OBJCORE_MAGIC);
+	assert(slot <= UINT16_MAX);
+	oc->timer_slot = (uint16_t)slot;
+	oc->timer_idx = u;
+}
+/*--------------------------------------------------------------------
+ * The shard counters are bumped under the shard lock, fold what is new
+ * since last time into the worker stats so the MAIN totals stay exact.
+ */
+
+static void
+exp_sumstat(struct exp_priv *ep)
+{
+	struct worker *wrk;
+
+	CHECK_OBJ_NOTNULL(ep, EXP_PRIV_MAGIC);
+	Lck_AssertHeld(&ep->mtx);
+	wrk = ep->wrk;
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+
+	wrk->stats->exp_mailed += ep->stats->c_mailed - ep->summed_mailed;
+	ep->summed_mailed = ep->stats->c_mailed;
+	wrk->stats->exp_received +=
+	    ep->stats->c_received - ep->summed_received;
+	ep->summed_received = ep->stats->c_received;
+	wrk->stats->n_superseded +=
+	    ep->stats->c_superseded - ep->summed_superseded;
+	ep->summed_superseded = ep->stats->c_superseded;
+	Pool_Sumstat(wrk);
+}
+
 static void * v_matchproto_(bgthread_t)
 exp_thread(struct worker *wrk, void *priv)
 {
 	struct objcore *oc;
-	vtim_real t = 0, tnext = 0;
+	vtim_real t = 0, tnext = 0, tsum = 0;
 	struct exp_priv *ep;
 	unsigned flags = 0;
 
 	CAST_OBJ_NOTNULL(ep, priv, EXP_PRIV_MAGIC);
-	ep->wrk = wrk;
 	VSL_Setup(&ep->vsl, NULL, 0);
-	ep->heap = VBH_new(NULL, object_cmp, object_update);
-	AN(ep->heap);
+	if (cache_param->expiry_wheel) {
+		ep->wheel = VTW_new(NULL, EXP_WHEEL_TICK, VTIM_real(),
+		    object_update_wheel);
+		AN(ep->wheel);
+	} else {
+		ep->heap = VBH_new(NULL, object_cmp, object_update);
+		AN(ep->heap);
+	}
+	Lck_Lock(&ep->mtx);
+	ep->wrk = wrk;
+	Lck_Unlock(&ep->mtx);
 	while (exp_shutdown == 0) {
 
 		Lck_Lock(&ep->mtx);
+		if (t >= tsum) {
+			/* Don't let a busy shard sit on its stats */
+			exp_sumstat(ep);
+			tsum = t + 1.;
+		}
 		oc = VSTAILQ_FIRST(&ep->inbox);
 		CHECK_OBJ_ORNULL(oc, OBJCORE_MAGIC);
 		if (oc != NULL) {
 			assert(oc->refcnt >= 1);
 			VSTAILQ_REMOVE(&ep->inbox, oc, objcore, exp_list);
-			VSC_C_main->exp_received++;
+			ep->stats->c_received++;
 			tnext = 0;
 			flags = oc->exp_flags;
 			if (flags & OC_EF_REMOVE)
@@ -448,7 +597,7 @@ exp_thread(struct worker *wrk, void *priv)
 				oc->exp_flags &= OC_EF_REFD;
 		} else if (tnext > t) {
 			VSL_Flush(&ep->vsl, 0);
-			Pool_Sumstat(wrk);
+			exp_sumstat(ep);
 			(void)Lck_CondWaitUntil(&ep->condvar, &ep->mtx, tnext);
 		}
 		Lck_Unlock(&ep->mtx);
@@ -470,33 +619,50 @@ EXP_Init(void)
 {
 	struct exp_priv *ep;
 	pthread_t pt;
-
-	ALLOC_OBJ(ep, EXP_PRIV_MAGIC);
-	AN(ep);
-
-	Lck_New(&ep->mtx, lck_exp);
-	PTOK(pthread_cond_init(&ep->condvar, NULL));
-	VSTAILQ_INIT(&ep->inbox);
-	WRK_BgThread(&pt, "cache-exp", exp_thread, ep);
-	ep->thread = pt;
-	exphdl = ep;
+	unsigned u;
+
+	exp_nshard = cache_param->expiry_shards;
+	assert(exp_nshard > 0);
+	exphdl = calloc(exp_nshard, sizeof *exphdl);
+	AN(exphdl);
+
+	for (u = 0; u < exp_nshard; u++) {
+		ep = &exphdl[u];
+		INIT_OBJ(ep, EXP_PRIV_MAGIC);
+		Lck_New(&ep->mtx, lck_exp);
+		PTOK(pthread_cond_init(&ep->condvar, NULL));
+		VSTAILQ_INIT(&ep->inbox);
+		ep->stats = VSC_exp_New(NULL, &ep->vsc_seg, "%u", u);
+		AN(ep->stats);
+		bprintf(ep->name, "cache-exp-%u", u);
+		WRK_BgThread(&pt, ep->name, exp_thread, ep);
+		ep->thread = pt;
+	}
 }
 
 void
 EXP_Shutdown(void)
 {
-	struct exp_priv *ep = exphdl;
+	struct exp_priv *ep;
 	void *status;
+	unsigned u;
 
-	Lck_Lock(&ep->mtx);
-	exp_shutdown = 1;
-	PTOK(pthread_cond_signal(&ep->condvar));
-	Lck_Unlock(&ep->mtx);
+	for (u = 0; u < exp_nshard; u++) {
+		ep = &exphdl[u];
+		CHECK_OBJ(ep, EXP_PRIV_MAGIC);
+		Lck_Lock(&ep->mtx);
+		exp_shutdown = 1;
+		PTOK(pthread_cond_signal(&ep->condvar));
+		Lck_Unlock(&ep->mtx);
+	}
 
-	AN(ep->thread);
-	PTOK(pthread_join(ep->thread, &status));
-	AZ(status);
-	memset(&ep->thread, 0, sizeof ep->thread);
+	for (u = 0; u < exp_nshard; u++) {
+		ep = &exphdl[u];
+		AN(ep->thread);
+		PTOK(pthread_join(ep->thread, &status));
+		AZ(status);
+		memset(&ep->thread, 0, sizeof ep->thread);
+	}
 
 	/* XXX could cleanup more - not worth it for now */
 }
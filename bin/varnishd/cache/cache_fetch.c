@@ -33,8 +33,10 @@
 
 #include "cache_varnishd.h"
 #include "cache_filter.h"
+#include "cache_pool.h"
 #include "cache_objhead.h"
 #include "storage/storage.h"
+#include "waiter/waiter.h"
 #include "vcl.h"
 #include "vtim.h"
 #include "vcc_interface.h"
@@ -49,6 +51,7 @@
 	FETCH_STEP(fetchend,          FETCHEND) \
 	FETCH_STEP(error,             ERROR) \
 	FETCH_STEP(fail,              FAIL) \
+	FETCH_STEP(park,              PARK) \
 	FETCH_STEP(done,              DONE)
 
 typedef const struct fetch_step *vbf_state_f(struct worker *, struct busyobj *);
@@ -64,6 +67,9 @@ struct fetch_step {
 FETCH_STEPS
 #undef FETCH_STEP
 
+static const struct fetch_step *vbf_beresp(struct worker *, struct busyobj *,
+    int);
+
 /*--------------------------------------------------------------------
  * Allocate an object, with fall-back to Transient.
  * XXX: This somewhat overlaps the stuff in stevedore.c
@@ -99,7 +105,16 @@ vbf_allocobj(struct busyobj *bo, unsigned l)
 	if (stv == NULL)
 		return (0);
 
-	if (STV_NewObject(bo->wrk, oc, stv, l))
+	if (stv != stv_transient && (bo->admit < 0 || bo->admit_stv != stv)) {
+		bo->admit = STV_Admit(stv, bo->digest, 1);
+		bo->admit_stv = stv;
+	}
+
+	if (stv != stv_transient && !bo->admit) {
+		bo->wrk->stats->beresp_rejected++;
+		VSLb(bo->vsl, SLT_Debug, "Rejected by %s %s admission filter",
+		    stv->name, stv->ident);
+	} else if (STV_NewObject(bo->wrk, oc, stv, l))
 		return (1);
 
 	if (stv == stv_transient)
@@ -391,8 +406,6 @@ static const struct fetch_step * v_matchproto_(vbf_state_f)
 vbf_stp_startfetch(struct worker *wrk, struct busyobj *bo)
 {
 	int i;
-	vtim_real now;
-	unsigned handling;
 	struct objcore *oc;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
@@ -402,6 +415,8 @@ vbf_stp_startfetch(struct worker *wrk, struct busyobj *bo)
 
 	AZ(bo->storage);
 	bo->storage = bo->uncacheable ? stv_transient : STV_next();
+	bo->admit = -1;
+	bo->admit_stv = NULL;
 
 	if (bo->retries > 0)
 		http_Unset(bo->bereq, "\012X-Varnish:");
@@ -433,6 +448,27 @@ vbf_stp_startfetch(struct worker *wrk, struct busyobj *bo)
 
 	VSLb_ts_busyobj(bo, "Fetch", W_TIM_real(wrk));
 	i = VDI_GetHdr(bo);
+	if (VBF_Parked(bo))
+		return (F_STP_PARK);
+	return (vbf_beresp(wrk, bo, i));
+}
+
+/*--------------------------------------------------------------------
+ * The backend response headers are in, or not (i != 0)
+ */
+
+static const struct fetch_step *
+vbf_beresp(struct worker *wrk, struct busyobj *bo, int i)
+{
+	vtim_real now;
+	unsigned handling;
+	struct objcore *oc;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	oc = bo->fetch_objcore;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
 	if (bo->htc != NULL)
 		CHECK_OBJ_NOTNULL(bo->htc->doclose, STREAM_CLOSE_MAGIC);
 
@@ -943,6 +979,8 @@ vbf_stp_error(struct worker *wrk, struct busyobj *bo)
 
 	if (bo->storage == NULL)
 		bo->storage = STV_next();
+	bo->admit = -1;
+	bo->admit_stv = NULL;
 
 	// XXX: reset all beresp flags ?
 
@@ -1054,6 +1092,19 @@ vbf_stp_fail(struct worker *wrk, struct busyobj *bo)
 	return (F_STP_DONE);
 }
 
+/*--------------------------------------------------------------------
+ */
+
+static const struct fetch_step * v_matchproto_(vbf_state_f)
+vbf_stp_park(struct worker *wrk, struct busyobj *bo)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	WRONG("Parked fetches are not stepped");
+	NEEDLESS(return (F_STP_DONE));
+}
+
 /*--------------------------------------------------------------------
  */
 
@@ -1067,39 +1118,140 @@ vbf_stp_done(struct worker *wrk, struct busyobj *bo)
 	NEEDLESS(return (F_STP_DONE));
 }
 
-static void v_matchproto_(task_func_t)
-vbf_fetch_thread(struct worker *wrk, void *priv)
+/*--------------------------------------------------------------------
+ * Parking a fetch
+ *
+ * Rather than having a worker thread sit in a read(2) until a slow
+ * backend sends the first byte of its response, the backend director
+ * can ask for the fetch to be parked once the request is sent.  The
+ * state machine then unwinds, the backend connection is handed to
+ * the waiter, and the worker goes back to the pool.  When the backend
+ * connection becomes readable, or the timeout expires, a new task
+ * calls the director's resume function and picks up where
+ * vbf_stp_startfetch() left off.
+ */
+
+struct vbf_park {
+	unsigned		magic;
+#define VBF_PARK_MAGIC		0x4d1f0c6a
+	int			fd;
+	unsigned		priv;
+	vbf_resume_f		*func;
+	vtim_real		when;
+	struct pool		*pool;
+	enum wait_event		ev;
+	struct waited		waited[1];
+};
+
+int
+VBF_Park(struct busyobj *bo, int fd, vtim_real when, vbf_resume_f *func,
+    unsigned priv)
+{
+	struct vbf_park *park;
+
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->wrk, WORKER_MAGIC);
+	assert(fd > 0);
+	AN(func);
+
+	if (!cache_param->fetch_evented || bo->wrk->pool == NULL)
+		return (-1);
+	if (bo->park == NULL) {
+		bo->park = WS_Alloc(bo->ws, sizeof *bo->park);
+		if (bo->park == NULL)
+			return (-1);
+	}
+	park = bo->park;
+	INIT_OBJ(park, VBF_PARK_MAGIC);
+	park->fd = fd;
+	park->priv = priv;
+	park->func = func;
+	park->when = when;
+	return (0);
+}
+
+int
+VBF_Parked(const struct busyobj *bo)
+{
+
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	if (bo->park == NULL)
+		return (0);
+	CHECK_OBJ(bo->park, VBF_PARK_MAGIC);
+	return (bo->park->func != NULL);
+}
+
+static task_func_t vbf_fetch_resume;
+
+static void v_matchproto_(waiter_handle_f)
+vbf_park_handle(struct waited *wp, enum wait_event ev, vtim_real now)
 {
-	struct vrt_ctx ctx[1];
 	struct busyobj *bo;
-	struct objcore *oc;
-	const struct fetch_step *stp;
+	struct vbf_park *park;
+
+	(void)now;
+	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+	CAST_OBJ_NOTNULL(bo, wp->priv1, BUSYOBJ_MAGIC);
+	park = bo->park;
+	CHECK_OBJ_NOTNULL(park, VBF_PARK_MAGIC);
+	assert(wp == park->waited);
+
+	park->ev = ev;
+	bo->fetch_task->func = vbf_fetch_resume;
+	bo->fetch_task->priv = bo;
+	/* BO tasks are always queued */
+	AZ(Pool_Task(park->pool, bo->fetch_task, TASK_QUEUE_BO));
+}
+
+static void
+vbf_park(struct worker *wrk, struct busyobj *bo)
+{
+	struct vbf_park *park;
+	struct waited *wp;
+	vtim_real now;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
-	CAST_OBJ_NOTNULL(bo, priv, BUSYOBJ_MAGIC);
-	CHECK_OBJ_NOTNULL(bo->req, REQ_MAGIC);
-	oc = bo->fetch_objcore;
-	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	park = bo->park;
+	CHECK_OBJ_NOTNULL(park, VBF_PARK_MAGIC);
+	CHECK_OBJ_NOTNULL(wrk->pool, POOL_MAGIC);
+
+	wrk->stats->fetch_parked++;
+	park->pool = wrk->pool;
+	now = VTIM_real();
+	wp = park->waited;
+	INIT_OBJ(wp, WAITED_MAGIC);
+	wp->fd = park->fd;
+	wp->priv1 = bo;
+	wp->func = vbf_park_handle;
+	wp->idle = now;
+	wp->tmo = vmax_t(vtim_dur, park->when - now, 0.);
+
+	bo->wrk = NULL;
+	wrk->vsl = NULL;
+	THR_SetBusyobj(NULL);
 
-	THR_SetBusyobj(bo);
-	stp = F_STP_MKBEREQ;
-	assert(isnan(bo->t_first));
-	assert(isnan(bo->t_prev));
-	VSLb_ts_busyobj(bo, "Start", W_TIM_real(wrk));
+	/* From here on, the busyobj may already be resumed elsewhere */
+	if (Wait_Enter(wrk->pool->waiter, wp))
+		vbf_park_handle(wp, WAITER_ACTION, now);
+}
 
-	bo->wrk = wrk;
-	wrk->vsl = bo->vsl;
+/*--------------------------------------------------------------------
+ * Run the state machine, until done or parked
+ */
 
-#if 0
-	if (bo->stale_oc != NULL) {
-		CHECK_OBJ_NOTNULL(bo->stale_oc, OBJCORE_MAGIC);
-		/* We don't want the oc/stevedore ops in fetching thread */
-		if (!ObjCheckFlag(wrk, bo->stale_oc, OF_IMSCAND))
-			(void)HSH_DerefObjCore(wrk, &bo->stale_oc, 0);
-	}
-#endif
+static void
+vbf_fetch_run(struct worker *wrk, struct busyobj *bo,
+    const struct fetch_step *stp)
+{
+	struct vrt_ctx ctx[1];
+	struct objcore *oc;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	oc = bo->fetch_objcore;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
-	VCL_TaskEnter(bo->privs);
 	while (stp != F_STP_DONE) {
 		CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
 		assert(oc->boc->refcount >= 1);
@@ -1108,6 +1260,10 @@ vbf_fetch_thread(struct worker *wrk, void *priv)
 		else
 			AZ(bo->req);
 		AN(stp);
+		if (stp == F_STP_PARK) {
+			vbf_park(wrk, bo);
+			return;
+		}
 		AN(stp->name);
 		AN(stp->func);
 		stp = stp->func(wrk, bo);
@@ -1141,6 +1297,69 @@ vbf_fetch_thread(struct worker *wrk, void *priv)
 	THR_SetBusyobj(NULL);
 }
 
+static void v_matchproto_(task_func_t)
+vbf_fetch_resume(struct worker *wrk, void *priv)
+{
+	struct busyobj *bo;
+	struct vbf_park *park;
+	vbf_resume_f *func;
+	int i;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(bo, priv, BUSYOBJ_MAGIC);
+	park = bo->park;
+	CHECK_OBJ_NOTNULL(park, VBF_PARK_MAGIC);
+	AZ(bo->wrk);
+
+	THR_SetBusyobj(bo);
+	bo->wrk = wrk;
+	wrk->vsl = bo->vsl;
+	bo->vfc->wrk = wrk;
+	VSLb_ts_busyobj(bo, "Resume", W_TIM_real(wrk));
+
+	func = park->func;
+	park->func = NULL;
+	AN(func);
+	i = func(bo, park->ev == WAITER_TIMEOUT, park->priv);
+	if (VBF_Parked(bo))
+		vbf_fetch_run(wrk, bo, F_STP_PARK);
+	else
+		vbf_fetch_run(wrk, bo, vbf_beresp(wrk, bo, i));
+}
+
+static void v_matchproto_(task_func_t)
+vbf_fetch_thread(struct worker *wrk, void *priv)
+{
+	struct busyobj *bo;
+	struct objcore *oc;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(bo, priv, BUSYOBJ_MAGIC);
+	CHECK_OBJ_NOTNULL(bo->req, REQ_MAGIC);
+	oc = bo->fetch_objcore;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+	THR_SetBusyobj(bo);
+	assert(isnan(bo->t_first));
+	assert(isnan(bo->t_prev));
+	VSLb_ts_busyobj(bo, "Start", W_TIM_real(wrk));
+
+	bo->wrk = wrk;
+	wrk->vsl = bo->vsl;
+
+#if 0
+	if (bo->stale_oc != NULL) {
+		CHECK_OBJ_NOTNULL(bo->stale_oc, OBJCORE_MAGIC);
+		/* We don't want the oc/stevedore ops in fetching thread */
+		if (!ObjCheckFlag(wrk, bo->stale_oc, OF_IMSCAND))
+			(void)HSH_DerefObjCore(wrk, &bo->stale_oc, 0);
+	}
+#endif
+
+	VCL_TaskEnter(bo->privs);
+	vbf_fetch_run(wrk, bo, F_STP_MKBEREQ);
+}
+
 /*--------------------------------------------------------------------
  */
 
@@ -1073,6 +1073,8 @@ HSH_DerefObjCore(struct worker *wrk, struct objcore **ocp, int rushmax)
 
 	BAN_DestroyObj(oc);
 	AZ(oc->ban);
+	TAG_DestroyObj(oc);
+	AZ(oc->tags);
 
 	if (oc->stobj->stevedore != NULL)
 		ObjFreeObj(wrk, oc);
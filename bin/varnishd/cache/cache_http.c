@@ -111,6 +111,7 @@ static const unsigned char http_asso_values[256] = {
 static struct http_hdrflg {
 	char		*hdr;
 	unsigned	flag;
+	unsigned	hot;		/* hp->hdx[] index + 1 */
 } http_hdrflg[GPERF_MAX_HASH_VALUE + 1] = {
 	{ NULL }, { NULL }, { NULL }, { NULL },
 	{ H_Date },
@@ -204,6 +205,79 @@ http_hdr_flags(const char *b, const char *e)
 	return (retval);
 }
 
+/*--------------------------------------------------------------------
+ * The few headers looked up on every transaction have their first hd[]
+ * slot in hp->hdx[], zero if absent, HTTP_HDX_SCAN if the slot does not
+ * fit.  The other well-known headers have a bit in hp->hdm, by their
+ * perfect hash modulo 16, if they may be present.  Both live in what was
+ * padding of struct http, so they cost no workspace.
+ *
+ * Every header added must be indexed, and whatever moves headers to
+ * other slots must reindex.  A slot which no longer holds its header,
+ * or a bit which is set for nothing, only costs a scan in http_findhdr().
+ */
+
+#define HTTP_HDM_BIT(k)		(1U << ((k) & 15))
+#define HTTP_HDX_SCAN		UINT8_MAX
+
+static char * const http_hdx_hot[HTTP_HDX_HOT] = {
+	H_Host,
+	H_Accept_Encoding,
+	H_Content_Length,
+	H_Content_Encoding,
+	H_Cache_Control,
+};
+
+static unsigned
+http_hdx_key(const txt *t)
+{
+	const char *e;
+	const struct http_hdrflg *f;
+
+	if (t->b == NULL)
+		return (0);
+	e = memchr(t->b, ':', t->e - t->b);
+	if (e == NULL)
+		return (0);
+	f = http_hdr_flags(t->b, e);
+	if (f == NULL)
+		return (0);
+	return (f - http_hdrflg);
+}
+
+void
+http_IndexHdr(struct http *hp, unsigned u)
+{
+	unsigned k, h;
+	uint8_t s;
+
+	CHECK_OBJ_NOTNULL(hp, HTTP_MAGIC);
+	assert(u >= HTTP_HDR_FIRST);
+	assert(u < hp->nhd);
+	k = http_hdx_key(&hp->hd[u]);
+	if (k == 0)
+		return;
+	h = http_hdrflg[k].hot;
+	if (h == 0) {
+		hp->hdm |= HTTP_HDM_BIT(k);
+		return;
+	}
+	s = (uint8_t)vmin_t(unsigned, u, HTTP_HDX_SCAN);
+	if (hp->hdx[h - 1] == 0 || s < hp->hdx[h - 1])
+		hp->hdx[h - 1] = s;
+}
+
+static void
+http_reindex(struct http *hp)
+{
+	unsigned u;
+
+	hp->hdm = 0;
+	memset(hp->hdx, 0, sizeof hp->hdx);
+	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++)
+		http_IndexHdr(hp, u);
+}
+
 /*--------------------------------------------------------------------*/
 
 static void
@@ -218,6 +292,21 @@ http_init_hdr(char *hdr, int flg)
 	f->flag = flg;
 }
 
+static void
+http_init_hot(void)
+{
+	struct http_hdrflg *f;
+	unsigned u;
+
+	for (u = 0; u < HTTP_HDX_HOT; u++) {
+		f = http_hdr_flags(http_hdx_hot[u] + 1,
+		    http_hdx_hot[u] + http_hdx_hot[u][0]);
+		AN(f);
+		AZ(f->hot);
+		f->hot = u + 1;
+	}
+}
+
 void
 HTTP_Init(void)
 {
@@ -225,6 +314,7 @@ HTTP_Init(void)
 
 #define HTTPH(a, b, c) http_init_hdr(b, c);
 #include "tbl/http_headers.h"
+	http_init_hot();
 
 	vsb = VSB_new_auto();
 	AN(vsb);
@@ -396,6 +486,8 @@ HTTP_Dup(struct http *to, const struct http * fm)
 	memcpy(to->hd, fm->hd, fm->nhd * sizeof *to->hd);
 	memcpy(to->hdf, fm->hdf, fm->nhd * sizeof *to->hdf);
 	to->nhd = fm->nhd;
+	to->hdm = fm->hdm;
+	memcpy(to->hdx, fm->hdx, sizeof to->hdx);
 	to->logtag = fm->logtag;
 	to->status = fm->status;
 	to->protover = fm->protover;
@@ -454,6 +546,8 @@ http_SetH(struct http *to, unsigned n, const char *header)
 	http_VSLH(to, n);
 	if (n == HTTP_HDR_PROTO)
 		http_Proto(to);
+	else if (n >= HTTP_HDR_FIRST)
+		http_IndexHdr(to, n);
 }
 
 /*--------------------------------------------------------------------*/
@@ -491,20 +585,38 @@ http_IsHdr(const txt *hh, hdr_t hdr)
 
 /*--------------------------------------------------------------------*/
 
+static int
+http_hdr_in(const struct http *hp, unsigned u, unsigned l, const char *hdr)
+{
+
+	Tcheck(hp->hd[u]);
+	if (hp->hd[u].e < hp->hd[u].b + l + 1)
+		return (0);
+	if (hp->hd[u].b[l] != ':')
+		return (0);
+	return (http_hdr_at(hdr, hp->hd[u].b, l));
+}
+
 static unsigned
 http_findhdr(const struct http *hp, unsigned l, const char *hdr)
 {
+	const struct http_hdrflg *f;
 	unsigned u;
 
+	f = http_hdr_flags(hdr, hdr + l);
+	if (f != NULL && f->hot) {
+		u = hp->hdx[f->hot - 1];
+		if (u == 0)
+			return (0);
+		if (u < HTTP_HDX_SCAN && u < hp->nhd &&
+		    http_hdr_in(hp, u, l, hdr))
+			return (u);
+	} else if (f != NULL && !(hp->hdm & HTTP_HDM_BIT(f - http_hdrflg)))
+		return (0);
+
 	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
-		Tcheck(hp->hd[u]);
-		if (hp->hd[u].e < hp->hd[u].b + l + 1)
-			continue;
-		if (hp->hd[u].b[l] != ':')
-			continue;
-		if (!http_hdr_at(hdr, hp->hd[u].b, l))
-			continue;
-		return (u);
+		if (http_hdr_in(hp, u, l, hdr))
+			return (u);
 	}
 	return (0);
 }
@@ -590,6 +702,7 @@ http_CollectHdrSep(struct http *hp, hdr_t hdr, const char *sep)
 				VSLbs(hp->vsl, SLT_LostHeader,
 				    TOSTRAND(hdr + 1));
 				WS_Release(hp->ws, 0);
+				http_reindex(hp);
 				return;
 			}
 			memcpy(b, hp->hd[f].b, x);
@@ -612,6 +725,7 @@ http_CollectHdrSep(struct http *hp, hdr_t hdr, const char *sep)
 			http_fail(hp);
 			VSLbs(hp->vsl, SLT_LostHeader, TOSTRAND(hdr + 1));
 			WS_Release(hp->ws, 0);
+			http_reindex(hp);
 			return;
 		}
 		memcpy(b, sep, lsep);
@@ -627,6 +741,7 @@ http_CollectHdrSep(struct http *hp, hdr_t hdr, const char *sep)
 	hp->hd[f].b = WS_Reservation(hp->ws);
 	hp->hd[f].e = b;
 	WS_ReleaseP(hp->ws, b + 1);
+	http_reindex(hp);
 }
 
 /*--------------------------------------------------------------------*/
@@ -1309,8 +1424,10 @@ HTTP_Decode(struct http *to, const uint8_t *fm)
 				to->hd[to->nhd].e = NULL;
 				continue;
 			}
-			if (*fm == '\0')
+			if (*fm == '\0') {
+				http_reindex(to);
 				return (0);
+			}
 			to->hd[to->nhd].b = (const void*)fm;
 			fm = (const void*)strchr((const void*)fm, '\0');
 			to->hd[to->nhd].e = (const void*)fm;
@@ -1480,6 +1597,8 @@ http_FilterReq(struct http *to, const struct http *fm, unsigned how)
 	to->status = fm->status;
 
 	to->nhd = HTTP_HDR_FIRST;
+	to->hdm = 0;
+	memset(to->hdx, 0, sizeof to->hdx);
 	for (u = HTTP_HDR_FIRST; u < fm->nhd; u++) {
 		Tcheck(fm->hd[u]);
 		if (http_isfiltered(fm, u, how))
@@ -1489,6 +1608,7 @@ http_FilterReq(struct http *to, const struct http *fm, unsigned how)
 		to->hdf[to->nhd] = 0;
 		http_VSLH(to, to->nhd);
 		to->nhd++;
+		http_IndexHdr(to, to->nhd - 1);
 	}
 }
 
@@ -1641,5 +1761,8 @@ http_Unset(struct http *hp, hdr_t hdr)
 		}
 		v++;
 	}
+	if (v == hp->nhd)
+		return;
 	hp->nhd = v;
+	http_reindex(hp);
 }
@@ -430,6 +430,7 @@ child_main(int sigmagic, size_t altstksz)
 	EXP_Init();
 	HSH_Init(heritage.hash);
 	BAN_Init();
+	TAG_Init();
 
 	VCA_Init();
 
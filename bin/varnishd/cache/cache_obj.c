@@ -183,6 +183,28 @@ ObjIterate(struct worker *wrk, struct objcore *oc,
 	return (om->objiterator(wrk, oc, priv, func, final));
 }
 
+/*====================================================================
+ * ObjSendfile()
+ *
+ * Like ObjIterate(), but hands the callback the file descriptor and
+ * offset of each body segment, for zero-copy delivery.  Returns 1,
+ * without calling it, if the object is not complete or its body does
+ * not live in a file.
+ */
+
+int
+ObjSendfile(struct worker *wrk, struct objcore *oc,
+    void *priv, objsendfile_f *func)
+{
+	const struct obj_methods *om = obj_getmethods(oc);
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(func);
+	if (om->objsendfile == NULL)
+		return (1);
+	return (om->objsendfile(wrk, oc, priv, func));
+}
+
 /*====================================================================
  * ObjGetSpace()
  *
@@ -49,6 +49,8 @@ typedef const void *objgetattr_f(struct worker *, struct objcore *,
 typedef void *objsetattr_f(struct worker *, struct objcore *,
     enum obj_attr attr, ssize_t len, const void *ptr);
 typedef void objtouch_f(struct worker *, struct objcore *, vtim_real now);
+typedef int objsendfiler_f(struct worker *, struct objcore *,
+    void *priv, objsendfile_f *func);
 
 struct obj_methods {
 	/* required */
@@ -64,5 +66,6 @@ struct obj_methods {
 	objslim_f	*objslim;
 	objtouch_f	*objtouch;
 	objsetstate_f	*objsetstate;
+	objsendfiler_f	*objsendfile;
 };
 
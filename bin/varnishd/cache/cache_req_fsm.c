@@ -216,7 +216,13 @@ cnt_deliver(struct worker *wrk, struct req *req)
 
 	assert(req->objcore->refcnt > 0);
 
-	ObjTouch(req->wrk, req->objcore, req->t_prev);
+	/*
+	 * A miss was just inserted, and whether it is on the LRU yet
+	 * depends on when the fetch let go of it, so only hits count as
+	 * a reference.
+	 */
+	if (req->is_hit)
+		ObjTouch(req->wrk, req->objcore, req->t_prev);
 
 	if (Resp_Setup_Deliver(req)) {
 		(void)HSH_DerefObjCore(wrk, &req->objcore, HSH_RUSH_POLICY);
@@ -0,0 +1,347 @@
+/*-
+ * Copyright (c) 2026 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Surrogate key index
+ *
+ * Objects can be given a set of tags (surrogate keys) from VCL, usually
+ * taken from a backend response header, and all objects carrying a tag
+ * can then be purged at a cost which depends on how many objects carry
+ * it, rather than on the size of the cache.
+ *
+ * The index is split into TAG_NSHARD shards by a hash of the tag, each
+ * with its own lock and tree.  A tag has a list of references to the
+ * objects carrying it, and an objcore the list of its own references,
+ * which goes away with the objcore in HSH_DerefObjCore().  The list on
+ * the objcore belongs to the fetch filling it in, and after that to
+ * whoever drops the last reference.
+ *
+ * Lock order is tag shard first, then objhead.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache_varnishd.h"
+#include "cache_objhead.h"
+
+#include "vct.h"
+#include "vtree.h"
+
+#define TAG_NSHARD	64
+#define TAG_MAXLEN	256
+
+struct tag_ref {
+	struct objcore		*oc;
+	struct tag_key		*key;
+	VTAILQ_ENTRY(tag_ref)	list;
+	struct tag_ref		*next;		/* on the same objcore */
+};
+
+struct tag_key {
+	unsigned		magic;
+#define TAG_KEY_MAGIC		0x6c4e1a37
+	unsigned		shard;
+	VRBT_ENTRY(tag_key)	entry;
+	VTAILQ_HEAD(, tag_ref)	refs;
+	size_t			len;
+	char			tag[];
+};
+
+VRBT_HEAD(tag_tree, tag_key);
+
+static struct tag_shard {
+	struct lock		mtx;
+	struct tag_tree		tree;
+} tag_shards[TAG_NSHARD];
+
+static inline int
+tag_cmp(const struct tag_key *a, const struct tag_key *b)
+{
+	if (a->len != b->len)
+		return (a->len < b->len ? -1 : 1);
+	return (memcmp(a->tag, b->tag, a->len));
+}
+
+VRBT_GENERATE_INSERT_COLOR(tag_tree, tag_key, entry, static)
+VRBT_GENERATE_INSERT_FINISH(tag_tree, tag_key, entry, static)
+VRBT_GENERATE_INSERT(tag_tree, tag_key, entry, tag_cmp, static)
+VRBT_GENERATE_REMOVE_COLOR(tag_tree, tag_key, entry, static)
+VRBT_GENERATE_REMOVE(tag_tree, tag_key, entry, static)
+VRBT_GENERATE_FIND(tag_tree, tag_key, entry, tag_cmp, static)
+
+static unsigned
+tag_hash(const char *b, size_t l)
+{
+	uint32_t h = 2166136261U;		/* FNV-1a */
+
+	while (l-- > 0) {
+		h ^= (uint8_t)*b++;
+		h *= 16777619U;
+	}
+	return (h % TAG_NSHARD);
+}
+
+static struct tag_key *
+tag_find(struct tag_shard *ts, const char *b, size_t l)
+{
+	union {
+		struct tag_key	k;
+		char		buf[sizeof(struct tag_key) + TAG_MAXLEN];
+	} u;
+
+	Lck_AssertHeld(&ts->mtx);
+	assert(l <= TAG_MAXLEN);
+	INIT_OBJ(&u.k, TAG_KEY_MAGIC);
+	u.k.len = l;
+	memcpy(u.k.tag, b, l);
+	return (VRBT_FIND(tag_tree, &ts->tree, &u.k));
+}
+
+/*--------------------------------------------------------------------
+ * Add a tag to an objcore, unless it has it already.
+ */
+
+static void
+tag_add(struct objcore *oc, const char *b, size_t l)
+{
+	struct tag_shard *ts;
+	struct tag_key *key;
+	struct tag_ref *ref;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	u = tag_hash(b, l);
+	ts = &tag_shards[u];
+
+	Lck_Lock(&ts->mtx);
+	key = tag_find(ts, b, l);
+	for (ref = oc->tags; key != NULL && ref != NULL; ref = ref->next) {
+		if (ref->key == key) {
+			Lck_Unlock(&ts->mtx);
+			return;
+		}
+	}
+	ref = calloc(1, sizeof *ref);
+	if (ref == NULL) {
+		Lck_Unlock(&ts->mtx);
+		return;
+	}
+	if (key == NULL) {
+		ALLOC_FLEX_OBJ(key, tag, l + 1, TAG_KEY_MAGIC);
+		if (key == NULL) {
+			Lck_Unlock(&ts->mtx);
+			free(ref);
+			return;
+		}
+		key->shard = u;
+		key->len = l;
+		memcpy(key->tag, b, l);
+		VTAILQ_INIT(&key->refs);
+		AZ(VRBT_INSERT(tag_tree, &ts->tree, key));
+	}
+	ref->oc = oc;
+	ref->key = key;
+	VTAILQ_INSERT_TAIL(&key->refs, ref, list);
+	ref->next = oc->tags;
+	oc->tags = ref;
+	Lck_Unlock(&ts->mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Tag an objcore with a list of tags separated by white space or
+ * commas, tags longer than TAG_MAXLEN are ignored.
+ */
+
+void
+TAG_Object(struct worker *wrk, struct objcore *oc, const char *tags)
+{
+	const char *b, *e;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AZ(oc->flags & OC_F_PRIVATE);
+	if (tags == NULL)
+		return;
+
+	for (b = tags; *b != '\0'; b = e) {
+		while (*b == ',' || vct_isspace(*b))
+			b++;
+		for (e = b; *e != '\0' && *e != ',' && !vct_isspace(*e); e++)
+			continue;
+		if (e > b && e - b <= TAG_MAXLEN)
+			tag_add(oc, b, e - b);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Drop the tags of an objcore about to be destroyed.
+ */
+
+void
+TAG_DestroyObj(struct objcore *oc)
+{
+	struct tag_shard *ts;
+	struct tag_key *key;
+	struct tag_ref *ref;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AZ(oc->refcnt);
+
+	while (oc->tags != NULL) {
+		ref = oc->tags;
+		oc->tags = ref->next;
+		assert(ref->oc == oc);
+		CAST_OBJ_NOTNULL(key, ref->key, TAG_KEY_MAGIC);
+		ts = &tag_shards[key->shard];
+		Lck_Lock(&ts->mtx);
+		VTAILQ_REMOVE(&key->refs, ref, list);
+		if (VTAILQ_EMPTY(&key->refs))
+			VRBT_REMOVE(tag_tree, &ts->tree, key);
+		else
+			key = NULL;
+		Lck_Unlock(&ts->mtx);
+		free(ref);
+		if (key != NULL)
+			FREE_OBJ(key);
+	}
+}
+
+/*---------------------------------------------------------------------
+ * Purge all objects carrying a tag.
+ *
+ * Same as HSH_Purge(), we collect as many objcores as the workspace
+ * takes under the lock, and keep a reference on the last one as our
+ * bookmark into the list while we work on the others.
+ */
+
+unsigned
+TAG_Purge(struct worker *wrk, const char *tag, vtim_real ttl_now,
+    vtim_dur ttl, vtim_dur grace, vtim_dur keep)
+{
+	struct tag_shard *ts;
+	struct tag_key *key;
+	struct tag_ref *ref, *last = NULL;
+	struct objcore *oc, *oc_nows[2], **ocp;
+	struct objhead *oh;
+	unsigned i, j, n, n_max, total = 0;
+	size_t l;
+	int is_purge;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(tag);
+
+	wrk->stats->tag_purges++;
+	l = strlen(tag);
+	if (l == 0 || l > TAG_MAXLEN)
+		return (0);
+	ts = &tag_shards[tag_hash(tag, l)];
+
+	is_purge = (ttl == 0 && grace == 0 && keep == 0);
+	n_max = WS_ReserveLumps(wrk->aws, sizeof *ocp);
+	if (n_max < 2) {
+		ocp = oc_nows;
+		n_max = 2;
+	} else
+		ocp = WS_Reservation(wrk->aws);
+	AN(ocp);
+
+	Lck_Lock(&ts->mtx);
+	key = tag_find(ts, tag, l);
+	ref = key != NULL ? VTAILQ_FIRST(&key->refs) : NULL;
+	n = 0;
+	while (1) {
+		for (; n < n_max && ref != NULL; ref = VTAILQ_NEXT(ref, list)) {
+			oc = ref->oc;
+			CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+			oh = oc->objhead;
+			CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+			Lck_Lock(&oh->mtx);
+			/* refcnt zero means it is on its way out */
+			if (oc->refcnt > 0 &&
+			    !(oc->flags & (OC_F_BUSY | OC_F_DYING))) {
+				if (is_purge)
+					oc->flags |= OC_F_DYING;
+				oc->refcnt++;
+				ocp[n++] = oc;
+				last = ref;
+			}
+			Lck_Unlock(&oh->mtx);
+		}
+
+		Lck_Unlock(&ts->mtx);
+
+		if (n == 0)
+			break;
+
+		j = n;
+		if (ref != NULL) {
+			/* Keep the last one as the bookmark */
+			j--;
+			assert(j >= 1);
+		}
+		for (i = 0; i < j; i++) {
+			CHECK_OBJ_NOTNULL(ocp[i], OBJCORE_MAGIC);
+			if (is_purge)
+				EXP_Remove(ocp[i], NULL);
+			else
+				EXP_Reduce(ocp[i], ttl_now, ttl, grace, keep);
+			(void)HSH_DerefObjCore(wrk, &ocp[i], 0);
+			AZ(ocp[i]);
+			total++;
+		}
+
+		if (j == n)
+			break;
+
+		Lck_Lock(&ts->mtx);
+		CHECK_OBJ_NOTNULL(ocp[j], OBJCORE_MAGIC);
+		AN(last);
+		assert(last->oc == ocp[j]);
+		ocp[0] = ocp[j];
+		n = 1;
+		ref = VTAILQ_NEXT(last, list);
+	}
+
+	WS_Release(wrk->aws, 0);
+	wrk->stats->tag_purged += total;
+	if (is_purge)
+		Pool_PurgeStat(total);
+	return (total);
+}
+
+void
+TAG_Init(void)
+{
+	unsigned u;
+
+	for (u = 0; u < TAG_NSHARD; u++) {
+		Lck_New(&tag_shards[u].mtx, lck_tag);
+		VRBT_INIT(&tag_shards[u].tree);
+	}
+}
@@ -278,6 +278,10 @@ enum vbf_fetch_mode_e {
 void VBF_Fetch(struct worker *wrk, struct req *req,
     struct objcore *oc, struct objcore *oldoc, enum vbf_fetch_mode_e);
 const char *VBF_Get_Filter_List(struct busyobj *);
+typedef int vbf_resume_f(struct busyobj *, int timedout, unsigned priv);
+int VBF_Park(struct busyobj *, int fd, vtim_real when, vbf_resume_f *,
+    unsigned priv);
+int VBF_Parked(const struct busyobj *);
 void Bereq_Rollback(VRT_CTX);
 
 /* cache_fetch_proc.c */
@@ -297,6 +301,7 @@ extern const struct vfp VFP_esi_gzip;
 
 /* cache_http.c */
 void HTTP_Init(void);
+void http_IndexHdr(struct http *, unsigned u);
 
 /* cache_http1_proto.c */
 
@@ -352,6 +357,9 @@ void *ObjSetAttr(struct worker *, struct objcore *, enum obj_attr,
 int ObjCopyAttr(struct worker *, struct objcore *, struct objcore *,
     enum obj_attr attr);
 void ObjBocDone(struct worker *, struct objcore *, struct boc **);
+typedef int objsendfile_f(void *priv, int fd, off_t off, ssize_t len);
+int ObjSendfile(struct worker *, struct objcore *, void *priv,
+    objsendfile_f *func);
 
 int ObjSetDouble(struct worker *, struct objcore *, enum obj_attr, double);
 int ObjSetU64(struct worker *, struct objcore *, enum obj_attr, uint64_t);
@@ -480,6 +488,13 @@ void VCP_Panic(struct vsb *, struct conn_pool *);
 /* cache_backend_probe.c */
 void VBP_Init(void);
 
+/* cache_tag.c */
+void TAG_Init(void);
+void TAG_Object(struct worker *, struct objcore *, const char *tags);
+void TAG_DestroyObj(struct objcore *);
+unsigned TAG_Purge(struct worker *, const char *tag, vtim_real ttl_now,
+    vtim_dur ttl, vtim_dur grace, vtim_dur keep);
+
 /* cache_vary.c */
 int VRY_Create(struct busyobj *bo, struct vsb **psb);
 int VRY_Match(const struct req *, const uint8_t *vary);
@@ -577,6 +592,7 @@ void V2D_Init(void);
 void STV_open(void);
 void STV_close(void);
 const struct stevedore *STV_next(void);
+int STV_Admit(const struct stevedore *, const uint8_t *digest, int count);
 int STV_BanInfoDrop(const uint8_t *ban, unsigned len);
 int STV_BanInfoNew(const uint8_t *ban, unsigned len);
 void STV_BanExport(const uint8_t *banlist, unsigned len);
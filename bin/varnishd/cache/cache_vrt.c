@@ -1016,6 +1016,56 @@ VRT_purge(VRT_CTX, VCL_DURATION ttl, VCL_DURATION grace, VCL_DURATION keep)
 	    ctx->req->t_req, ttl, grace, keep));
 }
 
+/*--------------------------------------------------------------------
+ * Surrogate keys
+ */
+
+VCL_VOID
+VRT_tag(VRT_CTX, VCL_STRING tags)
+{
+	struct objcore *oc;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+
+	if ((ctx->method & VCL_MET_BACKEND_RESPONSE) == 0) {
+		VRT_fail(ctx,
+		    "tags can only be set in vcl_backend_response{}");
+		return;
+	}
+
+	CHECK_OBJ_NOTNULL(ctx->bo, BUSYOBJ_MAGIC);
+	oc = ctx->bo->fetch_objcore;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	/* A pass has nothing to purge */
+	if (oc->flags & OC_F_PRIVATE)
+		return;
+	TAG_Object(ctx->bo->wrk, oc, tags);
+}
+
+VCL_INT
+VRT_purge_tag(VRT_CTX, VCL_STRING tag, VCL_DURATION ttl, VCL_DURATION grace,
+    VCL_DURATION keep)
+{
+	struct worker *wrk;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+
+	if (ctx->req != NULL) {
+		CHECK_OBJ(ctx->req, REQ_MAGIC);
+		wrk = ctx->req->wrk;
+	} else if (ctx->bo != NULL) {
+		CHECK_OBJ(ctx->bo, BUSYOBJ_MAGIC);
+		wrk = ctx->bo->wrk;
+	} else {
+		VRT_fail(ctx, "purge by tag needs a client or backend task");
+		return (0);
+	}
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	if (tag == NULL)
+		return (0);
+	return (TAG_Purge(wrk, tag, ctx->now, ttl, grace, keep));
+}
+
 /*--------------------------------------------------------------------
  */
 
@@ -489,6 +489,31 @@ VRT_l_beresp_storage(VRT_CTX, VCL_STEVEDORE stv)
 	ctx->bo->storage = stv;
 }
 
+VCL_BOOL
+VRT_r_beresp_admit(VRT_CTX)
+{
+	struct busyobj *bo;
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	bo = ctx->bo;
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	if (bo->admit >= 0 && bo->admit_stv == bo->storage)
+		return (bo->admit);
+	if (bo->storage == NULL)
+		return (1);
+	/* Only the fetch counts as a request for the object */
+	return (STV_Admit(bo->storage, bo->digest, 0));
+}
+
+VCL_VOID
+VRT_l_beresp_admit(VRT_CTX, VCL_BOOL a)
+{
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(ctx->bo, BUSYOBJ_MAGIC);
+	ctx->bo->admit = a ? 1 : 0;
+	ctx->bo->admit_stv = ctx->bo->storage;
+}
+
 /*--------------------------------------------------------------------
  * VCL <= 4.0 ONLY
  */
@@ -46,6 +46,9 @@ struct listen_sock {
 	VTAILQ_ENTRY(listen_sock)	arglist;
 	int				sock;
 	int				uds;
+	unsigned			reuseport_n;
+	unsigned			reuseport_idx;
+	unsigned			reuseport_cpu;
 	char				*endpoint;
 	const char			*name;
 	const struct suckaddr		*addr;
@@ -41,6 +41,8 @@
 #include "common/heritage.h"
 
 #include "hash/hash_slinger.h"
+#include "vmb.h"
+#include "vtim.h"
 
 static struct VSC_lck *lck_hcl;
 
@@ -49,12 +51,43 @@ static struct VSC_lck *lck_hcl;
 struct hcl_hd {
 	unsigned		magic;
 #define HCL_HEAD_MAGIC		0x0f327016
+	unsigned		moved;
 	VTAILQ_HEAD(, objhead)	head;
 	struct lock		mtx;
 };
 
+struct hcl_table {
+	unsigned		magic;
+#define HCL_TABLE_MAGIC		0x5e1f0a63
+	unsigned		nhash;
+	unsigned		nmoved;
+	vtim_mono		retired;
+	struct hcl_hd		*head;
+	VTAILQ_ENTRY(hcl_table)	list;
+};
+
+/*
+ * The table is resized when the average chain length leaves the
+ * [HCL_LOAD_MIN...HCL_LOAD_MAX] range, aiming for HCL_LOAD_TARGET.
+ * HCL_REHASH_STEP buckets are migrated every HCL_REHASH_PAUSE seconds.
+ */
+#define HCL_LOAD_MIN		1
+#define HCL_LOAD_TARGET		4
+#define HCL_LOAD_MAX		16
+#define HCL_NHASH_MAX		(1U << 30)
+#define HCL_REHASH_STEP		256
+#define HCL_REHASH_PAUSE	0.01
+#define HCL_RESIZE_CHECK	1.0
+
 static unsigned			hcl_nhash = 16383;
-static struct hcl_hd		*hcl_head;
+static struct hcl_table		*hcl_tbl;
+static struct hcl_table		*hcl_otbl;
+static VTAILQ_HEAD(, hcl_table)	hcl_retired =
+    VTAILQ_HEAD_INITIALIZER(hcl_retired);
+
+static struct lock		hcl_cool_mtx;
+static VTAILQ_HEAD(, objhead)	cool_h = VTAILQ_HEAD_INITIALIZER(cool_h);
+static VTAILQ_HEAD(, objhead)	dead_h = VTAILQ_HEAD_INITIALIZER(dead_h);
 
 /*--------------------------------------------------------------------
  * The ->init method allows the management process to pass arguments
@@ -86,6 +119,265 @@ hcl_init(int ac, char * const *av)
 	fprintf(stderr, "Classic hash: %u buckets\n", hcl_nhash);
 }
 
+/*--------------------------------------------------------------------*/
+
+static struct hcl_table *
+hcl_table_new(unsigned nhash)
+{
+	struct hcl_table *tbl;
+	unsigned u;
+
+	ALLOC_OBJ(tbl, HCL_TABLE_MAGIC);
+	AN(tbl);
+	tbl->nhash = nhash;
+	tbl->head = calloc(nhash, sizeof *tbl->head);
+	AN(tbl->head);
+	for (u = 0; u < nhash; u++) {
+		VTAILQ_INIT(&tbl->head[u].head);
+		Lck_New(&tbl->head[u].mtx, lck_hcl);
+		tbl->head[u].magic = HCL_HEAD_MAGIC;
+	}
+	return (tbl);
+}
+
+static void
+hcl_table_free(struct hcl_table *tbl)
+{
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(tbl, HCL_TABLE_MAGIC);
+	for (u = 0; u < tbl->nhash; u++) {
+		AN(tbl->head[u].moved);
+		assert(VTAILQ_EMPTY(&tbl->head[u].head));
+		Lck_Delete(&tbl->head[u].mtx);
+	}
+	free(tbl->head);
+	FREE_OBJ(tbl);
+}
+
+static struct hcl_hd *
+hcl_bucket(const struct hcl_table *tbl, const void *digest)
+{
+	unsigned hdigest;
+
+	CHECK_OBJ_NOTNULL(tbl, HCL_TABLE_MAGIC);
+	assert(DIGEST_LEN >= sizeof hdigest);
+	memcpy(&hdigest, digest, sizeof hdigest);
+	return (&tbl->head[hdigest % tbl->nhash]);
+}
+
+/*--------------------------------------------------------------------
+ * Lookups traverse the bucket lists without holding the bucket lock,
+ * so deleted objheads must stay around until no reader can possibly
+ * still be looking at them.  Like the critbit hasher we park them on
+ * a cooloff list before they are finally freed.
+ */
+
+static void * v_matchproto_(bgthread_t)
+hcl_cleaner(struct worker *wrk, void *priv)
+{
+	struct objhead *oh, *oh2;
+
+	(void)priv;
+	while (1) {
+		VTAILQ_FOREACH_SAFE(oh, &dead_h, hoh_list, oh2) {
+			CHECK_OBJ(oh, OBJHEAD_MAGIC);
+			VTAILQ_REMOVE(&dead_h, oh, hoh_list);
+			HSH_DeleteObjHead(wrk, oh);
+		}
+		Lck_Lock(&hcl_cool_mtx);
+		VTAILQ_CONCAT(&dead_h, &cool_h, hoh_list);
+		Lck_Unlock(&hcl_cool_mtx);
+		Pool_Sumstat(wrk);
+		VTIM_sleep(cache_param->critbit_cooloff);
+	}
+	NEEDLESS(return (NULL));
+}
+
+/*--------------------------------------------------------------------
+ * Walk a bucket list looking for digest.
+ *
+ * The lists are sorted by digest, and if the key is not present, *pnext
+ * is set to the element the key should be inserted before.
+ *
+ * Without the bucket lock held, an element we step onto can be removed
+ * and moved to the cooloff list or to another bucket under us, so the
+ * result is only a hint which the caller must validate by checking the
+ * refcount under the objhead lock.
+ */
+
+static struct objhead *
+hcl_find(const struct hcl_hd *hp, const void *digest, struct objhead **pnext)
+{
+	struct objhead *oh;
+	int i;
+
+	CHECK_OBJ_NOTNULL(hp, HCL_HEAD_MAGIC);
+	VTAILQ_FOREACH(oh, &hp->head, hoh_list) {
+		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+		i = memcmp(oh->digest, digest, sizeof oh->digest);
+		if (i < 0)
+			continue;
+		if (i > 0)
+			break;
+		return (oh);
+	}
+	if (pnext != NULL)
+		*pnext = oh;
+	return (NULL);
+}
+
+/*--------------------------------------------------------------------
+ * Link oh into the bucket list before oh2, bucket lock held.
+ */
+
+static void
+hcl_link(struct hcl_hd *hp, struct objhead *oh, struct objhead *oh2)
+{
+
+	Lck_AssertHeld(&hp->mtx);
+
+	/* Unlocked readers must never see a half-linked objhead */
+	VTAILQ_NEXT(oh, hoh_list) = oh2;
+	VWMB();
+	if (oh2 != NULL)
+		VTAILQ_INSERT_BEFORE(oh2, oh, hoh_list);
+	else
+		VTAILQ_INSERT_TAIL(&hp->head, oh, hoh_list);
+	oh->hoh_head = hp;
+}
+
+/*--------------------------------------------------------------------
+ * Find and lock the bucket which is authoritative for digest.
+ *
+ * While the table is being resized, the bucket in the old table is
+ * authoritative until it has been migrated.  A migrated bucket is
+ * never used again, so if we find one, our view of the tables is
+ * stale and we start over.
+ */
+
+static struct hcl_hd *
+hcl_lock_bucket(const void *digest)
+{
+	struct hcl_table *tbl, *otbl;
+	struct hcl_hd *hp;
+
+	while (1) {
+		tbl = hcl_tbl;
+		VRMB();
+		otbl = hcl_otbl;
+		if (otbl != NULL && otbl != tbl) {
+			hp = hcl_bucket(otbl, digest);
+			Lck_Lock(&hp->mtx);
+			if (!hp->moved)
+				return (hp);
+			Lck_Unlock(&hp->mtx);
+		}
+		hp = hcl_bucket(tbl, digest);
+		Lck_Lock(&hp->mtx);
+		if (!hp->moved)
+			return (hp);
+		Lck_Unlock(&hp->mtx);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Online resizing
+ *
+ * When the number of objheads strays too far from the number of
+ * buckets, a new table is allocated and the buckets of the old table
+ * are migrated HCL_REHASH_STEP at a time, so lookups never wait for
+ * more than a single bucket to be moved.  Retired tables are kept for
+ * critbit_cooloff seconds for the benefit of unlocked readers.
+ */
+
+static unsigned
+hcl_target(unsigned nhash, uint64_t noh)
+{
+	uint64_t n;
+
+	if (noh > (uint64_t)nhash * HCL_LOAD_MAX)
+		n = noh / HCL_LOAD_TARGET;
+	else if (noh < (uint64_t)nhash * HCL_LOAD_MIN && nhash > hcl_nhash)
+		n = noh / HCL_LOAD_TARGET;
+	else
+		return (nhash);
+	if (n < hcl_nhash)
+		n = hcl_nhash;
+	if (n > HCL_NHASH_MAX)
+		n = HCL_NHASH_MAX;
+	return ((unsigned)n | 1);
+}
+
+static void
+hcl_migrate(struct hcl_table *otbl, struct hcl_table *tbl)
+{
+	struct objhead *oh, *oh2;
+	struct hcl_hd *hp, *nhp;
+	unsigned u;
+
+	for (u = 0; u < HCL_REHASH_STEP && otbl->nmoved < otbl->nhash; u++) {
+		hp = &otbl->head[otbl->nmoved++];
+		Lck_Lock(&hp->mtx);
+		while ((oh = VTAILQ_FIRST(&hp->head)) != NULL) {
+			CHECK_OBJ(oh, OBJHEAD_MAGIC);
+			nhp = hcl_bucket(tbl, oh->digest);
+			Lck_Lock(&nhp->mtx);
+			AZ(nhp->moved);
+			VTAILQ_REMOVE(&hp->head, oh, hoh_list);
+			oh2 = NULL;
+			AZ(hcl_find(nhp, oh->digest, &oh2));
+			hcl_link(nhp, oh, oh2);
+			Lck_Unlock(&nhp->mtx);
+		}
+		hp->moved = 1;
+		Lck_Unlock(&hp->mtx);
+	}
+}
+
+static void * v_matchproto_(bgthread_t)
+hcl_rehash(struct worker *wrk, void *priv)
+{
+	struct hcl_table *tbl, *otbl;
+	unsigned n;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	(void)priv;
+	while (1) {
+		otbl = hcl_otbl;
+		if (otbl != NULL) {
+			hcl_migrate(otbl, hcl_tbl);
+			if (otbl->nmoved == otbl->nhash) {
+				hcl_otbl = NULL;
+				otbl->retired = VTIM_mono();
+				VTAILQ_INSERT_TAIL(&hcl_retired, otbl, list);
+				VSC_C_main->hcl_buckets = hcl_tbl->nhash;
+			}
+			VTIM_sleep(HCL_REHASH_PAUSE);
+			continue;
+		}
+
+		otbl = VTAILQ_FIRST(&hcl_retired);
+		if (otbl != NULL && otbl->retired +
+		    cache_param->critbit_cooloff < VTIM_mono()) {
+			VTAILQ_REMOVE(&hcl_retired, otbl, list);
+			hcl_table_free(otbl);
+		}
+
+		n = hcl_target(hcl_tbl->nhash, VSC_C_main->n_objecthead);
+		if (n != hcl_tbl->nhash) {
+			tbl = hcl_table_new(n);
+			hcl_otbl = hcl_tbl;
+			VWMB();
+			hcl_tbl = tbl;
+			VSC_C_main->hcl_rehash++;
+			continue;
+		}
+		VTIM_sleep(HCL_RESIZE_CHECK);
+	}
+	NEEDLESS(return (NULL));
+}
+
 /*--------------------------------------------------------------------
  * The ->start method is called during cache process start and allows
  * initialization to happen before the first lookup.
@@ -94,17 +386,14 @@ hcl_init(int ac, char * const *av)
 static void v_matchproto_(hash_start_f)
 hcl_start(void)
 {
-	unsigned u;
+	pthread_t tp;
 
 	lck_hcl = Lck_CreateClass(NULL, "hcl");
-	hcl_head = calloc(hcl_nhash, sizeof *hcl_head);
-	XXXAN(hcl_head);
-
-	for (u = 0; u < hcl_nhash; u++) {
-		VTAILQ_INIT(&hcl_head[u].head);
-		Lck_New(&hcl_head[u].mtx, lck_hcl);
-		hcl_head[u].magic = HCL_HEAD_MAGIC;
-	}
+	hcl_tbl = hcl_table_new(hcl_nhash);
+	VSC_C_main->hcl_buckets = hcl_nhash;
+	Lck_New(&hcl_cool_mtx, lck_hcl);
+	WRK_BgThread(&tp, "hcl-cleaner", hcl_cleaner, NULL);
+	WRK_BgThread(&tp, "hcl-rehash", hcl_rehash, NULL);
 }
 
 /*--------------------------------------------------------------------
@@ -112,40 +401,56 @@ hcl_start(void)
  * If nobj != NULL and the lookup does not find key, nobj is inserted.
  * If nobj == NULL and the lookup does not find key, NULL is returned.
  * A reference to the returned object is held.
- * We use a two-pass algorithm to handle inserts as they are quite
- * rare and collisions even rarer.
+ *
+ * We first try without the bucket lock, which is all it takes for a
+ * hit on an existing objhead.  A refcount of zero means the objhead is
+ * on its way out, and misses and inserts always take the bucket lock.
  */
 
 static struct objhead * v_matchproto_(hash_lookup_f)
 hcl_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 {
-	struct objhead *oh;
+	struct objhead *oh, *oh2;
+	struct hcl_table *tbl, *otbl;
 	struct hcl_hd *hp;
-	unsigned u1, hdigest;
-	int i;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	AN(digest);
 	if (noh != NULL)
 		CHECK_OBJ_NOTNULL(*noh, OBJHEAD_MAGIC);
 
-	assert(sizeof oh->digest >= sizeof hdigest);
-	memcpy(&hdigest, digest, sizeof hdigest);
-	u1 = hdigest % hcl_nhash;
-	hp = &hcl_head[u1];
+	tbl = hcl_tbl;
+	VRMB();
+	otbl = hcl_otbl;
+	oh = hcl_find(hcl_bucket(tbl, digest), digest, NULL);
+	if (oh == NULL && otbl != NULL)
+		oh = hcl_find(hcl_bucket(otbl, digest), digest, NULL);
+	if (oh != NULL) {
+		Lck_Lock(&oh->mtx);
+		if (oh->refcnt > 0) {
+			oh->refcnt++;
+			wrk->stats->hcl_nolock++;
+			return (oh);
+		}
+		Lck_Unlock(&oh->mtx);
+	}
 
-	Lck_Lock(&hp->mtx);
-	VTAILQ_FOREACH(oh, &hp->head, hoh_list) {
-		CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
-		i = memcmp(oh->digest, digest, sizeof oh->digest);
-		if (i < 0)
-			continue;
-		if (i > 0)
+	while (1) {
+		hp = hcl_lock_bucket(digest);
+		wrk->stats->hcl_lock++;
+		oh2 = NULL;
+		oh = hcl_find(hp, digest, &oh2);
+		if (oh == NULL)
 			break;
-		oh->refcnt++;
 		Lck_Unlock(&hp->mtx);
+
 		Lck_Lock(&oh->mtx);
-		return (oh);
+		if (oh->refcnt > 0) {
+			oh->refcnt++;
+			return (oh);
+		}
+		/* Raced hcl_deref(), it will unlink oh shortly */
+		Lck_Unlock(&oh->mtx);
 	}
 
 	if (noh == NULL) {
@@ -153,16 +458,11 @@ hcl_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 		return (NULL);
 	}
 
-	if (oh != NULL)
-		VTAILQ_INSERT_BEFORE(oh, *noh, hoh_list);
-	else
-		VTAILQ_INSERT_TAIL(&hp->head, *noh, hoh_list);
-
 	oh = *noh;
 	*noh = NULL;
 	memcpy(oh->digest, digest, sizeof oh->digest);
-
-	oh->hoh_head = hp;
+	hcl_link(hp, oh, oh2);
+	wrk->stats->hcl_insert++;
 
 	Lck_Unlock(&hp->mtx);
 	Lck_Lock(&oh->mtx);
@@ -171,6 +471,9 @@ hcl_lookup(struct worker *wrk, const void *digest, struct objhead **noh)
 
 /*--------------------------------------------------------------------
  * Dereference and if no references are left, free.
+ *
+ * The rehash thread can move oh to another bucket until we hold the
+ * lock of the bucket it is on.
  */
 
 static int v_matchproto_(hash_deref_f)
@@ -179,22 +482,30 @@ hcl_deref(struct worker *wrk, struct objhead *oh)
 	struct hcl_hd *hp;
 	int ret;
 
+	(void)wrk;
 	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
 	Lck_AssertHeld(&oh->mtx);
-	Lck_Unlock(&oh->mtx);
 
-	CAST_OBJ_NOTNULL(hp, oh->hoh_head, HCL_HEAD_MAGIC);
 	assert(oh->refcnt > 0);
-	Lck_Lock(&hp->mtx);
-	if (--oh->refcnt == 0) {
+	ret = --oh->refcnt;
+	if (ret == 0) {
+		while (1) {
+			CAST_OBJ_NOTNULL(hp, oh->hoh_head, HCL_HEAD_MAGIC);
+			Lck_Lock(&hp->mtx);
+			if (oh->hoh_head == hp)
+				break;
+			Lck_Unlock(&hp->mtx);
+		}
 		VTAILQ_REMOVE(&hp->head, oh, hoh_list);
-		ret = 0;
-	} else
-		ret = 1;
-	Lck_Unlock(&hp->mtx);
-	if (!ret)
-		HSH_DeleteObjHead(wrk, oh);
-	return (ret);
+		Lck_Unlock(&hp->mtx);
+	}
+	Lck_Unlock(&oh->mtx);
+	if (ret == 0) {
+		Lck_Lock(&hcl_cool_mtx);
+		VTAILQ_INSERT_TAIL(&cool_h, oh, hoh_list);
+		Lck_Unlock(&hcl_cool_mtx);
+	}
+	return (ret != 0);
 }
 
 /*--------------------------------------------------------------------*/
@@ -34,6 +34,7 @@
 /* VHT - Varnish HPACK Table */
 
 #define VHT_ENTRY_SIZE 32U
+#define VHT_STATIC_MAX 61
 
 struct vht_entry {
 	unsigned		magic;
@@ -60,8 +60,6 @@
 
 #include "hpack/vhp.h"
 
-#define VHT_STATIC_MAX 61
-
 struct vht_static {
 	const char *name;
 	unsigned namelen;
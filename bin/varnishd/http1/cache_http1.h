@@ -50,6 +50,7 @@ struct v1p_acct {
 	uint64_t        bereq;
 	uint64_t        in;
 	uint64_t        out;
+	uint64_t        spliced;
 };
 
 int V1P_Enter(void);
@@ -62,10 +63,16 @@ void V1P_Charge(struct req *, const struct v1p_acct *, struct VSC_vbe *);
 void V1L_Chunked(const struct worker *w);
 void V1L_EndChunk(const struct worker *w);
 void V1L_Open(struct worker *, struct ws *, int *fd, struct vsl_log *,
-    vtim_real deadline, unsigned niov);
+    vtim_real deadline, unsigned niov, vtim_dur lowat_tmo);
 stream_close_t V1L_Flush(const struct worker *w);
 stream_close_t V1L_Close(struct worker *w, uint64_t *cnt);
 stream_close_t V1L_Reopen(struct worker *wrk, uint64_t *cnt, unsigned niov);
 
 size_t V1L_Write(const struct worker *w, const void *ptr, ssize_t len);
+int V1L_ZeroCopy(const struct worker *);
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+#  define V1L_SENDFILE
+stream_close_t V1L_Sendfile(const struct worker *, int fd, off_t off,
+    ssize_t len);
+#endif
 extern const struct vdp * const VDP_v1l;
@@ -61,6 +61,75 @@ v1d_error(struct req *req, struct boc *boc, const char *msg)
 	req->acct.resp_bodybytes += VDP_Close(req->vdc, req->objcore, boc);
 }
 
+/*--------------------------------------------------------------------
+ * Send the body straight from the storage file, when V1B is the only
+ * delivery processor.  Returns 1, before sending anything, if we cannot.
+ */
+
+#ifdef V1L_SENDFILE
+static int v_matchproto_(objsendfile_f)
+v1d_sendfile_seg(void *priv, int fd, off_t off, ssize_t len)
+{
+	struct vdp_ctx *vdc;
+	struct vdp_entry *vdpe;
+
+	CAST_OBJ_NOTNULL(vdc, priv, VDP_CTX_MAGIC);
+	vdpe = VTAILQ_FIRST(&vdc->vdp);
+	CHECK_OBJ_NOTNULL(vdpe, VDP_ENTRY_MAGIC);
+	vdpe->calls++;
+	if (V1L_Sendfile(vdc->wrk, fd, off, len) != SC_NULL)
+		return (-1);
+	vdpe->bytes_in += len;
+	return (0);
+}
+#endif
+
+static int
+v1d_sendfile(struct req *req)
+{
+#ifdef V1L_SENDFILE
+	struct vdp_entry *vdpe;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	if (!cache_param->http1_sendfile)
+		return (1);
+	vdpe = VTAILQ_FIRST(&req->vdc->vdp);
+	CHECK_OBJ_NOTNULL(vdpe, VDP_ENTRY_MAGIC);
+	if (vdpe->vdp != VDP_v1l || VTAILQ_NEXT(vdpe, list) != NULL)
+		return (1);
+	return (ObjSendfile(req->wrk, req->objcore, req->vdc,
+	    v1d_sendfile_seg));
+#else
+	(void)req;
+	return (1);
+#endif
+}
+
+/*--------------------------------------------------------------------
+ * MSG_ZEROCOPY needs the body to stay put until the kernel is done
+ * with it, which rules out delivery processors with their own buffers
+ * and objects whose storage is freed as it is delivered.
+ */
+
+static void
+v1d_zerocopy(struct req *req)
+{
+	struct vdp_entry *vdpe;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(req->objcore, OBJCORE_MAGIC);
+	if (cache_param->http1_zerocopy == 0 ||
+	    req->resp_len < (intmax_t)cache_param->http1_zerocopy)
+		return;
+	if (req->objcore->flags & (OC_F_PRIVATE | OC_F_HFM | OC_F_HFP))
+		return;
+	vdpe = VTAILQ_FIRST(&req->vdc->vdp);
+	CHECK_OBJ_NOTNULL(vdpe, VDP_ENTRY_MAGIC);
+	if (vdpe->vdp != VDP_v1l || VTAILQ_NEXT(vdpe, list) != NULL)
+		return;
+	(void)V1L_ZeroCopy(req->wrk);
+}
+
 /*--------------------------------------------------------------------
  */
 
@@ -125,7 +194,7 @@ V1D_Deliver(struct req *req, struct boc *boc, int sendbody)
 	AZ(req->wrk->v1l);
 	V1L_Open(req->wrk, req->wrk->aws, &req->sp->fd, req->vsl,
 	    req->t_prev + SESS_TMO(req->sp, send_timeout),
-	    niov);
+	    niov, SESS_TMO(req->sp, idle_send_timeout));
 
 	if (WS_Overflowed(req->wrk->aws)) {
 		v1d_error(req, boc, "workspace_thread overflow");
@@ -156,6 +225,12 @@ V1D_Deliver(struct req *req, struct boc *boc, int sendbody)
 			(void)V1L_Flush(req->wrk);
 		if (chunked)
 			V1L_Chunked(req->wrk);
+		else if (boc == NULL) {
+			err = v1d_sendfile(req);
+			if (err <= 0)
+				break;
+			v1d_zerocopy(req);
+		}
 		err = VDP_DeliverObj(req->vdc, req->objcore);
 		if (!err && chunked)
 			V1L_EndChunk(req->wrk);
@@ -42,12 +42,24 @@
 #include "config.h"
 
 #include <sys/uio.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#  include <sys/sendfile.h>
+#endif
 #include "cache/cache_varnishd.h"
 #include "cache/cache_filter.h"
 
 #include <stdio.h>
 
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(MSG_ZEROCOPY) && \
+    defined(SO_ZEROCOPY)
+#  define V1L_ZEROCOPY
+#  include <netinet/in.h>
+#  include <linux/errqueue.h>
+#  include <poll.h>
+#endif
+
 #include "cache_http1.h"
+#include "vtcp.h"
 #include "vtim.h"
 
 /*--------------------------------------------------------------------*/
@@ -64,12 +76,22 @@ struct v1l {
 	ssize_t			cliov;
 	unsigned		ciov;	/* Chunked header marker */
 	vtim_real		deadline;
+	vtim_dur		lowat_tmo; /* client socket, see Flush */
 	struct vsl_log		*vsl;
 	ssize_t			cnt;	/* Flushed byte count */
 	struct ws		*ws;
 	uintptr_t		ws_snap;
+	unsigned		zc;	/* MSG_ZEROCOPY enabled */
+	unsigned		zc_copied;
+	uint32_t		zc_sent;
+	uint32_t		zc_done;
 };
 
+/* Below this, copying is cheaper than page pinning and notification */
+#define V1L_ZC_MIN		(16 * 1024)
+
+static void v1l_zc_reap(struct v1l *, const struct worker *);
+
 /*--------------------------------------------------------------------
  * for niov == 0, reserve the ws for max number of iovs
  * otherwise, up to niov
@@ -77,7 +99,7 @@ struct v1l {
 
 void
 V1L_Open(struct worker *wrk, struct ws *ws, int *fd, struct vsl_log *vsl,
-    vtim_real deadline, unsigned niov)
+    vtim_real deadline, unsigned niov, vtim_dur lowat_tmo)
 {
 	struct v1l *v1l;
 	unsigned u;
@@ -118,6 +140,7 @@ V1L_Open(struct worker *wrk, struct ws *ws, int *fd, struct vsl_log *vsl,
 	v1l->ciov = u;
 	v1l->wfd = fd;
 	v1l->deadline = deadline;
+	v1l->lowat_tmo = lowat_tmo;
 	v1l->vsl = vsl;
 	v1l->werr = SC_NULL;
 
@@ -139,6 +162,10 @@ V1L_Close(struct worker *wrk, uint64_t *cnt)
 	AN(cnt);
 	sc = V1L_Flush(wrk);
 	TAKE_OBJ_NOTNULL(v1l, &wrk->v1l, V1L_MAGIC);
+	if (v1l->zc) {
+		v1l_zc_reap(v1l, wrk);
+		sc = v1l->werr;
+	}
 	*cnt += v1l->cnt;
 	ws = v1l->ws;
 	ws_snap = v1l->ws_snap;
@@ -158,18 +185,20 @@ V1L_Reopen(struct worker *wrk, uint64_t *cnt, unsigned niov)
 	int *fd;
 	struct vsl_log *vsl;
 	vtim_real deadline;
+	vtim_dur lowat_tmo;
 
 	ws = v1l->ws;
 	fd = v1l->wfd;
 	vsl = v1l->vsl;
 	deadline = v1l->deadline;
+	lowat_tmo = v1l->lowat_tmo;
 	v1l = NULL;
 
 	sc = V1L_Close(wrk, cnt);
 	if (sc != SC_NULL)
 		return (sc);
 
-	V1L_Open(wrk, ws, fd, vsl, deadline, niov);
+	V1L_Open(wrk, ws, fd, vsl, deadline, niov, lowat_tmo);
 	return (sc);
 }
 
@@ -198,6 +227,156 @@ v1l_prune(struct v1l *v1l, size_t bytes)
 	AZ(v1l->liov);
 }
 
+/*--------------------------------------------------------------------
+ * MSG_ZEROCOPY
+ *
+ * The kernel pins the pages we send from and notifies us on the error
+ * queue when it is done with them, as ranges of sendmsg(2) call
+ * numbers.  Everything the iovecs point to must stay put until then,
+ * so V1L_Close() waits for all notifications before rolling back the
+ * workspace, and V1D_Deliver() only asks for zero copy when the body
+ * comes from storage which lives on after the delivery.
+ */
+
+static ssize_t
+v1l_send(struct v1l *v1l, const struct worker *wrk)
+{
+#ifdef V1L_ZEROCOPY
+	struct msghdr msg;
+	ssize_t i;
+
+	if (v1l->zc && v1l->liov >= V1L_ZC_MIN) {
+		memset(&msg, 0, sizeof msg);
+		msg.msg_iov = v1l->iov;
+		msg.msg_iovlen = v1l->niov;
+		i = sendmsg(*v1l->wfd, &msg, MSG_ZEROCOPY);
+		if (i > 0) {
+			v1l->zc_sent++;
+			wrk->stats->http1_zerocopy_bytes += i;
+			return (i);
+		}
+		if (i == 0 || errno != ENOBUFS)
+			return (i);
+		/* Out of optmem for notifications, copy this one */
+		v1l->zc_copied = 1;
+	}
+#else
+	(void)wrk;
+#endif
+	return (writev(*v1l->wfd, v1l->iov, v1l->niov));
+}
+
+static void
+v1l_zc_reap(struct v1l *v1l, const struct worker *wrk)
+{
+#ifdef V1L_ZEROCOPY
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct sock_extended_err *ee;
+	struct pollfd pfd[1];
+	union {
+		char		buf[CMSG_SPACE(sizeof *ee) + 64];
+		struct cmsghdr	align;
+	} cbuf;
+	vtim_dur tmo;
+	ssize_t i;
+
+	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
+	AN(v1l->zc);
+
+	while (v1l->zc_done != v1l->zc_sent && *v1l->wfd >= 0) {
+		/*
+		 * After a write error the session is closed anyway, and
+		 * the pages stay pinned by the kernel until it lets go of
+		 * them, so there is no point in holding the worker.
+		 */
+		if (v1l->werr != SC_NULL)
+			break;
+		memset(&msg, 0, sizeof msg);
+		msg.msg_control = cbuf.buf;
+		msg.msg_controllen = sizeof cbuf.buf;
+		i = recvmsg(*v1l->wfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+		if (i < 0 && errno == EAGAIN) {
+			tmo = v1l->deadline - VTIM_real();
+			if (tmo <= 0.) {
+				VSLb(v1l->vsl, SLT_Debug,
+				    "Hit total send timeout, "
+				    "zerocopy pending = %u",
+				    v1l->zc_sent - v1l->zc_done);
+				v1l->werr = SC_TX_ERROR;
+				break;
+			}
+			/* A non-empty error queue polls as POLLERR */
+			pfd->fd = *v1l->wfd;
+			pfd->events = 0;
+			pfd->revents = 0;
+			(void)poll(pfd, 1, VTIM_poll_tmo(tmo));
+			continue;
+		}
+		if (i < 0) {
+			VSLb(v1l->vsl, SLT_Debug,
+			    "Zerocopy notification error, errno = %s",
+			    VAS_errtxt(errno));
+			v1l->werr = SC_TX_ERROR;
+			break;
+		}
+		for (cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+		    cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!(cm->cmsg_level == SOL_IP &&
+			    cm->cmsg_type == IP_RECVERR) &&
+			    !(cm->cmsg_level == SOL_IPV6 &&
+			    cm->cmsg_type == IPV6_RECVERR))
+				continue;
+			ee = (void *)CMSG_DATA(cm);
+			if (ee->ee_errno != 0 ||
+			    ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			v1l->zc_done += ee->ee_data - ee->ee_info + 1;
+			if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				v1l->zc_copied = 1;
+		}
+	}
+	if (v1l->zc_copied)
+		wrk->stats->http1_zerocopy_fallback++;
+#else
+	(void)v1l;
+	(void)wrk;
+	WRONG("No zerocopy");
+#endif
+}
+
+int
+V1L_ZeroCopy(const struct worker *wrk)
+{
+#ifdef V1L_ZEROCOPY
+	struct v1l *v1l;
+	int i = 1;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	v1l = wrk->v1l;
+	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
+	AN(v1l->wfd);
+	if (v1l->zc)
+		return (0);
+	/* The chunk heads live on the stack of V1L_Flush() */
+	if (*v1l->wfd < 0 || v1l->ciov < v1l->siov)
+		return (-1);
+	if (setsockopt(*v1l->wfd, SOL_SOCKET, SO_ZEROCOPY, &i, sizeof i)) {
+		VSLb(v1l->vsl, SLT_Debug, "SO_ZEROCOPY failed: %s",
+		    VAS_errtxt(errno));
+		wrk->stats->http1_zerocopy_fallback++;
+		return (-1);
+	}
+	v1l->zc = 1;
+	return (0);
+#else
+	(void)wrk;
+	return (-1);
+#endif
+}
+
+/*--------------------------------------------------------------------*/
+
 stream_close_t
 V1L_Flush(const struct worker *wrk)
 {
@@ -232,6 +411,14 @@ V1L_Flush(const struct worker *wrk)
 			v1l->iov[v1l->ciov].iov_len = 0;
 		}
 
+		/* Let the client drain below TCP_NOTSENT_LOWAT first */
+		if (v1l->lowat_tmo > 0 && cache_param->tcp_notsent_lowat > 0) {
+			wrk->stats->sess_notsent_wait++;
+			(void)VTCP_wait_writable(*v1l->wfd,
+			    vmin_t(vtim_dur, v1l->lowat_tmo,
+			    v1l->deadline - VTIM_real()));
+		}
+
 		i = 0;
 		err = 0;
 		do {
@@ -244,7 +431,7 @@ V1L_Flush(const struct worker *wrk)
 				break;
 			}
 
-			i = writev(*v1l->wfd, v1l->iov, v1l->niov);
+			i = v1l_send(v1l, wrk);
 			if (i > 0)
 				v1l->cnt += i;
 
@@ -296,6 +483,7 @@ size_t
 V1L_Write(const struct worker *wrk, const void *ptr, ssize_t len)
 {
 	struct v1l *v1l;
+	struct iovec *iov;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	v1l = wrk->v1l;
@@ -306,6 +494,16 @@ V1L_Write(const struct worker *wrk, const void *ptr, ssize_t len)
 	if (len == -1)
 		len = strlen(ptr);
 	assert(v1l->niov < v1l->siov);
+	if (v1l->niov > 0 && v1l->niov - 1 != v1l->ciov) {
+		/* Coalesce with the previous write, if it continues it */
+		iov = &v1l->iov[v1l->niov - 1];
+		if ((const char *)iov->iov_base + iov->iov_len == ptr) {
+			iov->iov_len += len;
+			v1l->liov += len;
+			v1l->cliov += len;
+			return (len);
+		}
+	}
 	v1l->iov[v1l->niov].iov_base = TRUST_ME(ptr);
 	v1l->iov[v1l->niov].iov_len = len;
 	v1l->liov += len;
@@ -318,6 +516,68 @@ V1L_Write(const struct worker *wrk, const void *ptr, ssize_t len)
 	return (len);
 }
 
+#ifdef V1L_SENDFILE
+/*--------------------------------------------------------------------
+ * Send len bytes from offset off of file fd, after whatever we have
+ * queued up.
+ */
+
+stream_close_t
+V1L_Sendfile(const struct worker *wrk, int fd, off_t off, ssize_t len)
+{
+	struct v1l *v1l;
+	ssize_t i;
+	int err;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	v1l = wrk->v1l;
+	CHECK_OBJ_NOTNULL(v1l, V1L_MAGIC);
+	assert(fd >= 0);
+	assert(len > 0);
+
+	if (V1L_Flush(wrk) != SC_NULL || *v1l->wfd < 0)
+		return (v1l->werr);
+	AZ(v1l->liov);
+
+	while (len > 0) {
+		if (VTIM_real() > v1l->deadline) {
+			VSLb(v1l->vsl, SLT_Debug,
+			    "Hit total send timeout, "
+			    "sendfile left = %zd; not retrying", len);
+			v1l->werr = SC_TX_ERROR;
+			break;
+		}
+
+		i = sendfile(*v1l->wfd, fd, &off, len);
+		if (i > 0) {
+			v1l->cnt += i;
+			wrk->stats->http1_sendfile_bytes += i;
+			len -= i;
+			continue;
+		}
+
+		err = errno;
+		if (i < 0 && err == EWOULDBLOCK) {
+			VSLb(v1l->vsl, SLT_Debug,
+			    "Hit idle send timeout, "
+			    "sendfile left = %zd; retrying", len);
+			continue;
+		}
+
+		VSLb(v1l->vsl, SLT_Debug,
+		    "Sendfile error, retval = %zd, len = %zd, errno = %s",
+		    i, len, VAS_errtxt(err));
+		if (err == EPIPE)
+			v1l->werr = SC_REM_CLOSE;
+		else
+			v1l->werr = SC_TX_ERROR;
+		break;
+	}
+	CHECK_OBJ_NOTNULL(v1l->werr, STREAM_CLOSE_MAGIC);
+	return (v1l->werr);
+}
+#endif
+
 void
 V1L_Chunked(const struct worker *wrk)
 {
@@ -329,6 +589,7 @@ V1L_Chunked(const struct worker *wrk)
 
 	assert(v1l->ciov == v1l->siov);
 	assert(v1l->siov >= 3);
+	AZ(v1l->zc);
 	/*
 	 * If there is no space for chunked header, a chunk of data and
 	 * a chunk tail, we might as well flush right away.
@@ -35,10 +35,14 @@
 
 #include "cache/cache_varnishd.h"
 
+#include <fcntl.h>
 #include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 
+#include "cache/cache_pool.h"
 #include "cache_http1.h"
+#include "waiter/waiter.h"
 #include "vtcp.h"
 #include "vtim.h"
 
@@ -68,6 +72,416 @@ rdf(int fd0, int fd1, uint64_t *pcnt)
 	return (0);
 }
 
+#ifdef HAVE_SPLICE
+/*--------------------------------------------------------------------
+ * Move what is there from fd0 to fd1 through the pipe pfd, without
+ * copying it through userspace.  Returns -1 if splice(2) does not work
+ * for these descriptors, before anything was read.
+ */
+
+#define V1P_SPLICE_LEN	(64 * 1024)
+
+static int
+rdf_splice(int fd0, int fd1, const int *pfd, uint64_t *pcnt,
+    uint64_t *pspliced)
+{
+	ssize_t i, j;
+
+	i = splice(fd0, NULL, pfd[1], NULL, V1P_SPLICE_LEN,
+	    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (i < 0 && errno == EINVAL)
+		return (-1);
+	if (i < 0 && errno == EAGAIN)
+		return (0);
+	VTCP_Assert(i);
+	if (i <= 0)
+		return (1);
+	while (i > 0) {
+		j = splice(pfd[0], NULL, fd1, NULL, i, SPLICE_F_MOVE);
+		VTCP_Assert(j);
+		if (j <= 0)
+			return (1);
+		i -= j;
+		*pcnt += j;
+		*pspliced += j;
+	}
+	return (0);
+}
+
+static void
+v1p_splice_close(int *pfd)
+{
+
+	if (pfd[0] >= 0)
+		closefd(&pfd[0]);
+	if (pfd[1] >= 0)
+		closefd(&pfd[1]);
+}
+#endif
+
+/*--------------------------------------------------------------------
+ * Move data from fd0 to fd1, spliced if we can.
+ */
+
+static int
+v1p_move(int fd0, int fd1, int *pfd, uint64_t *pcnt, uint64_t *pspliced)
+{
+#ifdef HAVE_SPLICE
+	int i;
+
+	if (pfd[0] >= 0) {
+		i = rdf_splice(fd0, fd1, pfd, pcnt, pspliced);
+		if (i >= 0)
+			return (i);
+		v1p_splice_close(pfd);
+		Lck_Lock(&pipestat_mtx);
+		VSC_C_main->pipe_splice_fallback++;
+		Lck_Unlock(&pipestat_mtx);
+	}
+#else
+	(void)pfd;
+	(void)pspliced;
+#endif
+	return (rdf(fd0, fd1, pcnt));
+}
+
+/*--------------------------------------------------------------------
+ * Evented pipe: once the backend request is out, the two directions of
+ * the tunnel are handed to the waiter on dup(2)'ed file descriptors,
+ * and the worker goes back to the pool.  When a direction becomes
+ * readable, a short task moves what is there and puts it back on the
+ * waiter.  The sockets are non-blocking, and what the other side does
+ * not take right away is kept until the waiter says it can take more.
+ * The original file descriptors are closed as usual by the session and
+ * the backend connection.
+ */
+
+/* The waiter cannot wait forever, rearm periodically instead */
+#define V1P_EV_MAXTMO	3600.
+
+struct v1p_ev;
+
+struct v1p_ev_dir {
+	unsigned		magic;
+#define V1P_EV_DIR_MAGIC	0x5a1e7c0d
+	struct v1p_ev		*ev;
+	struct waited		waited[1];
+	struct pool_task	task;
+	int			fd0;
+	int			fd1;		/* our own, to wait for output */
+	int			pfd[2];
+	uint64_t		cnt;
+	size_t			pend;		/* read but not written */
+	size_t			off;
+	char			buf[BUFSIZ];
+};
+
+struct v1p_ev {
+	unsigned		magic;
+#define V1P_EV_MAGIC		0x3e0b91d4
+	unsigned		refcnt;
+	struct pool		*pool;
+	vtim_real		t_last;
+	vtim_real		deadline;
+	int			fd_client;
+	int			fd_backend;
+	uint64_t		spliced;
+	struct v1p_ev_dir	dir_in;		/* client -> backend */
+	struct v1p_ev_dir	dir_out;	/* backend -> client */
+};
+
+static void
+v1p_ev_rel(struct v1p_ev *ev)
+{
+
+	CHECK_OBJ_NOTNULL(ev, V1P_EV_MAGIC);
+	Lck_Lock(&pipestat_mtx);
+	assert(ev->refcnt > 0);
+	if (--ev->refcnt > 0) {
+		Lck_Unlock(&pipestat_mtx);
+		return;
+	}
+	VSC_C_main->s_pipe_in += ev->dir_in.cnt;
+	VSC_C_main->s_pipe_out += ev->dir_out.cnt;
+	VSC_C_main->s_pipe_spliced += ev->spliced;
+	assert(VSC_C_main->n_pipe > 0);
+	VSC_C_main->n_pipe--;
+	Lck_Unlock(&pipestat_mtx);
+
+#ifdef HAVE_SPLICE
+	v1p_splice_close(ev->dir_in.pfd);
+	v1p_splice_close(ev->dir_out.pfd);
+#endif
+	closefd(&ev->dir_in.fd1);
+	closefd(&ev->dir_out.fd1);
+	closefd(&ev->fd_client);
+	closefd(&ev->fd_backend);
+	FREE_OBJ(ev);
+}
+
+static void
+v1p_ev_done(struct v1p_ev_dir *d, int kill)
+{
+
+	CHECK_OBJ_NOTNULL(d, V1P_EV_DIR_MAGIC);
+	if (kill) {
+		(void)shutdown(d->fd0, SHUT_RDWR);
+		(void)shutdown(d->fd1, SHUT_RDWR);
+	} else {
+		(void)shutdown(d->fd0, SHUT_RD);
+		(void)shutdown(d->fd1, SHUT_WR);
+	}
+	v1p_ev_rel(d->ev);
+}
+
+static waiter_handle_f v1p_ev_handle;
+
+static void
+v1p_ev_arm(struct v1p_ev_dir *d, vtim_real now)
+{
+	struct v1p_ev *ev;
+	struct waited *wp;
+	vtim_real t_last;
+	vtim_dur tmo;
+
+	CHECK_OBJ_NOTNULL(d, V1P_EV_DIR_MAGIC);
+	ev = d->ev;
+	CHECK_OBJ_NOTNULL(ev, V1P_EV_MAGIC);
+
+	Lck_Lock(&pipestat_mtx);
+	t_last = ev->t_last;
+	Lck_Unlock(&pipestat_mtx);
+
+	tmo = V1P_EV_MAXTMO;
+	if (cache_param->pipe_timeout > 0.)
+		tmo = vmin(tmo, t_last + cache_param->pipe_timeout - now);
+	if (ev->deadline > 0.)
+		tmo = vmin(tmo, ev->deadline - now);
+	if (tmo <= 0.) {
+		v1p_ev_done(d, 1);
+		return;
+	}
+
+	wp = d->waited;
+	INIT_OBJ(wp, WAITED_MAGIC);
+	if (d->pend > 0) {
+		wp->fd = d->fd1;
+		wp->output = 1;
+	} else
+		wp->fd = d->fd0;
+	wp->priv1 = d;
+	wp->func = v1p_ev_handle;
+	wp->idle = now;
+	wp->tmo = tmo;
+	if (Wait_Enter(ev->pool->waiter, wp))
+		v1p_ev_done(d, 1);
+}
+
+/*
+ * Write out what is pending, until fd1 would block.
+ */
+
+static int
+v1p_ev_flush(struct v1p_ev_dir *d, uint64_t *pspliced)
+{
+	ssize_t j;
+
+	while (d->pend > 0) {
+#ifdef HAVE_SPLICE
+		if (d->pfd[0] >= 0)
+			j = splice(d->pfd[0], NULL, d->fd1, NULL, d->pend,
+			    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		else
+#endif
+			j = write(d->fd1, d->buf + d->off, d->pend);
+		if (j < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return (0);
+		VTCP_Assert(j);
+		if (j <= 0)
+			return (1);
+		if (d->pfd[0] >= 0)
+			*pspliced += j;
+		else
+			d->off += j;
+		d->pend -= j;
+		d->cnt += j;
+	}
+	return (0);
+}
+
+/*
+ * Like v1p_move(), but never blocks: data stays in d->buf, or in the
+ * splice pipe, until fd1 can take it.
+ */
+
+static int
+v1p_ev_move(struct v1p_ev_dir *d, uint64_t *pspliced)
+{
+	ssize_t i;
+
+	if (v1p_ev_flush(d, pspliced))
+		return (1);
+	if (d->pend > 0)
+		return (0);
+#ifdef HAVE_SPLICE
+	if (d->pfd[0] >= 0) {
+		i = splice(d->fd0, NULL, d->pfd[1], NULL, V1P_SPLICE_LEN,
+		    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (i < 0 && errno == EINVAL) {
+			v1p_splice_close(d->pfd);
+			Lck_Lock(&pipestat_mtx);
+			VSC_C_main->pipe_splice_fallback++;
+			Lck_Unlock(&pipestat_mtx);
+		} else {
+			if (i < 0 && errno == EAGAIN)
+				return (0);
+			VTCP_Assert(i);
+			if (i <= 0)
+				return (1);
+			d->pend = i;
+			return (v1p_ev_flush(d, pspliced));
+		}
+	}
+#endif
+	i = read(d->fd0, d->buf, sizeof d->buf);
+	if (i < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return (0);
+	VTCP_Assert(i);
+	if (i <= 0)
+		return (1);
+	d->pend = i;
+	d->off = 0;
+	return (v1p_ev_flush(d, pspliced));
+}
+
+static void v_matchproto_(task_func_t)
+v1p_ev_task(struct worker *wrk, void *priv)
+{
+	struct v1p_ev_dir *d;
+	struct v1p_ev *ev;
+	uint64_t spliced = 0;
+	vtim_real now;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(d, priv, V1P_EV_DIR_MAGIC);
+	ev = d->ev;
+	CHECK_OBJ_NOTNULL(ev, V1P_EV_MAGIC);
+
+	if (v1p_ev_move(d, &spliced)) {
+		if (spliced > 0) {
+			Lck_Lock(&pipestat_mtx);
+			ev->spliced += spliced;
+			Lck_Unlock(&pipestat_mtx);
+		}
+		v1p_ev_done(d, 0);
+		return;
+	}
+	now = VTIM_real();
+	Lck_Lock(&pipestat_mtx);
+	ev->spliced += spliced;
+	ev->t_last = now;
+	Lck_Unlock(&pipestat_mtx);
+	v1p_ev_arm(d, now);
+}
+
+static void v_matchproto_(waiter_handle_f)
+v1p_ev_handle(struct waited *wp, enum wait_event wev, vtim_real now)
+{
+	struct v1p_ev_dir *d;
+
+	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+	CAST_OBJ_NOTNULL(d, wp->priv1, V1P_EV_DIR_MAGIC);
+	CHECK_OBJ_NOTNULL(d->ev, V1P_EV_MAGIC);
+	assert(wp == d->waited);
+
+	switch (wev) {
+	case WAITER_ACTION:
+	case WAITER_REMCLOSE:
+		d->task.func = v1p_ev_task;
+		d->task.priv = d;
+		if (Pool_Task(d->ev->pool, &d->task, TASK_QUEUE_RUSH))
+			v1p_ev_done(d, 1);
+		break;
+	case WAITER_TIMEOUT:
+		v1p_ev_arm(d, now);
+		break;
+	case WAITER_CLOSE:
+		v1p_ev_done(d, 1);
+		break;
+	default:
+		WRONG("Wrong event in v1p_ev_handle");
+	}
+}
+
+static void
+v1p_ev_dir_init(struct v1p_ev *ev, struct v1p_ev_dir *d, int fd0, int fd1,
+    int *pfd)
+{
+
+	INIT_OBJ(d, V1P_EV_DIR_MAGIC);
+	d->ev = ev;
+	d->fd0 = fd0;
+	d->fd1 = fd1;
+	d->pfd[0] = pfd[0];
+	d->pfd[1] = pfd[1];
+	pfd[0] = -1;
+	pfd[1] = -1;
+}
+
+/*--------------------------------------------------------------------
+ * Hand the tunnel to the waiter.  Returns non-zero if that could not
+ * be done, in which case the caller carries on as usual.
+ */
+
+static int
+v1p_evented(const struct req *req, int fd, int *pfd_out, int *pfd_in,
+    vtim_real deadline)
+{
+	struct v1p_ev *ev = NULL;
+	int fds[4], i;
+	vtim_real now;
+
+	/*
+	 * Client and backend, each once for reading and once for writing,
+	 * so that the waiter never sees the same descriptor twice.
+	 */
+	for (i = 0; i < 4; i++) {
+		fds[i] = dup(i & 1 ? fd : req->sp->fd);
+		if (fds[i] < 0)
+			break;
+	}
+	if (i == 4)
+		ALLOC_OBJ(ev, V1P_EV_MAGIC);
+	if (ev == NULL) {
+		while (i-- > 0)
+			closefd(&fds[i]);
+		return (-1);
+	}
+	now = VTIM_real();
+	ev->refcnt = 2;
+	ev->pool = req->sp->pool;
+	ev->t_last = now;
+	ev->deadline = deadline;
+	/* The dups share their file status flags with the originals */
+	VTCP_nonblocking(fds[0]);
+	VTCP_nonblocking(fds[1]);
+
+	ev->fd_client = fds[0];
+	ev->fd_backend = fds[1];
+	v1p_ev_dir_init(ev, &ev->dir_in, fds[0], fds[3], pfd_in);
+	v1p_ev_dir_init(ev, &ev->dir_out, fds[1], fds[2], pfd_out);
+
+	/* Our reference on n_pipe, released by v1p_ev_rel() */
+	Lck_Lock(&pipestat_mtx);
+	VSC_C_main->n_pipe++;
+	VSC_C_main->s_pipe_evented++;
+	Lck_Unlock(&pipestat_mtx);
+
+	v1p_ev_arm(&ev->dir_in, now);
+	v1p_ev_arm(&ev->dir_out, now);
+	return (0);
+}
+
 int
 V1P_Enter(void)
 {
@@ -108,6 +522,7 @@ V1P_Charge(struct req *req, const struct v1p_acct *a, struct VSC_vbe *b)
 	VSC_C_main->s_pipe_hdrbytes += a->req;
 	VSC_C_main->s_pipe_in += a->in;
 	VSC_C_main->s_pipe_out += a->out;
+	VSC_C_main->s_pipe_spliced += a->spliced;
 	b->pipe_hdrbytes += a->bereq;
 	b->pipe_out += a->in;
 	b->pipe_in += a->out;
@@ -119,6 +534,7 @@ V1P_Process(const struct req *req, int fd, struct v1p_acct *v1a,
     vtim_real deadline)
 {
 	struct pollfd fds[2];
+	int pfd_out[2] = { -1, -1 }, pfd_in[2] = { -1, -1 };
 	vtim_dur tmo, tmo_task;
 	stream_close_t sc;
 	int i, j;
@@ -137,6 +553,20 @@ V1P_Process(const struct req *req, int fd, struct v1p_acct *v1a,
 		req->htc->pipeline_e = NULL;
 		v1a->in += j;
 	}
+#ifdef HAVE_SPLICE
+	if (cache_param->pipe_splice &&
+	    (pipe2(pfd_out, O_CLOEXEC) || pipe2(pfd_in, O_CLOEXEC))) {
+		v1p_splice_close(pfd_out);
+		v1p_splice_close(pfd_in);
+		Lck_Lock(&pipestat_mtx);
+		VSC_C_main->pipe_splice_fallback++;
+		Lck_Unlock(&pipestat_mtx);
+	}
+#endif
+	if (cache_param->pipe_evented &&
+	    !v1p_evented(req, fd, pfd_out, pfd_in, deadline))
+		return (SC_TX_PIPE);
+
 	memset(fds, 0, sizeof fds);
 	fds[0].fd = fd;
 	fds[0].events = POLLIN;
@@ -159,8 +589,8 @@ V1P_Process(const struct req *req, int fd, struct v1p_acct *v1a,
 			sc = SC_RX_TIMEOUT;
 		if (i < 1)
 			break;
-		if (fds[0].revents &&
-		    rdf(fd, req->sp->fd, &v1a->out)) {
+		if (fds[0].revents && v1p_move(fd, req->sp->fd,
+		    pfd_out, &v1a->out, &v1a->spliced)) {
 			if (fds[1].fd == -1)
 				break;
 			(void)shutdown(fd, SHUT_RD);
@@ -168,8 +598,8 @@ V1P_Process(const struct req *req, int fd, struct v1p_acct *v1a,
 			fds[0].events = 0;
 			fds[0].fd = -1;
 		}
-		if (fds[1].revents &&
-		    rdf(req->sp->fd, fd, &v1a->in)) {
+		if (fds[1].revents && v1p_move(req->sp->fd, fd,
+		    pfd_in, &v1a->in, &v1a->spliced)) {
 			if (fds[0].fd == -1)
 				break;
 			(void)shutdown(req->sp->fd, SHUT_RD);
@@ -179,6 +609,10 @@ V1P_Process(const struct req *req, int fd, struct v1p_acct *v1a,
 		}
 	}
 
+#ifdef HAVE_SPLICE
+	v1p_splice_close(pfd_out);
+	v1p_splice_close(pfd_in);
+#endif
 	return (sc);
 }
 
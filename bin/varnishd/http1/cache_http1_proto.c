@@ -117,6 +117,8 @@ http1_dissect_hdrs(struct http *hp, char *p, struct http_conn *htc,
 	assert(p > htc->rxbuf_b);
 	assert(p <= htc->rxbuf_e);
 	hp->nhd = HTTP_HDR_FIRST;
+	hp->hdm = 0;
+	memset(hp->hdx, 0, sizeof hp->hdx);
 	r = NULL;		/* For FlexeLint */
 	for (; p < htc->rxbuf_e; p = r) {
 
@@ -125,10 +127,9 @@ http1_dissect_hdrs(struct http *hp, char *p, struct http_conn *htc,
 		if (vct_iscrlf(p, htc->rxbuf_e))
 			break;
 		while (r < htc->rxbuf_e) {
-			if (vct_ishdrval(*r)) {
-				r++;
-				continue;
-			}
+			r += VCT_hdrval_span(r, htc->rxbuf_e);
+			if (r == htc->rxbuf_e)
+				break;
 			i = vct_iscrlf(r, htc->rxbuf_e);
 			if (i == 0) {
 				VSLb(hp->vsl, SLT_BogoHeader,
@@ -199,6 +200,7 @@ http1_dissect_hdrs(struct http *hp, char *p, struct http_conn *htc,
 			hp->hd[hp->nhd].b = p;
 			hp->hd[hp->nhd].e = q;
 			hp->nhd++;
+			http_IndexHdr(hp, hp->nhd - 1);
 		} else {
 			VSLb(hp->vsl, SLT_BogoHeader, "Too many headers: %.*s",
 			    (int)(q - p > 20 ? 20 : q - p), p);
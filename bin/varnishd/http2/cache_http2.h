@@ -131,6 +131,39 @@ struct h2_rxbuf {
 	uint8_t				data[];
 };
 
+/*
+ * Frames are not written when they are sent, but batched up and written
+ * by whoever releases the send token first.  Frame headers, and small
+ * payloads, are copied into the batch, larger payloads must stay put
+ * until the sender has released the send token.
+ */
+
+#define H2_TX_FRAMES			32
+#define H2_TX_INLINE			16
+
+struct h2_txbatch {
+	unsigned			nframe;
+	unsigned			niov;
+	size_t				len;
+	uint8_t				hdr[H2_TX_FRAMES][9 + H2_TX_INLINE];
+	const void			*body[H2_TX_FRAMES];
+	uint32_t			bodylen[H2_TX_FRAMES];
+	struct iovec			iov[H2_TX_FRAMES * 2];
+};
+
+struct h2_tx {
+	unsigned			magic;
+#define H2_TX_MAGIC			0x4c1f2d7e
+	int				writing;
+	uint64_t			gen;	/* batch being filled */
+	uint64_t			done;	/* last batch written */
+	pthread_cond_t			cond[1];
+	struct h2_txbatch		batch[2];
+};
+
+#define H2_URGENCY_DEFAULT		3	/* RFC 9218 section 4.1 */
+#define H2_URGENCY_MAX			7
+
 struct h2_req {
 	unsigned			magic;
 #define H2_REQ_MAGIC			0x03411584
@@ -153,6 +186,11 @@ struct h2_req {
 	struct h2_rxbuf			*rxbuf;
 
 	VTAILQ_ENTRY(h2_req)		tx_list;
+	uint64_t			tx_gen;
+
+	/* RFC 9218 priority parameters */
+	uint8_t				urgency;
+	uint8_t				incremental;
 	h2_error			error;
 };
 
@@ -186,6 +224,12 @@ struct h2_sess {
 	struct h2h_decode		*decode;
 	struct vht_table		dectbl[1];
 
+	/* HPACK encoder state, only touched by the send token holder */
+	struct vht_table		enctbl[1];
+	unsigned			enc_size;
+	unsigned			enc_max;	/* as known to the peer */
+	unsigned			enc_reset;
+
 	unsigned			rxf_len;
 	unsigned			rxf_type;
 	unsigned			rxf_flags;
@@ -199,9 +243,15 @@ struct h2_sess {
 	uint32_t			goaway_last_stream;
 
 	VTAILQ_HEAD(,h2_req)		txqueue;
+	struct h2_tx			*tx;
+	uint64_t			sched_waits;
+	uint64_t			sched_reordered;
 
 	h2_error			error;
 
+	/* Kept while idle in the waiter, without srq */
+	struct acct_req			acct;
+
 	// rst rate limit parameters, copied from h2_* parameters
 	vtim_dur			rapid_reset;
 	int64_t				rapid_reset_limit;
@@ -224,6 +274,8 @@ vtr_sess_panic_f h2_sess_panic;
 vtr_deliver_f h2_deliver;
 vtr_minimal_response_f h2_minimal_response;
 #endif /* TRANSPORT_MAGIC */
+void h2_enc_len(struct vsb *, unsigned bits, unsigned val, uint8_t b0);
+void h2_enc_str(struct vsb *, const char *s, size_t l, int lower);
 
 /* http2/cache_http2_hpack.c */
 struct h2h_decode {
@@ -248,7 +300,21 @@ h2_error h2h_decode_hdr_fini(const struct h2_sess *h2);
 h2_error h2h_decode_bytes(struct h2_sess *h2, const uint8_t *ptr,
     size_t len);
 
+/* cache_http2_fetch.c */
+struct h2f_pool;
+struct h2f_stream;
+struct h2f_pool *H2F_New(struct conn_pool *);
+void H2F_Destroy(struct h2f_pool **);
+struct pfd *H2F_Get(struct h2f_pool *, vtim_dur tmo, struct worker *,
+    struct h2f_stream **, unsigned *reused, int *err);
+struct pfd *H2F_Pfd(const struct http_conn *);
+int H2F_SendReq(struct worker *, struct busyobj *);
+int H2F_FetchRespHdr(struct busyobj *);
+int H2F_Finish(struct busyobj *);
+
 /* cache_http2_send.c */
+void H2_Send_Priority(struct h2_req *, const struct http *,
+    const struct http *);
 void H2_Send_Get(struct worker *, struct h2_sess *, struct h2_req *);
 void H2_Send_Rel(struct h2_sess *, const struct h2_req *);
 
@@ -268,6 +334,7 @@ h2_error h2_stream_tmo(struct h2_sess *, const struct h2_req *, vtim_real);
 void h2_del_req(struct worker *, struct h2_req *);
 void h2_kill_req(struct worker *, struct h2_sess *, struct h2_req *, h2_error);
 int h2_rxframe(struct worker *, struct h2_sess *);
+void h2_tx_goaway(struct worker *, struct h2_sess *, h2_error);
 h2_error h2_set_setting(struct h2_sess *, const uint8_t *);
 void h2_req_body(struct req*);
 task_func_t h2_do_req;
@@ -42,6 +42,7 @@
 #include "http2/cache_http2.h"
 
 #include "vct.h"
+#include "vtcp.h"
 
 /**********************************************************************/
 
@@ -131,6 +132,16 @@ h2_bytes(struct vdp_ctx *vdc, enum vdp_action act, void **priv,
 		return (-1);
 	if (len == 0)
 		return (0);
+	/*
+	 * Wait for the socket to drain below TCP_NOTSENT_LOWAT before
+	 * queueing for the send lock, so that a stream does not hold
+	 * the session's transmit queue while the kernel has no room.
+	 */
+	if (cache_param->tcp_notsent_lowat > 0) {
+		vdc->wrk->stats->sess_notsent_wait++;
+		(void)VTCP_wait_writable(r2->h2sess->sess->fd,
+		    SESS_TMO(r2->h2sess->sess, idle_send_timeout));
+	}
 	H2_Send_Get(vdc->wrk, r2->h2sess, r2);
 	vdc->bytes_done = 0;
 	H2_Send(vdc->wrk, r2, H2_F_DATA, H2FF_NONE, len, ptr, &vdc->bytes_done);
@@ -205,23 +216,204 @@ h2_minimal_response(struct req *req, uint16_t status)
 	return (0);
 }
 
-static void
+void
 h2_enc_len(struct vsb *vsb, unsigned bits, unsigned val, uint8_t b0)
 {
 	assert(bits < 8);
 	unsigned mask = (1U << bits) - 1U;
 
-	if (val >= mask) {
-		VSB_putc(vsb, b0 | (uint8_t)mask);
-		val -= mask;
-		while (val >= 128) {
-			VSB_putc(vsb, 0x80 | ((uint8_t)val & 0x7f));
-			val >>= 7;
-		}
+	if (val < mask) {
+		VSB_putc(vsb, b0 | (uint8_t)val);
+		return;
+	}
+	VSB_putc(vsb, b0 | (uint8_t)mask);
+	val -= mask;
+	while (val >= 128) {
+		VSB_putc(vsb, 0x80 | ((uint8_t)val & 0x7f));
+		val >>= 7;
 	}
 	VSB_putc(vsb, (uint8_t)val);
 }
 
+static unsigned
+h2_enc_len_size(unsigned bits, unsigned val)
+{
+	unsigned mask = (1U << bits) - 1U;
+	unsigned l = 1;
+
+	if (val < mask)
+		return (l);
+	for (val -= mask; val >= 128; val >>= 7)
+		l++;
+	return (l + 1);
+}
+
+/**********************************************************************
+ * HPACK string literals, Huffman encoded when that makes them shorter
+ * and the h2_huffman parameter allows it (RFC 7541 section 5.2).
+ */
+
+static const struct {
+	uint32_t	code;
+	uint8_t		len;
+} h2_huf[256] = {
+#define HPH(c, cd, l)	[c] = { cd, l },
+#include "tbl/vhp_huffman.h"
+};
+
+void
+h2_enc_str(struct vsb *vsb, const char *s, size_t l, int lower)
+{
+	uint64_t pack = 0;
+	size_t u, bits = 0;
+	unsigned pl = 0;
+	uint8_t c;
+
+	if (cache_param->h2_huffman) {
+		for (u = 0; u < l; u++)
+			bits += h2_huf[lower ?
+			    tolower((uint8_t)s[u]) : (uint8_t)s[u]].len;
+	}
+	if (!cache_param->h2_huffman || (bits + 7) / 8 >= l) {
+		h2_enc_len(vsb, 7, l, 0x00);
+		if (!lower) {
+			VSB_bcat(vsb, s, l);
+			return;
+		}
+		for (u = 0; u < l; u++)
+			VSB_putc(vsb, tolower((uint8_t)s[u]));
+		return;
+	}
+
+	h2_enc_len(vsb, 7, (bits + 7) / 8, 0x80);
+	for (u = 0; u < l; u++) {
+		c = lower ? tolower((uint8_t)s[u]) : (uint8_t)s[u];
+		AN(h2_huf[c].len);
+		pl += h2_huf[c].len;
+		assert(pl <= 64);
+		pack |= (uint64_t)h2_huf[c].code << (64 - pl);
+		while (pl >= 8) {
+			VSB_putc(vsb, (uint8_t)(pack >> 56));
+			pack <<= 8;
+			pl -= 8;
+		}
+	}
+	if (pl > 0) {
+		/* Pad with the most significant bits of EOS */
+		pack |= UINT64_MAX >> pl;
+		VSB_putc(vsb, (uint8_t)(pack >> 56));
+	}
+}
+
+/**********************************************************************
+ * HPACK dynamic table for response headers (RFC 7541 section 2.3.2)
+ *
+ * The encoder table must see the header blocks in the order they go
+ * out on the wire, so it is only used by the holder of the send token.
+ * When a header block built against it does not make it to the client,
+ * the table is flushed with a pair of size updates in the next block.
+ */
+
+static const char * const h2_enc_noindex[] = {
+	"age", "content-length", "content-range", "date", "etag",
+	"expires", "last-modified", "set-cookie", "x-varnish", NULL
+};
+
+static void
+h2_enc_reset(struct h2_sess *h2)
+{
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	if (h2->enc_size == 0)
+		return;
+	AZ(VHT_SetMaxTableSize(h2->enctbl, 0));
+	h2->enc_reset = 1;
+}
+
+static void
+h2_enc_tblsize(struct h2_sess *h2, struct vsb *vsb)
+{
+	unsigned max;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	if (h2->enc_size == 0)
+		return;
+	max = h2->remote_settings.header_table_size;
+	if (max > h2->enc_size)
+		max = h2->enc_size;
+	if (h2->enc_reset) {
+		AZ(h2->enctbl->maxsize);
+		h2_enc_len(vsb, 5, 0, 0x20);
+		h2->enc_max = 0;
+		h2->enc_reset = 0;
+	}
+	if (max == h2->enc_max)
+		return;
+	h2_enc_len(vsb, 5, max, 0x20);
+	AZ(VHT_SetMaxTableSize(h2->enctbl, max));
+	h2->enc_max = max;
+}
+
+/* Find the name, and possibly the full field in the dynamic table */
+static unsigned
+h2_enc_lookup(const struct h2_sess *h2, const char *n, size_t nl,
+    const char *v, size_t vl, unsigned *nidx)
+{
+	const char *p;
+	size_t l;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	AN(nidx);
+	for (u = 0; u < h2->enctbl->n; u++) {
+		p = VHT_LookupName(h2->enctbl, VHT_STATIC_MAX + 1 + u, &l);
+		AN(p);
+		if (l != nl || strncasecmp(p, n, nl))
+			continue;
+		if (*nidx == 0)
+			*nidx = VHT_STATIC_MAX + 1 + u;
+		p = VHT_LookupValue(h2->enctbl, VHT_STATIC_MAX + 1 + u, &l);
+		if (l == vl && (vl == 0 || !memcmp(p, v, vl)))
+			return (VHT_STATIC_MAX + 1 + u);
+	}
+	return (0);
+}
+
+static int
+h2_enc_indexable(const struct h2_sess *h2, const char *n, size_t nl,
+    size_t vl)
+{
+	const char * const *p;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	if (VHT_ENTRY_SIZE + nl + vl > h2->enctbl->maxsize)
+		return (0);
+	for (p = h2_enc_noindex; *p != NULL; p++)
+		if (strlen(*p) == nl && !strncasecmp(*p, n, nl))
+			return (0);
+	return (1);
+}
+
+static void
+h2_enc_insert(struct h2_sess *h2, const char *n, size_t nl,
+    const char *v, size_t vl)
+{
+	char buf[64];
+	size_t l, u;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	VHT_NewEntry(h2->enctbl);
+	while (nl > 0) {
+		l = vmin(nl, sizeof buf);
+		for (u = 0; u < l; u++)
+			buf[u] = tolower((uint8_t)n[u]);
+		VHT_AppendName(h2->enctbl, buf, l);
+		n += l;
+		nl -= l;
+	}
+	VHT_AppendValue(h2->enctbl, v, vl);
+}
+
 /*
  * Hand-crafted-H2-HEADERS-R-Us:
  *
@@ -241,15 +433,19 @@ static const uint8_t h2_500_resp[] = {
 };
 
 static void
-h2_build_headers(struct vsb *resp, struct req *req)
+h2_build_headers(struct vsb *resp, struct req *req, struct h2_sess *h2)
 {
-	unsigned u, l;
+	unsigned u, l, idx, nidx;
 	int i;
 	struct http *hp;
 	const char *r;
-	const struct hpack_static *hps;
+	const struct hpack_static *hps, *hps2;
 	uint8_t buf[6];
-	ssize_t sz, sz1;
+	ssize_t sz, vl, len;
+	uint64_t plain = 0, sent = 0;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	h2_enc_tblsize(h2, resp);
 
 	assert(req->resp->status % 1000 >= 100);
 	l = h2_status(buf, req->resp->status % 1000);
@@ -276,26 +472,66 @@ h2_build_headers(struct vsb *resp, struct req *req)
 				hps = NULL;
 			break;
 		}
-		if (hps != NULL) {
-			VSLb(req->vsl, SLT_Debug,
-			    "HP {%d, \"%s\", \"%s\"} <%s>",
-			    hps->idx, hps->name, hps->val, hp->hd[u].b);
-			h2_enc_len(resp, 4, hps->idx, 0x10);
-		} else {
-			VSB_putc(resp, 0x10);
-			sz--;
-			h2_enc_len(resp, 7, sz, 0);
-			for (sz1 = 0; sz1 < sz; sz1++)
-				VSB_putc(resp, tolower(hp->hd[u].b[sz1]));
-
-		}
+		sz--;
 
 		while (vct_islws(*++r))
 			continue;
-		sz = hp->hd[u].e - r;
-		h2_enc_len(resp, 7, sz, 0);
-		VSB_bcat(resp, r, sz);
+		vl = hp->hd[u].e - r;
+
+		/* What the static table alone would have cost */
+		if (hps != NULL)
+			plain += h2_enc_len_size(4, hps->idx);
+		else
+			plain += 1 + h2_enc_len_size(7, sz) + sz;
+		plain += h2_enc_len_size(7, vl) + vl;
+		len = VSB_len(resp);
+
+		idx = 0;
+		nidx = 0;
+		if (h2->enc_size > 0) {
+			if (hps != NULL) {
+				nidx = hps->idx;
+				for (hps2 = hps; hps2->idx > 0 &&
+				    !strcmp(hps2->name, hps->name); hps2++) {
+					if (strlen(hps2->val) == (size_t)vl &&
+					    !memcmp(hps2->val, r, vl)) {
+						idx = hps2->idx;
+						break;
+					}
+				}
+			}
+			if (idx == 0)
+				idx = h2_enc_lookup(h2, hp->hd[u].b, sz,
+				    r, vl, &nidx);
+		}
+
+		if (idx > 0) {
+			h2_enc_len(resp, 7, idx, 0x80);
+			req->wrk->stats->h2_hpack_indexed++;
+		} else if (h2->enc_size > 0 &&
+		    h2_enc_indexable(h2, hp->hd[u].b, sz, vl)) {
+			h2_enc_len(resp, 6, nidx, 0x40);
+			if (nidx == 0)
+				h2_enc_str(resp, hp->hd[u].b, sz, 1);
+			h2_enc_str(resp, r, vl, 0);
+			h2_enc_insert(h2, hp->hd[u].b, sz, r, vl);
+		} else {
+			if (hps != NULL) {
+				VSLb(req->vsl, SLT_Debug,
+				    "HP {%d, \"%s\", \"%s\"} <%s>",
+				    hps->idx, hps->name, hps->val,
+				    hp->hd[u].b);
+				h2_enc_len(resp, 4, hps->idx, 0x10);
+			} else {
+				VSB_putc(resp, 0x10);
+				h2_enc_str(resp, hp->hd[u].b, sz, 1);
+			}
+			h2_enc_str(resp, r, vl, 0);
+		}
+		sent += VSB_len(resp) - len;
 	}
+	if (!VSB_error(resp) && plain > sent)
+		req->wrk->stats->h2_hpack_saved += plain - sent;
 }
 
 void v_matchproto_(vtr_deliver_f)
@@ -305,14 +541,18 @@ h2_deliver(struct req *req, struct boc *boc, int sendbody)
 	const char *r;
 	struct sess *sp;
 	struct h2_req *r2;
+	struct h2_sess *h2;
 	struct vsb resp[1];
 	struct vrt_ctx ctx[1];
 	uintptr_t ss;
+	uint64_t hdrbytes;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	CHECK_OBJ_ORNULL(boc, BOC_MAGIC);
 	CHECK_OBJ_NOTNULL(req->objcore, OBJCORE_MAGIC);
 	CAST_OBJ_NOTNULL(r2, req->transport_priv, H2_REQ_MAGIC);
+	h2 = r2->h2sess;
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
 	sp = req->sp;
 	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
 
@@ -320,13 +560,22 @@ h2_deliver(struct req *req, struct boc *boc, int sendbody)
 
 	(void)http_DoConnection(req->resp, SC_RESP_CLOSE);
 
+	H2_Send_Priority(r2, req->http, req->resp);
+	if (DO_DEBUG(DBG_PROTOCOL))
+		VSLb(req->vsl, SLT_Debug, "H2: stream %u priority u=%u i=%u",
+		    r2->stream, r2->urgency, r2->incremental);
+
 	ss = WS_Snapshot(req->ws);
 
+	/* The HPACK encoder table requires the send token */
+	H2_Send_Get(req->wrk, h2, r2);
+
 	WS_VSB_new(resp, req->ws);
-	h2_build_headers(resp, req);
+	h2_build_headers(resp, req, h2);
 	r = WS_VSB_finish(resp, req->ws, &sz);
 
 	if (r == NULL) {
+		h2_enc_reset(h2);
 		VSLb(req->vsl, SLT_Error, "workspace_client overflow");
 		VSLb(req->vsl, SLT_RespStatus, "500");
 		VSLb(req->vsl, SLT_RespReason, "Internal Server Error");
@@ -341,11 +590,13 @@ h2_deliver(struct req *req, struct boc *boc, int sendbody)
 
 	r2->t_send = req->t_prev;
 
-	H2_Send_Get(req->wrk, r2->h2sess, r2);
+	hdrbytes = req->acct.resp_hdrbytes;
 	H2_Send(req->wrk, r2, H2_F_HEADERS,
 	    (sendbody ? 0 : H2FF_HEADERS_END_STREAM) | H2FF_HEADERS_END_HEADERS,
 	    sz, r, &req->acct.resp_hdrbytes);
-	H2_Send_Rel(r2->h2sess, r2);
+	if (req->acct.resp_hdrbytes - hdrbytes != sz)
+		h2_enc_reset(h2);
+	H2_Send_Rel(h2, r2);
 
 	WS_Reset(req->ws, ss);
 
@@ -0,0 +1,1507 @@
+/*-
+ * Copyright (c) 2026 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * HTTP/2 backend fetches
+ *
+ * Backends with .http2 = true get their fetches multiplexed as streams
+ * over a few prior-knowledge cleartext HTTP/2 connections, instead of
+ * one HTTP/1 connection per fetch.  A connection takes new streams
+ * until the lower of the backend_h2_max_streams parameter and the
+ * peer's SETTINGS_MAX_CONCURRENT_STREAMS is reached, then another
+ * connection is opened.  Idle connections are parked in the waiter,
+ * like HTTP/1 ones, which closes them at backend_idle_timeout or when
+ * the backend closes or sends anything.  A fetch which picks a parked
+ * connection sends its request, then waits for the waiter to hand the
+ * connection back before reading it.
+ *
+ * There is no thread per connection.  Whichever fetch waits for its
+ * stream becomes the reader of the connection, and decodes and queues
+ * the frames for all the streams, until its own stream has what it was
+ * waiting for, then the next waiter takes over.  The frames are handled
+ * under the pool lock, only the poll(2) and read(2) are done without it.
+ *
+ * Outgoing frames are likewise queued on the connection under the lock,
+ * and whoever finds nobody else writing becomes the writer and drains
+ * the queue without holding the lock.
+ *
+ * Only bodyless requests are sent this way, and pipe never is, the
+ * backend code falls back to HTTP/1 for those.
+ */
+
+#include "config.h"
+
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "cache/cache_varnishd.h"
+#include "cache/cache_conn_pool.h"
+#include "cache/cache_filter.h"
+#include "cache/cache_pool.h"
+
+#include "http2/cache_http2.h"
+#include "waiter/waiter.h"
+
+#include "vct.h"
+#include "vend.h"
+#include "vtim.h"
+
+#define H2F_FRAME_MAX		16384		/* SETTINGS_MAX_FRAME_SIZE */
+#define H2F_WINDOW		(256 * 1024)	/* per stream */
+#define H2F_CONN_WINDOW		(16 * 1024 * 1024)
+#define H2F_STREAM_MAX		0x7ffffff0U
+
+static const char H2F_preface[24] = {
+	'P', 'R', 'I', ' ', '*', ' ', 'H', 'T', 'T', 'P', '/', '2', '.', '0',
+	'\r', '\n', '\r', '\n', 'S', 'M', '\r', '\n', '\r', '\n'
+};
+
+struct h2f_chunk {
+	VTAILQ_ENTRY(h2f_chunk)	list;
+	size_t			len;
+	size_t			off;
+	uint8_t			data[];
+};
+
+struct h2f_stream {
+	unsigned		magic;
+#define H2F_STREAM_MAGIC	0x5e2f3a91
+	uint32_t		id;
+	struct h2f_conn		*conn;
+	VTAILQ_ENTRY(h2f_stream) list;
+
+	unsigned		hdrs:1;
+	unsigned		eos:1;
+	unsigned		reused:1;
+	unsigned		retry:1;
+	const char		*why;		/* failed */
+	uint32_t		code;
+
+	char			*hbuf;
+	size_t			hsize;
+	size_t			hlen;
+	uint64_t		hdrbytes;
+
+	VTAILQ_HEAD(,h2f_chunk)	chunks;
+	int64_t			rwin;
+	size_t			unacked;
+	vtim_dur		between_bytes_timeout;
+};
+
+struct h2f_conn {
+	unsigned		magic;
+#define H2F_CONN_MAGIC		0x1d2c8e07
+	struct h2f_pool		*pool;
+	VTAILQ_ENTRY(h2f_conn)	list;
+	struct pfd		*pfd;
+	int			fd;
+	int			err;
+
+	unsigned		connecting:1;
+	unsigned		reading:1;
+	unsigned		writing:1;
+	unsigned		dead:1;
+	unsigned		goaway:1;
+	unsigned		parked:1;	/* in the waiter */
+	const char		*why;
+
+	unsigned		n_stream;
+	uint64_t		n_served;
+	uint32_t		next_id;
+	uint32_t		max_streams;
+	uint32_t		frame_size;
+	size_t			rx_unacked;
+	vtim_real		t_idle;
+	pthread_cond_t		cond;
+	struct waited		waited[1];
+	VTAILQ_HEAD(,h2f_stream) streams;
+
+	/* HPACK decoding of the header block in progress */
+	struct vht_table	dectbl[1];
+	struct vhd_decode	vhd[1];
+	uint32_t		cont_id;
+	uint8_t			cont_flags;
+	struct h2f_stream	*dec_hs;	/* NULL: discard */
+	char			*dec_out;
+	size_t			dec_l;
+	size_t			dec_u;
+	size_t			dec_e;		/* start of entry */
+	const char		*dec_bad;
+	char			scratch[256];
+
+	uint8_t			*txbuf;
+	size_t			txlen;
+	size_t			txspace;
+
+	size_t			rxlen;
+	uint8_t			rxbuf[2 * (9 + H2F_FRAME_MAX)];
+};
+
+struct h2f_pool {
+	unsigned		magic;
+#define H2F_POOL_MAGIC		0x62b0f1c4
+	struct lock		mtx;
+	struct conn_pool	*conn_pool;
+	VTAILQ_HEAD(,h2f_conn)	conns;
+};
+
+VTAILQ_HEAD(h2f_conn_s, h2f_conn);
+
+/**********************************************************************
+ * Sending.  Frames are queued under the pool lock, so that stream ids
+ * go out in order and frames do not interleave, and h2f_flush() writes
+ * them out without it.
+ */
+
+static int
+h2f_write(const struct h2f_conn *hc, struct iovec *iov, int niov)
+{
+	ssize_t l;
+
+	while (niov > 0) {
+		l = writev(hc->fd, iov, niov);
+		if (l < 0 && errno == EINTR)
+			continue;
+		if (l <= 0)
+			return (-1);
+		while (niov > 0 && (size_t)l >= iov->iov_len) {
+			l -= iov->iov_len;
+			iov++;
+			niov--;
+		}
+		if (niov > 0) {
+			iov->iov_base = (char *)iov->iov_base + l;
+			iov->iov_len -= l;
+		}
+	}
+	return (0);
+}
+
+static void
+h2f_queue(struct h2f_conn *hc, const void *ptr, size_t len)
+{
+	size_t sz;
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	Lck_AssertHeld(&hc->pool->mtx);
+	if (hc->txspace - hc->txlen < len) {
+		sz = vmax_t(size_t, 2 * hc->txspace, 4096);
+		sz = vmax_t(size_t, sz, hc->txlen + len);
+		hc->txbuf = realloc(hc->txbuf, sz);
+		AN(hc->txbuf);
+		hc->txspace = sz;
+	}
+	memcpy(hc->txbuf + hc->txlen, ptr, len);
+	hc->txlen += len;
+}
+
+static void
+h2f_send(struct h2f_conn *hc, h2_frame ftyp, uint8_t flags,
+    uint32_t stream, const void *ptr, uint32_t len)
+{
+	uint8_t hdr[9];
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	assert(len < (1U << 24));
+	if (hc->fd < 0)
+		return;
+	vbe32enc(hdr, len << 8);
+	hdr[3] = ftyp->type;
+	hdr[4] = flags;
+	vbe32enc(hdr + 5, stream);
+	h2f_queue(hc, hdr, sizeof hdr);
+	if (len > 0)
+		h2f_queue(hc, ptr, len);
+}
+
+static void
+h2f_send_u32(struct h2f_conn *hc, h2_frame ftyp, uint32_t stream,
+    uint32_t val)
+{
+	uint8_t buf[4];
+
+	vbe32enc(buf, val);
+	h2f_send(hc, ftyp, 0, stream, buf, sizeof buf);
+}
+
+static void h2f_fail(struct h2f_conn *, h2_error, const char *);
+
+/*
+ * Write out the queue, unless somebody else is already at it.  The
+ * lock is dropped while writing, a failure fails the connection.
+ */
+
+static void
+h2f_flush(struct h2f_conn *hc)
+{
+	struct iovec iov[1];
+	uint8_t *buf;
+	size_t space;
+	int i, e;
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	Lck_AssertHeld(&hc->pool->mtx);
+	if (hc->writing)
+		return;
+	hc->writing = 1;
+	while (hc->txlen > 0) {
+		buf = hc->txbuf;
+		space = hc->txspace;
+		iov->iov_base = buf;
+		iov->iov_len = hc->txlen;
+		hc->txbuf = NULL;
+		hc->txlen = 0;
+		hc->txspace = 0;
+		Lck_Unlock(&hc->pool->mtx);
+		i = h2f_write(hc, iov, 1);
+		e = errno;
+		Lck_Lock(&hc->pool->mtx);
+		if (hc->txbuf == NULL) {
+			hc->txbuf = buf;
+			hc->txspace = space;
+		} else {
+			free(buf);
+		}
+		if (i) {
+			if (hc->err == 0)
+				hc->err = e;
+			hc->txlen = 0;
+			h2f_fail(hc, NULL, "write error");
+		}
+	}
+	hc->writing = 0;
+}
+
+/**********************************************************************
+ * Failures
+ */
+
+static void
+h2f_stream_fail(struct h2f_stream *hs, uint32_t code, const char *why,
+    int retry)
+{
+
+	CHECK_OBJ_NOTNULL(hs, H2F_STREAM_MAGIC);
+	AN(why);
+	if (hs->eos || hs->why != NULL)
+		return;
+	hs->why = why;
+	hs->code = code;
+	hs->retry = retry;
+}
+
+static void
+h2f_stream_rst(struct h2f_conn *hc, struct h2f_stream *hs, h2_error h2e,
+    const char *why)
+{
+
+	h2f_stream_fail(hs, h2e->val, why, 0);
+	h2f_send_u32(hc, H2_F_RST_STREAM, hs->id, h2e->val);
+}
+
+static void
+h2f_fail(struct h2f_conn *hc, h2_error h2e, const char *why)
+{
+	struct h2f_stream *hs;
+	uint8_t buf[8];
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	Lck_AssertHeld(&hc->pool->mtx);
+	if (hc->dead)
+		return;
+	if (h2e != NULL && h2e->val != H2CE_NO_ERROR->val) {
+		vbe32enc(buf, 0);
+		vbe32enc(buf + 4, h2e->val);
+		h2f_send(hc, H2_F_GOAWAY, 0, 0, buf, sizeof buf);
+	}
+	hc->dead = 1;
+	hc->why = why;
+	VTAILQ_FOREACH(hs, &hc->streams, list)
+		h2f_stream_fail(hs, h2e == NULL ? 0 : h2e->val, why,
+		    hs->reused && !hs->hdrs && hs->hdrbytes == 0);
+	PTOK(pthread_cond_broadcast(&hc->cond));
+}
+
+/**********************************************************************
+ * HPACK decoding, into the stream's header buffer as a sequence of
+ * "name: value" strings, or into the scratch buffer for header blocks
+ * nobody wants, which still have to go through the decoder table.
+ */
+
+static struct h2f_stream *
+h2f_lookup(const struct h2f_conn *hc, uint32_t id)
+{
+	struct h2f_stream *hs;
+
+	VTAILQ_FOREACH(hs, &hc->streams, list)
+		if (hs->id == id)
+			return (hs);
+	return (NULL);
+}
+
+static void
+h2f_dec_target(struct h2f_conn *hc, struct h2f_stream *hs)
+{
+
+	hc->dec_hs = hs;
+	if (hs != NULL) {
+		hc->dec_out = hs->hbuf;
+		hc->dec_l = hs->hsize;
+	} else {
+		hc->dec_out = hc->scratch;
+		hc->dec_l = sizeof hc->scratch;
+	}
+	hc->dec_u = 0;
+	hc->dec_e = 0;
+}
+
+static void
+h2f_dec_overflow(struct h2f_conn *hc)
+{
+
+	if (hc->dec_hs != NULL)
+		hc->dec_bad = "response headers too large";
+	hc->dec_u = 0;
+	hc->dec_e = 0;
+}
+
+static enum vhd_ret_e
+h2f_decode(struct h2f_conn *hc, const uint8_t *in, size_t in_l)
+{
+	enum vhd_ret_e r;
+	size_t in_u = 0;
+	const char *p;
+
+	while (1) {
+		r = VHD_Decode(hc->vhd, hc->dectbl, in, in_l, &in_u,
+		    hc->dec_out, hc->dec_l, &hc->dec_u);
+		if (r < 0)
+			return (r);
+		switch (r) {
+		case VHD_OK:
+		case VHD_MORE:
+			assert(in_u == in_l);
+			return (r);
+		case VHD_NAME:
+		case VHD_NAME_SEC:
+			if (hc->dec_l - hc->dec_u < 2) {
+				h2f_dec_overflow(hc);
+				break;
+			}
+			hc->dec_out[hc->dec_u++] = ':';
+			hc->dec_out[hc->dec_u++] = ' ';
+			break;
+		case VHD_VALUE:
+		case VHD_VALUE_SEC:
+			if (hc->dec_l - hc->dec_u < 1) {
+				h2f_dec_overflow(hc);
+				break;
+			}
+			for (p = hc->dec_out + hc->dec_e;
+			    p < hc->dec_out + hc->dec_u; p++)
+				if (*p == '\0' || *p == '\r' || *p == '\n')
+					hc->dec_bad = "malformed response header";
+			hc->dec_out[hc->dec_u++] = '\0';
+			if (hc->dec_hs == NULL)
+				hc->dec_u = 0;
+			hc->dec_e = hc->dec_u;
+			break;
+		case VHD_BUF:
+			h2f_dec_overflow(hc);
+			break;
+		default:
+			WRONG("Unhandled return value");
+		}
+	}
+}
+
+static int
+h2f_status(const char *b, size_t l)
+{
+
+	if (l < 13 || strncmp(b, ":status: ", 9) || b[12] != '\0')
+		return (-1);
+	if (b[9] < '1' || b[9] > '9' ||
+	    b[10] < '0' || b[10] > '9' ||
+	    b[11] < '0' || b[11] > '9')
+		return (-1);
+	return (100 * (b[9] - '0') + 10 * (b[10] - '0') + b[11] - '0');
+}
+
+static void
+h2f_block(struct h2f_conn *hc, const uint8_t *p, uint32_t len,
+    uint8_t flags)
+{
+	struct h2f_stream *hs;
+	enum vhd_ret_e r;
+	int status;
+
+	r = h2f_decode(hc, p, len);
+	if (r < 0 || (!(flags & H2FF_HEADERS_END_HEADERS) && r != VHD_OK &&
+	    r != VHD_MORE)) {
+		h2f_fail(hc, H2CE_COMPRESSION_ERROR, VHD_Error(r));
+		return;
+	}
+	hs = hc->dec_hs;
+	if (hs != NULL)
+		hs->hdrbytes += 9 + len;
+	if (!(flags & H2FF_HEADERS_END_HEADERS))
+		return;
+	if (r != VHD_OK) {
+		h2f_fail(hc, H2CE_COMPRESSION_ERROR, "incomplete header block");
+		return;
+	}
+
+	if (hs == NULL) {
+		/* Trailers are decoded but ignored */
+		hs = h2f_lookup(hc, hc->cont_id);
+		if (hs != NULL && hs->hdrs &&
+		    (hc->cont_flags & H2FF_HEADERS_END_STREAM))
+			hs->eos = 1;
+	} else if (hc->dec_bad != NULL) {
+		h2f_stream_rst(hc, hs, H2SE_PROTOCOL_ERROR, hc->dec_bad);
+	} else if ((status = h2f_status(hs->hbuf, hc->dec_u)) < 0) {
+		h2f_stream_rst(hc, hs, H2SE_PROTOCOL_ERROR, "bad :status");
+	} else if (status < 200) {
+		/* Interim response, wait for the real one */
+		if (hc->cont_flags & H2FF_HEADERS_END_STREAM)
+			h2f_stream_rst(hc, hs, H2SE_PROTOCOL_ERROR,
+			    "stream ended after interim response");
+	} else {
+		hs->hlen = hc->dec_u;
+		hs->hdrs = 1;
+		if (hc->cont_flags & H2FF_HEADERS_END_STREAM)
+			hs->eos = 1;
+	}
+	hc->cont_id = 0;
+	h2f_dec_target(hc, NULL);
+}
+
+/**********************************************************************
+ * Frame reception
+ */
+
+static int
+h2f_unpad(uint8_t **p, uint32_t *len)
+{
+	uint8_t pad;
+
+	if (*len < 1)
+		return (-1);
+	pad = **p;
+	if (pad >= *len)
+		return (-1);
+	(*p)++;
+	*len -= 1 + pad;
+	return (0);
+}
+
+static void
+h2f_rx_data(struct h2f_conn *hc, uint8_t flags, uint32_t id, uint8_t *p,
+    uint32_t len)
+{
+	struct h2f_stream *hs;
+	struct h2f_chunk *hk;
+	uint32_t flen = len;
+
+	hc->rx_unacked += len;
+	if (hc->rx_unacked >= H2F_CONN_WINDOW / 2) {
+		h2f_send_u32(hc, H2_F_WINDOW_UPDATE, 0, hc->rx_unacked);
+		hc->rx_unacked = 0;
+	}
+	if (id == 0 ||
+	    ((flags & H2FF_DATA_PADDED) && h2f_unpad(&p, &len))) {
+		h2f_fail(hc, H2CE_PROTOCOL_ERROR, "bad DATA frame");
+		return;
+	}
+	hs = h2f_lookup(hc, id);
+	if (hs == NULL || hs->eos || hs->why != NULL)
+		return;
+	if (!hs->hdrs) {
+		h2f_stream_rst(hc, hs, H2SE_PROTOCOL_ERROR,
+		    "DATA before HEADERS");
+		return;
+	}
+	hs->rwin -= flen;
+	if (hs->rwin < 0) {
+		h2f_stream_rst(hc, hs, H2SE_FLOW_CONTROL_ERROR,
+		    "stream window exceeded");
+		return;
+	}
+	hs->unacked += flen - len;
+	if (len > 0) {
+		hk = malloc(sizeof *hk + len);
+		AN(hk);
+		hk->len = len;
+		hk->off = 0;
+		memcpy(hk->data, p, len);
+		VTAILQ_INSERT_TAIL(&hs->chunks, hk, list);
+	}
+	if (flags & H2FF_DATA_END_STREAM)
+		hs->eos = 1;
+}
+
+static void
+h2f_rx_headers(struct h2f_conn *hc, uint8_t flags, uint32_t id, uint8_t *p,
+    uint32_t len)
+{
+	struct h2f_stream *hs;
+
+	if (id == 0 || (id & 1) == 0 ||
+	    ((flags & H2FF_HEADERS_PADDED) && h2f_unpad(&p, &len)) ||
+	    ((flags & H2FF_HEADERS_PRIORITY) && len < 5)) {
+		h2f_fail(hc, H2CE_PROTOCOL_ERROR, "bad HEADERS frame");
+		return;
+	}
+	if (flags & H2FF_HEADERS_PRIORITY) {
+		p += 5;
+		len -= 5;
+	}
+	hs = h2f_lookup(hc, id);
+	if (hs != NULL && (hs->hdrs || hs->eos || hs->why != NULL))
+		hs = NULL;
+	VHD_Init(hc->vhd);
+	h2f_dec_target(hc, hs);
+	hc->dec_bad = NULL;
+	hc->cont_id = id;
+	hc->cont_flags = flags;
+	h2f_block(hc, p, len, flags);
+}
+
+static void
+h2f_rx_settings(struct h2f_conn *hc, uint8_t flags, const uint8_t *p,
+    uint32_t len)
+{
+	uint16_t ident;
+	uint32_t val;
+
+	if (flags & H2FF_SETTINGS_ACK)
+		return;
+	if (len % 6) {
+		h2f_fail(hc, H2CE_FRAME_SIZE_ERROR, "bad SETTINGS frame");
+		return;
+	}
+	for (; len > 0; p += 6, len -= 6) {
+		ident = vbe16dec(p);
+		val = vbe32dec(p + 2);
+		if (ident == H2_SET_MAX_CONCURRENT_STREAMS->ident) {
+			hc->max_streams = vmin_t(uint32_t, val,
+			    cache_param->backend_h2_max_streams);
+		} else if (ident == H2_SET_MAX_FRAME_SIZE->ident) {
+			if (val < H2_SET_MAX_FRAME_SIZE->minval ||
+			    val > H2_SET_MAX_FRAME_SIZE->maxval) {
+				h2f_fail(hc, H2CE_PROTOCOL_ERROR,
+				    "bad SETTINGS_MAX_FRAME_SIZE");
+				return;
+			}
+			hc->frame_size = val;
+		}
+		/*
+		 * The request headers are never indexed and no DATA is
+		 * sent, so the other settings do not concern us.
+		 */
+	}
+	h2f_send(hc, H2_F_SETTINGS, H2FF_SETTINGS_ACK, 0, NULL, 0);
+}
+
+static void
+h2f_rx_goaway(struct h2f_conn *hc, const uint8_t *p, uint32_t len)
+{
+	struct h2f_stream *hs;
+	uint32_t last;
+
+	if (len < 8) {
+		h2f_fail(hc, H2CE_FRAME_SIZE_ERROR, "bad GOAWAY frame");
+		return;
+	}
+	last = vbe32dec(p) & ~(1U << 31);
+	hc->goaway = 1;
+	VTAILQ_FOREACH(hs, &hc->streams, list)
+		if (hs->id > last)
+			h2f_stream_fail(hs, vbe32dec(p + 4), "GOAWAY", 1);
+}
+
+static void
+h2f_frame(struct h2f_conn *hc, uint8_t type, uint8_t flags, uint32_t id,
+    uint8_t *p, uint32_t len)
+{
+	struct h2f_stream *hs;
+
+	if (hc->cont_id != 0) {
+		if (type != H2_F_CONTINUATION->type || id != hc->cont_id)
+			h2f_fail(hc, H2CE_PROTOCOL_ERROR,
+			    "expected CONTINUATION");
+		else
+			h2f_block(hc, p, len, flags);
+		return;
+	}
+
+	if (type == H2_F_DATA->type) {
+		h2f_rx_data(hc, flags, id, p, len);
+	} else if (type == H2_F_HEADERS->type) {
+		h2f_rx_headers(hc, flags, id, p, len);
+	} else if (type == H2_F_RST_STREAM->type) {
+		if (len != 4) {
+			h2f_fail(hc, H2CE_FRAME_SIZE_ERROR,
+			    "bad RST_STREAM frame");
+			return;
+		}
+		hs = h2f_lookup(hc, id);
+		if (hs != NULL)
+			h2f_stream_fail(hs, vbe32dec(p), "stream reset",
+			    vbe32dec(p) == H2SE_REFUSED_STREAM->val);
+	} else if (type == H2_F_SETTINGS->type) {
+		h2f_rx_settings(hc, flags, p, len);
+	} else if (type == H2_F_PING->type) {
+		if (len != 8) {
+			h2f_fail(hc, H2CE_FRAME_SIZE_ERROR, "bad PING frame");
+			return;
+		}
+		if (!(flags & H2FF_PING_ACK))
+			h2f_send(hc, H2_F_PING, H2FF_PING_ACK, 0, p, len);
+	} else if (type == H2_F_GOAWAY->type) {
+		h2f_rx_goaway(hc, p, len);
+	} else if (type == H2_F_PUSH_PROMISE->type ||
+	    type == H2_F_CONTINUATION->type) {
+		/* We said SETTINGS_ENABLE_PUSH=0 */
+		h2f_fail(hc, H2CE_PROTOCOL_ERROR, "unexpected frame");
+	}
+	/* PRIORITY, WINDOW_UPDATE and unknown frames are ignored */
+}
+
+static void
+h2f_frames(struct h2f_conn *hc)
+{
+	uint8_t *p, *e;
+	uint32_t len;
+
+	p = hc->rxbuf;
+	e = p + hc->rxlen;
+	while (!hc->dead && e - p >= 9) {
+		len = vbe32dec(p) >> 8;
+		if (len > H2F_FRAME_MAX) {
+			h2f_fail(hc, H2CE_FRAME_SIZE_ERROR, "frame too large");
+			return;
+		}
+		if (e - p < 9 + len)
+			break;
+		h2f_frame(hc, p[3], p[4], vbe32dec(p + 5) & ~(1U << 31),
+		    p + 9, len);
+		p += 9 + len;
+	}
+	hc->rxlen = e - p;
+	if (hc->rxlen > 0 && p != hc->rxbuf)
+		memmove(hc->rxbuf, p, hc->rxlen);
+}
+
+/*
+ * Read whatever the connection has for us, or time out.  Returns
+ * non-zero on timeout.
+ */
+
+static int
+h2f_rx(struct h2f_conn *hc, vtim_real deadline)
+{
+	struct pollfd pfd[1];
+	ssize_t l = 0;
+	int i, e = 0;
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	Lck_AssertHeld(&hc->pool->mtx);
+	assert(hc->reading);
+	assert(hc->fd >= 0);
+	assert(hc->rxlen < sizeof hc->rxbuf);
+
+	pfd->fd = hc->fd;
+	pfd->events = POLLIN;
+	pfd->revents = 0;
+	i = (int)vmax_t(double, 0., (deadline - VTIM_real()) * 1e3);
+	Lck_Unlock(&hc->pool->mtx);
+	i = poll(pfd, 1, i);
+	if (i > 0) {
+		l = read(hc->fd, hc->rxbuf + hc->rxlen,
+		    sizeof hc->rxbuf - hc->rxlen);
+		e = errno;
+	}
+	Lck_Lock(&hc->pool->mtx);
+	if (i == 0)
+		return (1);
+	if (i < 0 || (l < 0 && e == EINTR))
+		return (0);
+	if (l <= 0) {
+		h2f_fail(hc, NULL, l == 0 ? "backend closed" : "read error");
+		return (0);
+	}
+	hc->rxlen += l;
+	h2f_frames(hc);
+	h2f_flush(hc);
+	return (0);
+}
+
+typedef int h2f_ready_f(const struct h2f_stream *);
+
+static int
+h2f_hdrs_ready(const struct h2f_stream *hs)
+{
+
+	return (hs->hdrs || hs->why != NULL);
+}
+
+static int
+h2f_body_ready(const struct h2f_stream *hs)
+{
+
+	return (!VTAILQ_EMPTY(&hs->chunks) || hs->eos || hs->why != NULL);
+}
+
+/*
+ * Wait until the stream is ready, reading the connection ourselves if
+ * nobody else is.  Returns non-zero on timeout.
+ */
+
+static int
+h2f_wait(struct h2f_stream *hs, h2f_ready_f *func, vtim_real deadline)
+{
+	struct h2f_conn *hc;
+	int i;
+
+	CHECK_OBJ_NOTNULL(hs, H2F_STREAM_MAGIC);
+	hc = hs->conn;
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	Lck_AssertHeld(&hc->pool->mtx);
+
+	while (!func(hs)) {
+		AZ(hc->dead);
+		if (!hc->reading && !hc->parked) {
+			hc->reading = 1;
+			i = h2f_rx(hc, deadline);
+			hc->reading = 0;
+			PTOK(pthread_cond_broadcast(&hc->cond));
+			if (i)
+				break;
+			continue;
+		}
+		i = Lck_CondWaitUntil(&hc->cond, &hc->pool->mtx, deadline);
+		if (i == ETIMEDOUT)
+			break;
+	}
+	return (!func(hs));
+}
+
+/**********************************************************************
+ * Connections
+ */
+
+static void
+h2f_conn_close(struct h2f_conn *hc)
+{
+	uint8_t buf[8];
+	struct iovec iov[2];
+	uint8_t hdr[9];
+
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	AZ(hc->n_stream);
+	AZ(hc->reading);
+	AZ(hc->writing);
+	if (hc->pfd != NULL) {
+		if (!hc->dead) {
+			/* Not under the lock, h2f_send() won't do */
+			vbe32enc(hdr, sizeof buf << 8);
+			hdr[3] = H2_F_GOAWAY->type;
+			hdr[4] = 0;
+			vbe32enc(hdr + 5, 0);
+			vbe32enc(buf, 0);
+			vbe32enc(buf + 4, H2CE_NO_ERROR->val);
+			iov[0].iov_base = hdr;
+			iov[0].iov_len = sizeof hdr;
+			iov[1].iov_base = buf;
+			iov[1].iov_len = sizeof buf;
+			(void)h2f_write(hc, iov, 2);
+		}
+		VCP_Close(&hc->pfd);
+		AZ(hc->pfd);
+	}
+	VHT_Fini(hc->dectbl);
+	PTOK(pthread_cond_destroy(&hc->cond));
+	free(hc->txbuf);
+	FREE_OBJ(hc);
+}
+
+static int
+h2f_conn_usable(struct h2f_conn *hc, vtim_real now)
+{
+	struct pollfd pfd[1];
+
+	if (hc->dead || hc->goaway || hc->next_id > H2F_STREAM_MAX)
+		return (0);
+	if (hc->n_stream > 0 || hc->connecting)
+		return (1);
+	if (hc->t_idle + cache_param->backend_idle_timeout < now)
+		return (0);
+	/* Nobody reads an idle connection, anything there means trouble */
+	pfd->fd = hc->fd;
+	pfd->events = POLLIN;
+	pfd->revents = 0;
+	return (poll(pfd, 1, 0) == 0);
+}
+
+static void
+h2f_preface(struct h2f_conn *hc)
+{
+	uint8_t buf[12];
+
+	h2f_queue(hc, H2F_preface, sizeof H2F_preface);
+	vbe16enc(buf, H2_SET_ENABLE_PUSH->ident);
+	vbe32enc(buf + 2, 0);
+	vbe16enc(buf + 6, H2_SET_INITIAL_WINDOW_SIZE->ident);
+	vbe32enc(buf + 8, H2F_WINDOW);
+	h2f_send(hc, H2_F_SETTINGS, 0, 0, buf, sizeof buf);
+	h2f_send_u32(hc, H2_F_WINDOW_UPDATE, 0,
+	    H2F_CONN_WINDOW - H2_SET_INITIAL_WINDOW_SIZE->defval);
+}
+
+/*
+ * Detach a stream, returns the connection if it must be closed.
+ */
+
+static struct h2f_conn *
+h2f_stream_rel(struct h2f_stream *hs)
+{
+	struct h2f_conn *hc;
+
+	CHECK_OBJ_NOTNULL(hs, H2F_STREAM_MAGIC);
+	hc = hs->conn;
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	Lck_AssertHeld(&hc->pool->mtx);
+
+	VTAILQ_REMOVE(&hc->streams, hs, list);
+	if (hc->dec_hs == hs)
+		h2f_dec_target(hc, NULL);
+	assert(hc->n_stream > 0);
+	if (--hc->n_stream > 0)
+		return (NULL);
+	hc->t_idle = VTIM_real();
+	if (!hc->dead && !hc->goaway && hc->next_id <= H2F_STREAM_MAX)
+		return (NULL);
+	if (hc->parked) {
+		/* The waiter closes it */
+		(void)shutdown(hc->fd, SHUT_RDWR);
+		return (NULL);
+	}
+	VTAILQ_REMOVE(&hc->pool->conns, hc, list);
+	return (hc);
+}
+
+/*
+ * The waiter hands back a parked connection.  If a fetch picked it up
+ * in the meantime, the fetch can now read it, otherwise it goes.
+ */
+
+static void v_matchproto_(waiter_handle_f)
+h2f_handle(struct waited *w, enum wait_event ev, vtim_real now)
+{
+	struct h2f_conn *hc;
+	struct h2f_pool *hp;
+
+	CHECK_OBJ_NOTNULL(w, WAITED_MAGIC);
+	CAST_OBJ_NOTNULL(hc, w->priv1, H2F_CONN_MAGIC);
+	(void)ev;
+	(void)now;
+	hp = hc->pool;
+	CHECK_OBJ_NOTNULL(hp, H2F_POOL_MAGIC);
+
+	Lck_Lock(&hp->mtx);
+	AN(hc->parked);
+	hc->parked = 0;
+	if (hc->n_stream > 0) {
+		PTOK(pthread_cond_broadcast(&hc->cond));
+		Lck_Unlock(&hp->mtx);
+		return;
+	}
+	VTAILQ_REMOVE(&hp->conns, hc, list);
+	Lck_Unlock(&hp->mtx);
+	h2f_conn_close(hc);
+}
+
+/*
+ * Park an idle connection in the waiter, returns the connection if it
+ * must be closed.
+ */
+
+static struct h2f_conn *
+h2f_park(const struct worker *wrk, struct h2f_conn *hc)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	Lck_AssertHeld(&hc->pool->mtx);
+
+	if (hc->n_stream > 0 || hc->parked)
+		return (NULL);
+	AZ(hc->reading);
+	AZ(hc->writing);
+	INIT_OBJ(hc->waited, WAITED_MAGIC);
+	hc->waited->fd = hc->fd;
+	hc->waited->priv1 = hc;
+	hc->waited->func = h2f_handle;
+	hc->waited->tmo = cache_param->backend_idle_timeout;
+	hc->waited->idle = hc->t_idle;
+	hc->parked = 1;
+	if (Wait_Enter(wrk->pool->waiter, hc->waited)) {
+		hc->parked = 0;
+		VTAILQ_REMOVE(&hc->pool->conns, hc, list);
+		return (hc);
+	}
+	return (NULL);
+}
+
+static void
+h2f_stream_free(struct h2f_stream **hsp)
+{
+	struct h2f_stream *hs;
+	struct h2f_chunk *hk, *hk2;
+
+	TAKE_OBJ_NOTNULL(hs, hsp, H2F_STREAM_MAGIC);
+	VTAILQ_FOREACH_SAFE(hk, &hs->chunks, list, hk2)
+		free(hk);
+	free(hs->hbuf);
+	FREE_OBJ(hs);
+}
+
+/*--------------------------------------------------------------------
+ * Get a stream on a new or existing connection.  Returns the pfd of the
+ * connection, or NULL with *err set if the connection failed.
+ */
+
+struct pfd *
+H2F_Get(struct h2f_pool *hp, vtim_dur tmo, struct worker *wrk,
+    struct h2f_stream **hsp, unsigned *reused, int *err)
+{
+	struct h2f_conn *hc, *hc2;
+	struct h2f_conn_s gone;
+	struct h2f_stream *hs;
+	struct pfd *pfd = NULL;
+	vtim_real now;
+	int fresh = 0;
+
+	CHECK_OBJ_NOTNULL(hp, H2F_POOL_MAGIC);
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(hsp);
+	AN(reused);
+	AN(err);
+	*err = 0;
+
+	ALLOC_OBJ(hs, H2F_STREAM_MAGIC);
+	AN(hs);
+	hs->hsize = cache_param->http_resp_size;
+	hs->hbuf = malloc(hs->hsize);
+	AN(hs->hbuf);
+	VTAILQ_INIT(&hs->chunks);
+	hs->rwin = H2F_WINDOW;
+
+	VTAILQ_INIT(&gone);
+	now = VTIM_real();
+	Lck_Lock(&hp->mtx);
+	VTAILQ_FOREACH_SAFE(hc, &hp->conns, list, hc2) {
+		if (!h2f_conn_usable(hc, now)) {
+			if (hc->n_stream == 0 && !hc->parked) {
+				VTAILQ_REMOVE(&hp->conns, hc, list);
+				VTAILQ_INSERT_TAIL(&gone, hc, list);
+			}
+			continue;
+		}
+		if (hc->n_stream < hc->max_streams)
+			break;
+	}
+	if (hc == NULL) {
+		ALLOC_OBJ(hc, H2F_CONN_MAGIC);
+		AN(hc);
+		hc->pool = hp;
+		hc->fd = -1;
+		hc->connecting = 1;
+		hc->next_id = 1;
+		hc->max_streams = vmin_t(uint32_t, 100,
+		    cache_param->backend_h2_max_streams);
+		hc->frame_size = H2_SET_MAX_FRAME_SIZE->defval;
+		PTOK(pthread_cond_init(&hc->cond, NULL));
+		VTAILQ_INIT(&hc->streams);
+		AZ(VHT_Init(hc->dectbl,
+		    H2_SET_HEADER_TABLE_SIZE->defval));
+		h2f_dec_target(hc, NULL);
+		VTAILQ_INSERT_TAIL(&hp->conns, hc, list);
+		fresh = 1;
+	}
+	hs->conn = hc;
+	hs->reused = !fresh;
+	hc->n_stream++;
+	hc->n_served++;
+	VTAILQ_INSERT_TAIL(&hc->streams, hs, list);
+
+	if (fresh) {
+		Lck_Unlock(&hp->mtx);
+		pfd = VCP_Get(hp->conn_pool, tmo, wrk, 1, err);
+		Lck_Lock(&hp->mtx);
+		hc->connecting = 0;
+		if (pfd == NULL) {
+			hc->err = *err;
+			h2f_fail(hc, NULL, "connect failed");
+		} else {
+			hc->pfd = pfd;
+			hc->fd = *PFD_Fd(pfd);
+			VSC_C_main->backend_h2_conn++;
+			h2f_preface(hc);
+		}
+		PTOK(pthread_cond_broadcast(&hc->cond));
+		h2f_flush(hc);
+	}
+	while (hc->connecting)
+		(void)Lck_CondWait(&hc->cond, &hp->mtx);
+
+	if (hs->why != NULL) {
+		*err = hc->err;
+		hc = h2f_stream_rel(hs);
+		if (hc != NULL)
+			VTAILQ_INSERT_TAIL(&gone, hc, list);
+		h2f_stream_free(&hs);
+	}
+	pfd = hs == NULL ? NULL : hc->pfd;
+	Lck_Unlock(&hp->mtx);
+
+	VTAILQ_FOREACH_SAFE(hc, &gone, list, hc2)
+		h2f_conn_close(hc);
+
+	*hsp = hs;
+	*reused = !fresh;
+	return (pfd);
+}
+
+static struct h2f_stream *
+h2f_htc_stream(const struct http_conn *htc)
+{
+	struct h2f_stream *hs;
+
+	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
+	CAST_OBJ_NOTNULL(hs, htc->priv, H2F_STREAM_MAGIC);
+	CHECK_OBJ_NOTNULL(hs->conn, H2F_CONN_MAGIC);
+	return (hs);
+}
+
+/*
+ * The htc->priv of an HTTP/1 fetch is a struct pfd, tell them apart by
+ * the magic.
+ */
+
+struct pfd *
+H2F_Pfd(const struct http_conn *htc)
+{
+	const struct h2f_stream *hs;
+
+	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
+	hs = htc->priv;
+	if (hs == NULL || hs->magic != H2F_STREAM_MAGIC)
+		return (NULL);
+	CHECK_OBJ_NOTNULL(hs->conn, H2F_CONN_MAGIC);
+	return (hs->conn->pfd);
+}
+
+/*--------------------------------------------------------------------
+ * Send the request headers
+ *
+ * Returns:
+ *	-1 failure
+ *	 0 success
+ *	 1 failure which can be retried
+ */
+
+static void
+h2f_enc_req(struct vsb *vsb, const struct http *hp)
+{
+	const char *p, *r;
+	unsigned u;
+
+	/* Literal header fields without indexing, RFC 7541 6.2.2 */
+	h2_enc_len(vsb, 4, 2, 0x00);		/* :method */
+	h2_enc_str(vsb, hp->hd[HTTP_HDR_METHOD].b,
+	    Tlen(hp->hd[HTTP_HDR_METHOD]), 0);
+	VSB_putc(vsb, 0x86);			/* :scheme http */
+	if (http_GetHdr(hp, H_Host, &p)) {
+		h2_enc_len(vsb, 4, 1, 0x00);	/* :authority */
+		h2_enc_str(vsb, p, strlen(p), 0);
+	}
+	h2_enc_len(vsb, 4, 4, 0x00);		/* :path */
+	h2_enc_str(vsb, hp->hd[HTTP_HDR_URL].b,
+	    Tlen(hp->hd[HTTP_HDR_URL]), 0);
+
+	for (u = HTTP_HDR_FIRST; u < hp->nhd; u++) {
+		if (http_IsFiltered(hp, u, HTTPH_C_SPECIFIC) ||
+		    http_IsHdr(&hp->hd[u], H_Host))
+			continue;
+		r = strchr(hp->hd[u].b, ':');
+		AN(r);
+		p = r + 1;
+		while (vct_islws(*p))
+			p++;
+		if (http_IsHdr(&hp->hd[u], H_TE) && strcasecmp(p, "trailers"))
+			continue;
+		VSB_putc(vsb, 0x00);
+		h2_enc_str(vsb, hp->hd[u].b, r - hp->hd[u].b, 1);
+		h2_enc_str(vsb, p, hp->hd[u].e - p, 0);
+	}
+}
+
+int
+H2F_SendReq(struct worker *wrk, struct busyobj *bo)
+{
+	struct h2f_stream *hs;
+	struct h2f_conn *hc;
+	struct vsb vsb[1];
+	const char *b, *why = NULL;
+	size_t sz, l;
+	uintptr_t ss;
+	h2_frame ftyp;
+	uint8_t flags;
+	int retry = 0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	hs = h2f_htc_stream(bo->htc);
+	hc = hs->conn;
+
+	ss = WS_Snapshot(bo->ws);
+	WS_VSB_new(vsb, bo->ws);
+	h2f_enc_req(vsb, bo->bereq);
+	b = WS_VSB_finish(vsb, bo->ws, &sz);
+	if (b == NULL) {
+		VSLb(bo->vsl, SLT_FetchError, "workspace_backend overflow");
+		VSLb_ts_busyobj(bo, "Bereq", W_TIM_real(wrk));
+		bo->htc->doclose = SC_OVERLOAD;
+		return (-1);
+	}
+
+	Lck_Lock(&hc->pool->mtx);
+	if (hs->why == NULL && hc->goaway)
+		h2f_stream_fail(hs, 0, "GOAWAY", 1);
+	if (hs->why == NULL) {
+		hs->id = hc->next_id;
+		hc->next_id += 2;
+		ftyp = H2_F_HEADERS;
+		flags = H2FF_HEADERS_END_STREAM;
+		do {
+			l = vmin_t(size_t, sz, hc->frame_size);
+			if (l == sz)
+				flags |= H2FF_HEADERS_END_HEADERS;
+			h2f_send(hc, ftyp, flags, hs->id, b, l);
+			bo->acct.bereq_hdrbytes += 9 + l;
+			b += l;
+			sz -= l;
+			ftyp = H2_F_CONTINUATION;
+			flags = 0;
+		} while (sz > 0);
+		h2f_flush(hc);
+	}
+	why = hs->why;
+	retry = hs->retry;
+	Lck_Unlock(&hc->pool->mtx);
+
+	WS_Reset(bo->ws, ss);
+	VSLb_ts_busyobj(bo, "Bereq", W_TIM_real(wrk));
+	if (why == NULL)
+		return (0);
+	VSLb(bo->vsl, SLT_FetchError, "HTTP/2 %s", why);
+	bo->htc->doclose = SC_TX_ERROR;
+	return (retry ? 1 : -1);
+}
+
+/*--------------------------------------------------------------------
+ * Body
+ */
+
+static enum vfp_status v_matchproto_(vfp_pull_f)
+h2f_body_pull(struct vfp_ctx *vc, struct vfp_entry *vfe, void *p,
+    ssize_t *lp)
+{
+	struct h2f_stream *hs;
+	struct h2f_conn *hc;
+	struct h2f_chunk *hk;
+	ssize_t l, m, n = 0;
+	const char *why;
+	int tmo, end;
+
+	CHECK_OBJ_NOTNULL(vc, VFP_CTX_MAGIC);
+	CHECK_OBJ_NOTNULL(vfe, VFP_ENTRY_MAGIC);
+	CAST_OBJ_NOTNULL(hs, vfe->priv1, H2F_STREAM_MAGIC);
+	hc = hs->conn;
+	CHECK_OBJ_NOTNULL(hc, H2F_CONN_MAGIC);
+	AN(p);
+	AN(lp);
+
+	l = *lp;
+	*lp = 0;
+
+	Lck_Lock(&hc->pool->mtx);
+	tmo = h2f_wait(hs, h2f_body_ready,
+	    VTIM_real() + hs->between_bytes_timeout);
+	while (n < l && (hk = VTAILQ_FIRST(&hs->chunks)) != NULL) {
+		m = vmin_t(ssize_t, l - n, hk->len - hk->off);
+		memcpy((char *)p + n, hk->data + hk->off, m);
+		hk->off += m;
+		n += m;
+		if (hk->off == hk->len) {
+			VTAILQ_REMOVE(&hs->chunks, hk, list);
+			free(hk);
+		}
+	}
+	hs->unacked += n;
+	if (hs->unacked >= H2F_WINDOW / 2 && !hs->eos && hs->why == NULL) {
+		h2f_send_u32(hc, H2_F_WINDOW_UPDATE, hs->id, hs->unacked);
+		hs->rwin += hs->unacked;
+		hs->unacked = 0;
+		h2f_flush(hc);
+	}
+	end = hs->eos && VTAILQ_EMPTY(&hs->chunks);
+	why = hs->why;
+	Lck_Unlock(&hc->pool->mtx);
+
+	*lp = n;
+	if (n == 0 && why != NULL)
+		return (VFP_Error(vc, "HTTP/2 %s", why));
+	if (n == 0 && tmo)
+		return (VFP_Error(vc, "between bytes timeout"));
+	if (vfe->priv2 >= 0) {
+		if (n > vfe->priv2)
+			return (VFP_Error(vc, "body longer than Content-Length"));
+		vfe->priv2 -= n;
+		if (end && vfe->priv2 > 0)
+			return (VFP_Error(vc,
+			    "body shorter than Content-Length"));
+	}
+	return (end ? VFP_END : VFP_OK);
+}
+
+static const struct vfp h2f_body = {
+	.name = "H2F_BODY",
+	.pull = h2f_body_pull,
+};
+
+/*--------------------------------------------------------------------
+ * Wait for the response headers
+ *
+ * Returns:
+ *	-1 failure
+ *	 0 success
+ *	 1 failure which can be retried
+ */
+
+int
+H2F_FetchRespHdr(struct busyobj *bo)
+{
+	struct h2f_stream *hs;
+	struct h2f_conn *hc;
+	struct http_conn *htc;
+	struct http *hp;
+	struct vfp_entry *vfe;
+	const char *b, *e, *why;
+	ssize_t cl;
+	int tmo, retry, nobody;
+
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	htc = bo->htc;
+	hs = h2f_htc_stream(htc);
+	hc = hs->conn;
+
+	VSC_C_main->backend_req++;
+
+	Lck_Lock(&hc->pool->mtx);
+	tmo = h2f_wait(hs, h2f_hdrs_ready,
+	    VTIM_real() + htc->first_byte_timeout);
+	why = hs->why;
+	retry = hs->retry;
+	nobody = hs->eos && VTAILQ_EMPTY(&hs->chunks);
+	bo->acct.beresp_hdrbytes += hs->hdrbytes;
+	Lck_Unlock(&hc->pool->mtx);
+
+	if (tmo) {
+		VSLb(bo->vsl, SLT_FetchError, "first byte timeout");
+		htc->doclose = SC_RX_TIMEOUT;
+		return (-1);
+	}
+	if (!hs->hdrs) {
+		AN(why);
+		VSLb(bo->vsl, SLT_FetchError, "HTTP/2 %s (%u)", why, hs->code);
+		htc->doclose = SC_RX_BAD;
+		return (retry ? 1 : -1);
+	}
+
+	/* The reader is done with hbuf once hdrs is set */
+	hp = bo->beresp;
+	b = hs->hbuf;
+	e = b + hs->hlen;
+	http_PutResponse(hp, "HTTP/2.0", h2f_status(b, e - b), NULL);
+	for (b += strlen(b) + 1; b < e; b += strlen(b) + 1) {
+		if (*b == ':') {
+			VSLb(bo->vsl, SLT_BogoHeader, "%.20s", b);
+			VSLb(bo->vsl, SLT_FetchError, "http format error");
+			htc->doclose = SC_RX_JUNK;
+			return (-1);
+		}
+		http_SetHeader(hp, WS_Copy(bo->ws, b, -1));
+	}
+	if (WS_Overflowed(bo->ws)) {
+		VSLb(bo->vsl, SLT_FetchError, "overflow");
+		htc->doclose = SC_RX_OVERFLOW;
+		return (-1);
+	}
+
+	htc->content_length = -1;
+	hs->between_bytes_timeout = htc->between_bytes_timeout;
+	cl = http_GetContentLength(hp);
+
+	/* As in V1F_FetchRespHdr(), minus the HTTP/1 framing */
+	if (http_method_eq(http_GetMethod(bo->bereq), HEAD)) {
+		bo->wrk->stats->fetch_head++;
+		htc->body_status = BS_NONE;
+	} else if (http_IsStatus(hp, 204)) {
+		bo->wrk->stats->fetch_204++;
+		if (cl > 0 || http_GetHdr(hp, H_Transfer_Encoding, NULL))
+			htc->body_status = BS_ERROR;
+		else
+			htc->body_status = BS_NONE;
+	} else if (http_IsStatus(hp, 304)) {
+		bo->wrk->stats->fetch_304++;
+		htc->body_status = BS_NONE;
+	} else if (cl == -2 ||
+	    http_GetHdr(hp, H_Transfer_Encoding, NULL)) {
+		bo->wrk->stats->fetch_bad++;
+		htc->body_status = BS_ERROR;
+	} else if (cl > 0) {
+		bo->wrk->stats->fetch_length++;
+		htc->content_length = cl;
+		htc->body_status = BS_LENGTH;
+	} else if (cl == 0 || nobody) {
+		bo->wrk->stats->fetch_none++;
+		htc->content_length = cl;
+		htc->body_status = BS_NONE;
+	} else {
+		bo->wrk->stats->fetch_eof++;
+		htc->body_status = BS_EOF;
+	}
+
+	assert(bo->vfc->resp == bo->beresp);
+	if (htc->body_status != BS_NONE && htc->body_status != BS_ERROR) {
+		vfe = VFP_Push(bo->vfc, &h2f_body);
+		if (vfe == NULL) {
+			VSLb(bo->vsl, SLT_FetchError, "overflow");
+			htc->doclose = SC_RX_OVERFLOW;
+			return (-1);
+		}
+		vfe->priv1 = hs;
+		vfe->priv2 = htc->content_length;
+	}
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Done with the stream, returns non-zero if the connection was closed.
+ */
+
+int
+H2F_Finish(struct busyobj *bo)
+{
+	struct h2f_stream *hs;
+	struct h2f_conn *hc;
+
+	CHECK_OBJ_NOTNULL(bo, BUSYOBJ_MAGIC);
+	hs = h2f_htc_stream(bo->htc);
+	hc = hs->conn;
+	bo->htc->priv = NULL;
+
+	Lck_Lock(&hc->pool->mtx);
+	if (hs->id != 0 && !hs->eos && hs->why == NULL && !hc->dead) {
+		h2f_send_u32(hc, H2_F_RST_STREAM, hs->id, H2SE_CANCEL->val);
+		h2f_flush(hc);
+	}
+	hc = h2f_stream_rel(hs);
+	if (hc == NULL)
+		hc = h2f_park(bo->wrk, hs->conn);
+	Lck_Unlock(&hs->conn->pool->mtx);
+
+	h2f_stream_free(&hs);
+	if (hc == NULL)
+		return (0);
+	h2f_conn_close(hc);
+	return (1);
+}
+
+/*--------------------------------------------------------------------*/
+
+struct h2f_pool *
+H2F_New(struct conn_pool *cp)
+{
+	struct h2f_pool *hp;
+
+	AN(cp);
+	ALLOC_OBJ(hp, H2F_POOL_MAGIC);
+	AN(hp);
+	Lck_New(&hp->mtx, lck_h2fetch);
+	hp->conn_pool = cp;
+	VTAILQ_INIT(&hp->conns);
+	return (hp);
+}
+
+void
+H2F_Destroy(struct h2f_pool **hpp)
+{
+	struct h2f_pool *hp;
+	struct h2f_conn *hc, *hc2;
+	struct h2f_conn_s gone;
+
+	TAKE_OBJ_NOTNULL(hp, hpp, H2F_POOL_MAGIC);
+	VTAILQ_INIT(&gone);
+	Lck_Lock(&hp->mtx);
+	VTAILQ_FOREACH_SAFE(hc, &hp->conns, list, hc2) {
+		AZ(hc->n_stream);
+		if (hc->parked) {
+			(void)shutdown(hc->fd, SHUT_RDWR);
+			continue;
+		}
+		VTAILQ_REMOVE(&hp->conns, hc, list);
+		VTAILQ_INSERT_TAIL(&gone, hc, list);
+	}
+	/* Let the waiter close the parked ones */
+	while (!VTAILQ_EMPTY(&hp->conns)) {
+		Lck_Unlock(&hp->mtx);
+		(void)usleep(20000);
+		Lck_Lock(&hp->mtx);
+	}
+	Lck_Unlock(&hp->mtx);
+	VTAILQ_FOREACH_SAFE(hc, &gone, list, hc2)
+		h2f_conn_close(hc);
+	Lck_Delete(&hp->mtx);
+	FREE_OBJ(hp);
+}
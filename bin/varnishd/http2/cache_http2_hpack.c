@@ -254,6 +254,8 @@ h2h_addhdr(struct http *hp, struct h2h_decode *d)
 	}
 
 	hp->hd[n] = hdr;
+	if (n >= HTTP_HDR_FIRST)
+		http_IndexHdr(hp, n);
 	return (0);
 }
 
@@ -92,6 +92,13 @@ h2_sess_panic(struct vsb *vsb, const struct sess *sp)
 	    "{rxf_len, rxf_type, rxf_flags, rxf_stream} ="
 	    " {%u, %u, 0x%x, %u},\n",
 	    h2->rxf_len, h2->rxf_type, h2->rxf_flags, h2->rxf_stream);
+	VSB_printf(vsb, "sched_waits = %ju, sched_reordered = %ju,\n",
+	    (uintmax_t)h2->sched_waits, (uintmax_t)h2->sched_reordered);
+	if (h2->tx != NULL)
+		VSB_printf(vsb,
+		    "{tx_gen, tx_done, tx_writing} = {%ju, %ju, %d},\n",
+		    (uintmax_t)h2->tx->gen, (uintmax_t)h2->tx->done,
+		    h2->tx->writing);
 	VTAILQ_FOREACH(r2, &h2->streams, list) {
 		if (PAN_dump_struct(vsb, r2, H2_REQ_MAGIC, "stream"))
 			continue;
@@ -107,6 +114,8 @@ h2_sess_panic(struct vsb *vsb, const struct sess *sp)
 
 		VSB_printf(vsb, "h2_sess = %p, scheduled = %d, error = %s,\n",
 		    r2->h2sess, r2->scheduled, h2_panic_error(r2->error));
+		VSB_printf(vsb, "urgency = %u, incremental = %u,\n",
+		    r2->urgency, r2->incremental);
 		VSB_printf(vsb, "t_send = %f, t_winupd = %f,\n",
 		    r2->t_send, r2->t_winupd);
 		VSB_printf(vsb, "t_window = %jd, r_window = %jd,\n",
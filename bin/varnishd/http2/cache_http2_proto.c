@@ -164,6 +164,7 @@ h2_new_req(struct h2_sess *h2, unsigned stream, struct req *req)
 		r2->counted = 1;
 	r2->r_window = h2->local_settings.initial_window_size;
 	r2->t_window = h2->remote_settings.initial_window_size;
+	r2->urgency = H2_URGENCY_DEFAULT;
 	req->transport_priv = r2;
 	Lck_Lock(&h2->sess->mtx);
 	if (stream)
@@ -404,7 +405,7 @@ h2_rx_goaway(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	return (h2->error);
 }
 
-static void
+void
 h2_tx_goaway(struct worker *wrk, struct h2_sess *h2, h2_error h2e)
 {
 	char b[8];
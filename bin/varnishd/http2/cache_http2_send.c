@@ -38,6 +38,7 @@
 #include "cache/cache_transport.h"
 #include "http2/cache_http2.h"
 
+#include "vct.h"
 #include "vend.h"
 #include "vtim.h"
 
@@ -98,9 +99,108 @@ h2_cond_wait(pthread_cond_t *cond, struct h2_sess *h2, struct h2_req *r2)
 	return (h2e != NULL ? -1 : 0);
 }
 
+/**********************************************************************
+ * RFC 9218 Extensible Priorities
+ *
+ * The priority of a stream comes from the Priority header of the
+ * request, with the parameters of a Priority header in the response
+ * taking precedence, so VCL can set either of them.
+ */
+
+static const char H2_Priority[] = "\011Priority:";
+
+static void
+h2_priority_parse(const char *p, uint8_t *u, uint8_t *i)
+{
+	const char *k;
+	size_t kl;
+
+	if (p == NULL)
+		return;
+	while (*p != '\0') {
+		while (*p == ',' || vct_issp(*p))
+			p++;
+		k = p;
+		while (vct_islower(*p) || vct_isdigit(*p) ||
+		    *p == '_' || *p == '-' || *p == '.' || *p == '*')
+			p++;
+		kl = p - k;
+		if (kl == 1 && *k == 'u' && p[0] == '=' &&
+		    p[1] >= '0' && p[1] <= '0' + H2_URGENCY_MAX &&
+		    !vct_isdigit(p[2]))
+			*u = p[1] - '0';
+		else if (kl == 1 && *k == 'i' && p[0] != '=')
+			*i = 1;
+		else if (kl == 1 && *k == 'i' && !strncmp(p, "=?1", 3))
+			*i = 1;
+		else if (kl == 1 && *k == 'i' && !strncmp(p, "=?0", 3))
+			*i = 0;
+		/* Skip the value and parameters of this member */
+		while (*p != '\0' && *p != ',') {
+			if (*p == '"') {
+				for (p++; *p != '\0' && *p != '"'; p++)
+					if (*p == '\\' && p[1] != '\0')
+						p++;
+				if (*p == '\0')
+					break;
+			}
+			p++;
+		}
+	}
+}
+
+void
+H2_Send_Priority(struct h2_req *r2, const struct http *req,
+    const struct http *resp)
+{
+	struct h2_sess *h2;
+	const char *p;
+	uint8_t u, i;
+
+	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
+	h2 = r2->h2sess;
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+
+	u = H2_URGENCY_DEFAULT;
+	i = 0;
+	if (req != NULL && http_GetHdr(req, H2_Priority, &p))
+		h2_priority_parse(p, &u, &i);
+	if (resp != NULL && http_GetHdr(resp, H2_Priority, &p))
+		h2_priority_parse(p, &u, &i);
+	assert(u <= H2_URGENCY_MAX);
+
+	Lck_Lock(&h2->sess->mtx);
+	r2->urgency = u;
+	r2->incremental = i;
+	Lck_Unlock(&h2->sess->mtx);
+}
+
+/*
+ * Should a be sent before b ?  Streams are ordered by urgency, and
+ * non-incremental streams of the same urgency by stream id, so that
+ * they complete one after the other.  Incremental streams take turns
+ * with the streams of the same urgency already waiting.
+ */
+
+static int
+h2_sched_before(const struct h2_req *a, const struct h2_req *b)
+{
+
+	if (b->stream == 0)
+		return (0);
+	if (a->stream == 0)
+		return (1);	/* Control frames first */
+	if (a->urgency != b->urgency)
+		return (a->urgency < b->urgency);
+	if (!a->incremental && !b->incremental)
+		return (a->stream < b->stream);
+	return (0);
+}
+
 static void
 h2_send_get_locked(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 {
+	struct h2_req *r2b;
 
 	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
 	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
@@ -110,7 +210,22 @@ h2_send_get_locked(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	if (&wrk->cond == h2->cond)
 		ASSERT_RXTHR(h2);
 	r2->wrk = wrk;
-	VTAILQ_INSERT_TAIL(&h2->txqueue, r2, tx_list);
+
+	/* The first stream holds the send token, never queue before it */
+	r2b = VTAILQ_FIRST(&h2->txqueue);
+	if (r2b != NULL) {
+		h2->sched_waits++;
+		r2b = VTAILQ_NEXT(r2b, tx_list);
+	}
+	while (r2b != NULL && !h2_sched_before(r2, r2b))
+		r2b = VTAILQ_NEXT(r2b, tx_list);
+	if (r2b != NULL) {
+		VTAILQ_INSERT_BEFORE(r2b, r2, tx_list);
+		h2->sched_reordered++;
+		wrk->stats->h2_sched_reordered++;
+	} else
+		VTAILQ_INSERT_TAIL(&h2->txqueue, r2, tx_list);
+
 	while (!H2_SEND_HELD(h2, r2))
 		AZ(Lck_CondWait(&wrk->cond, &h2->sess->mtx));
 	r2->wrk = NULL;
@@ -129,20 +244,106 @@ H2_Send_Get(struct worker *wrk, struct h2_sess *h2, struct h2_req *r2)
 	Lck_Unlock(&h2->sess->mtx);
 }
 
+/*
+ * Write out the batch being filled.  New frames go to the other batch
+ * while the session mtx is released for the writev(2).
+ */
+
+static void
+h2_tx_write(struct h2_sess *h2)
+{
+	struct h2_tx *tx;
+	struct h2_txbatch *b;
+	uint64_t gen;
+	unsigned u;
+	ssize_t s;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	Lck_AssertHeld(&h2->sess->mtx);
+	tx = h2->tx;
+	CHECK_OBJ_NOTNULL(tx, H2_TX_MAGIC);
+	AZ(tx->writing);
+	assert(tx->done + 1 == tx->gen);
+
+	gen = tx->gen++;
+	b = &tx->batch[gen & 1];
+	AZ(tx->batch[tx->gen & 1].nframe);
+	tx->writing = 1;
+
+	if (b->niov > 0) {
+		Lck_Unlock(&h2->sess->mtx);
+		s = writev(h2->sess->fd, b->iov, b->niov);
+		Lck_Lock(&h2->sess->mtx);
+		if (s != b->len) {
+			if (errno == EWOULDBLOCK) {
+				VSLb(h2->vsl, SLT_Debug,
+				    "H2: Hit idle_send_timeout");
+			}
+			/*
+			 * There is no point in being nice here, we will be
+			 * unable to send a GOAWAY once the code unrolls, so
+			 * go directly to the finale and be done with it.
+			 */
+			h2->error = H2CE_PROTOCOL_ERROR;
+		} else {
+			for (u = 0; u < b->nframe; u++) {
+				if (b->bodylen[u] == 0)
+					continue;
+				VSLb_bin(h2->vsl, SLT_H2TxBody,
+				    b->bodylen[u], b->body[u]);
+			}
+		}
+	}
+
+	b->nframe = 0;
+	b->niov = 0;
+	b->len = 0;
+	tx->writing = 0;
+	tx->done = gen;
+	PTOK(pthread_cond_broadcast(tx->cond));
+}
+
+/* Wait for everything up to and including batch gen to be written */
+
+static void
+h2_tx_sync(struct h2_sess *h2, uint64_t gen)
+{
+	struct h2_tx *tx;
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	Lck_AssertHeld(&h2->sess->mtx);
+	tx = h2->tx;
+	CHECK_OBJ_NOTNULL(tx, H2_TX_MAGIC);
+	assert(gen <= tx->gen);
+
+	while (tx->done < gen) {
+		if (tx->writing)
+			AZ(Lck_CondWait(tx->cond, &h2->sess->mtx));
+		else
+			h2_tx_write(h2);
+	}
+}
+
 static void
 h2_send_rel_locked(struct h2_sess *h2, const struct h2_req *r2)
 {
+	uint64_t gen;
+
 	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
 	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
 
 	Lck_AssertHeld(&h2->sess->mtx);
 	AN(H2_SEND_HELD(h2, r2));
+	gen = r2->tx_gen;
 	VTAILQ_REMOVE(&h2->txqueue, r2, tx_list);
 	r2 = VTAILQ_FIRST(&h2->txqueue);
 	if (r2 != NULL) {
 		CHECK_OBJ_NOTNULL(r2->wrk, WORKER_MAGIC);
 		PTOK(pthread_cond_signal(&r2->wrk->cond));
 	}
+
+	/* The next sender builds its frames while we write ours */
+	h2_tx_sync(h2, gen);
 }
 
 void
@@ -172,7 +373,8 @@ h2_mk_hdr(uint8_t *hdr, h2_frame ftyp, uint8_t flags,
 /*
  * This is the "raw" frame sender, all per-stream accounting and
  * prioritization must have happened before this is called, and
- * the session mtx must be held.
+ * the send token must be held.  The frame is only queued, and the
+ * payload must not change before the send token is released.
  */
 
 void
@@ -180,9 +382,10 @@ H2_Send_Frame(struct worker *wrk, struct h2_sess *h2,
     h2_frame ftyp, uint8_t flags,
     uint32_t len, uint32_t stream, const void *ptr)
 {
-	uint8_t hdr[9];
-	ssize_t s;
-	struct iovec iov[2];
+	struct h2_req *r2;
+	struct h2_tx *tx;
+	struct h2_txbatch *b;
+	uint8_t *hdr;
 
 	(void)wrk;
 
@@ -193,36 +396,48 @@ H2_Send_Frame(struct worker *wrk, struct h2_sess *h2,
 	else
 		AZ(ftyp->act_snonzero);
 
-	h2_mk_hdr(hdr, ftyp, flags, len, stream);
 	Lck_Lock(&h2->sess->mtx);
+	r2 = VTAILQ_FIRST(&h2->txqueue);
+	CHECK_OBJ_NOTNULL(r2, H2_REQ_MAGIC);
+	tx = h2->tx;
+	CHECK_OBJ_NOTNULL(tx, H2_TX_MAGIC);
+
+	while (tx->batch[tx->gen & 1].nframe == H2_TX_FRAMES) {
+		if (tx->writing)
+			AZ(Lck_CondWait(tx->cond, &h2->sess->mtx));
+		else
+			h2_tx_write(h2);
+	}
+	b = &tx->batch[tx->gen & 1];
+	r2->tx_gen = tx->gen;
+
+	hdr = b->hdr[b->nframe];
+	h2_mk_hdr(hdr, ftyp, flags, len, stream);
 	VSLb_bin(h2->vsl, SLT_H2TxHdr, 9, hdr);
 	h2->srq->acct.resp_hdrbytes += 9;
 	if (ftyp->overhead)
 		h2->srq->acct.resp_bodybytes += len;
-	Lck_Unlock(&h2->sess->mtx);
 
-	memset(iov, 0, sizeof iov);
-	iov[0].iov_base = (void*)hdr;
-	iov[0].iov_len = sizeof hdr;
-	iov[1].iov_base = TRUST_ME(ptr);
-	iov[1].iov_len = len;
-	s = writev(h2->sess->fd, iov, len == 0 ? 1 : 2);
-	if (s != sizeof hdr + len) {
-		if (errno == EWOULDBLOCK) {
-			VSLb(h2->vsl, SLT_Debug,
-			     "H2: stream %u: Hit idle_send_timeout", stream);
-		}
-		/*
-		 * There is no point in being nice here, we will be unable
-		 * to send a GOAWAY once the code unrolls, so go directly
-		 * to the finale and be done with it.
-		 */
-		h2->error = H2CE_PROTOCOL_ERROR;
+	b->iov[b->niov].iov_base = hdr;
+	b->iov[b->niov].iov_len = 9;
+	if (len > 0 && len <= H2_TX_INLINE) {
+		AN(ptr);
+		memcpy(hdr + 9, ptr, len);
+		ptr = hdr + 9;
+		b->iov[b->niov].iov_len += len;
 	} else if (len > 0) {
-		Lck_Lock(&h2->sess->mtx);
-		VSLb_bin(h2->vsl, SLT_H2TxBody, len, ptr);
-		Lck_Unlock(&h2->sess->mtx);
+		AN(ptr);
+		b->niov++;
+		b->iov[b->niov].iov_base = TRUST_ME(ptr);
+		b->iov[b->niov].iov_len = len;
 	}
+	b->niov++;
+	b->body[b->nframe] = ptr;
+	b->bodylen[b->nframe] = len;
+	b->nframe++;
+	b->len += 9 + len;
+	assert(b->niov <= H2_TX_FRAMES * 2);
+	Lck_Unlock(&h2->sess->mtx);
 }
 
 static int64_t
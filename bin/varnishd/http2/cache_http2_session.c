@@ -34,12 +34,16 @@
 #include "cache/cache_varnishd.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 
+#include "cache/cache_pool.h"
 #include "cache/cache_transport.h"
 #include "http2/cache_http2.h"
 
 #include "vend.h"
 #include "vtcp.h"
+#include "vtim.h"
+#include "waiter/waiter.h"
 
 static const char h2_resp_101[] =
 	"HTTP/1.1 101 Switching Protocols\r\n"
@@ -93,11 +97,30 @@ h2_local_settings(struct h2_settings *h2s)
  * WS, VSL, HTC &c,  but rather than implement all that stuff over, we
  * grab an actual struct req, and mirror the relevant fields into
  * struct h2_sess.
+ *
+ * While the session is idle in the waiter that request is released,
+ * so the h2_sess itself lives on the heap.
  */
 
+static void
+h2_sess_srq(struct h2_sess *h2, struct req *srq)
+{
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	CHECK_OBJ_NOTNULL(srq, REQ_MAGIC);
+	AZ(h2->srq);
+	h2->srq = srq;
+	h2->htc = srq->htc;
+	h2->ws = srq->ws;
+	h2->vsl = srq->vsl;
+	VSL_Flush(h2->vsl, 0);
+	h2->vsl->wid = h2->sess->vxid;
+	h2->htc->rfd = &h2->sess->fd;
+	h2->rxthr = pthread_self();
+}
+
 static struct h2_sess *
-h2_init_sess(struct sess *sp,
-    struct h2_sess *h2s, struct req *srq, struct h2h_decode *decode)
+h2_init_sess(struct sess *sp, struct req *srq)
 {
 	uintptr_t *up;
 	struct h2_sess *h2;
@@ -110,24 +133,21 @@ h2_init_sess(struct sess *sp,
 	if (srq == NULL)
 		srq = Req_New(sp);
 	AN(srq);
-	h2 = h2s;
+	ALLOC_OBJ(h2, H2_SESS_MAGIC);
 	AN(h2);
-	INIT_OBJ(h2, H2_SESS_MAGIC);
-	h2->srq = srq;
-	h2->htc = srq->htc;
-	h2->ws = srq->ws;
-	h2->vsl = srq->vsl;
-	VSL_Flush(h2->vsl, 0);
-	h2->vsl->wid = sp->vxid;
-	h2->htc->rfd = &sp->fd;
 	h2->sess = sp;
-	h2->rxthr = pthread_self();
+	h2_sess_srq(h2, srq);
 	PTOK(pthread_cond_init(h2->winupd_cond, NULL));
 	VTAILQ_INIT(&h2->streams);
 	VTAILQ_INIT(&h2->txqueue);
+	ALLOC_OBJ(h2->tx, H2_TX_MAGIC);
+	AN(h2->tx);
+	PTOK(pthread_cond_init(h2->tx->cond, NULL));
+	h2->tx->gen = 1;
 	h2_local_settings(&h2->local_settings);
 	h2->remote_settings = H2_proto_settings;
-	h2->decode = decode;
+	ALLOC_OBJ(h2->decode, H2H_DECODE_MAGIC);
+	AN(h2->decode);
 
 	h2->rapid_reset = cache_param->h2_rapid_reset;
 	h2->rapid_reset_limit = cache_param->h2_rapid_reset_limit;
@@ -138,12 +158,45 @@ h2_init_sess(struct sess *sp,
 	AZ(isnan(h2->last_rst));
 
 	AZ(VHT_Init(h2->dectbl, h2->local_settings.header_table_size));
+	h2->enc_size = cache_param->h2_encoder_table_size;
+	h2->enc_max = H2_proto_settings.header_table_size;
+	if (h2->enc_size > 0) {
+		/* Until the peer tells us otherwise, stay within its default */
+		AZ(VHT_Init(h2->enctbl, h2->enc_size));
+		AZ(VHT_SetMaxTableSize(h2->enctbl,
+		    vmin(h2->enc_size, h2->enc_max)));
+	}
 
 	*up = (uintptr_t)h2;
 
 	return (h2);
 }
 
+/* Does not need a worker, the waiter can call it */
+
+static void
+h2_fini_sess(struct h2_sess **h2p)
+{
+	struct h2_sess *h2;
+
+	TAKE_OBJ_NOTNULL(h2, h2p, H2_SESS_MAGIC);
+	AZ(h2->refcnt);
+	AZ(h2->srq);
+	assert(VTAILQ_EMPTY(&h2->streams));
+
+	VHT_Fini(h2->dectbl);
+	if (h2->enc_size > 0)
+		VHT_Fini(h2->enctbl);
+	PTOK(pthread_cond_destroy(h2->winupd_cond));
+	CHECK_OBJ_NOTNULL(h2->tx, H2_TX_MAGIC);
+	AZ(h2->tx->writing);
+	AZ(h2->tx->batch[h2->tx->gen & 1].nframe);
+	PTOK(pthread_cond_destroy(h2->tx->cond));
+	FREE_OBJ(h2->tx);
+	FREE_OBJ(h2->decode);
+	FREE_OBJ(h2);
+}
+
 static void
 h2_del_sess(struct worker *wrk, struct h2_sess *h2, stream_close_t reason)
 {
@@ -151,15 +204,12 @@ h2_del_sess(struct worker *wrk, struct h2_sess *h2, stream_close_t reason)
 	struct req *req;
 
 	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
-	AZ(h2->refcnt);
-	assert(VTAILQ_EMPTY(&h2->streams));
 	AN(reason);
 
-	VHT_Fini(h2->dectbl);
-	PTOK(pthread_cond_destroy(h2->winupd_cond));
 	TAKE_OBJ_NOTNULL(req, &h2->srq, REQ_MAGIC);
 	assert(!WS_IsReserved(req->ws));
 	sp = h2->sess;
+	h2_fini_sess(&h2);
 	Req_Cleanup(sp, wrk, req);
 	Req_Release(req);
 	SES_Delete(sp, reason, NAN);
@@ -339,70 +389,157 @@ H2_OU_Sess(struct worker *wrk, struct sess *sp, struct req *req)
 	SES_SetTransport(wrk, sp, req, &HTTP2_transport);
 }
 
-static void v_matchproto_(task_func_t)
-h2_new_session(struct worker *wrk, void *arg)
+/**********************************************************************
+ * A session with no streams left goes to the waiter, like an HTTP/1
+ * session between requests, rather than keep a worker thread sitting
+ * in h2_rxframe().  The session request and stream 0 are given back,
+ * the HPACK tables, settings and counters stay in struct h2_sess.
+ * Whatever the waiter reports, a worker is scheduled to deal with it,
+ * so that a timed out session still gets its GOAWAY.
+ */
+
+static task_func_t h2_unwait;
+
+static int
+h2_idle(const struct h2_sess *h2)
+{
+
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	ASSERT_RXTHR(h2);
+	if (h2->error != NULL || h2->goaway || h2->new_req != NULL)
+		return (0);
+	/* Only stream 0 left */
+	if (h2->refcnt != 1 || h2->open_streams != 0)
+		return (0);
+	assert(VTAILQ_FIRST(&h2->streams) == h2->req0);
+	if (h2->htc->rxbuf_e != h2->htc->rxbuf_b ||
+	    h2->htc->pipeline_b != NULL)
+		return (0);
+	return (h2->sess->t_idle + SESS_TMO(h2->sess, timeout_linger) <
+	    VTIM_real());
+}
+
+static void v_matchproto_(waiter_handle_f)
+h2_sess_handle(struct waited *wp, enum wait_event ev, vtim_real now)
 {
-	struct req *req;
 	struct sess *sp;
-	struct h2_sess h2s;
 	struct h2_sess *h2;
-	struct h2_req *r2, *r22;
-	int again;
-	uint8_t settings[48];
-	struct h2h_decode decode;
-	size_t l;
+	struct pool_task *tp;
 
-	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
-	CAST_OBJ_NOTNULL(req, arg, REQ_MAGIC);
-	sp = req->sp;
+	CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+	CAST_OBJ_NOTNULL(h2, wp->priv1, H2_SESS_MAGIC);
+	assert(wp->priv2 == &HTTP2_transport);
+	sp = h2->sess;
 	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+	assert(WS_Reservation(sp->ws) == wp);
+	FINI_OBJ(wp);
+
+	switch (ev) {
+	case WAITER_ACTION:
+		break;
+	case WAITER_TIMEOUT:
+		h2->error = H2CE_NO_ERROR;
+		break;
+	case WAITER_REMCLOSE:
+		h2->error = H2CE_NO_ERROR;
+		h2->goaway = 1;		/* Nobody left to tell */
+		break;
+	case WAITER_CLOSE:
+		WRONG("Should not see WAITER_CLOSE on client side");
+		break;
+	default:
+		WRONG("Wrong event in h2_sess_handle");
+	}
 
-	if (wrk->wpriv->vcl)
-		VCL_Rel(&wrk->wpriv->vcl);
-
-	assert(req->transport == &HTTP2_transport);
+	/* h2_park() made room for this */
+	WS_Release(sp->ws, 0);
+	assert(sizeof *tp <= WS_ReserveSize(sp->ws, sizeof *tp));
+	tp = WS_Reservation(sp->ws);
+	tp->func = h2_unwait;
+	tp->priv = h2;
+	if (Pool_Task(sp->pool, tp, TASK_QUEUE_REQ)) {
+		WS_Release(sp->ws, 0);
+		h2_fini_sess(&h2);
+		SES_Delete(sp, SC_OVERLOAD, now);
+	}
+}
 
-	assert (req->err_code == H2_PU_MARKER || req->err_code == H2_OU_MARKER);
+static void
+h2_park(struct worker *wrk, struct h2_sess *h2)
+{
+	struct sess *sp;
+	struct req *srq;
+	struct waited *wp;
+	vtim_real t_idle;
+	unsigned u;
 
-	h2 = h2_init_sess(sp, &h2s,
-	    req->err_code == H2_PU_MARKER ? req : NULL, &decode);
-	h2->req0 = h2_new_req(h2, 0, NULL);
-	AZ(h2->htc->priv);
-	h2->htc->priv = h2;
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(h2, H2_SESS_MAGIC);
+	sp = h2->sess;
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
 
-	AZ(wrk->vsl);
-	wrk->vsl = h2->vsl;
+	VSLb(h2->vsl, SLT_Debug, "H2: idle, to the waiter");
+	/* Releasing stream 0 is no activity */
+	t_idle = sp->t_idle;
+	h2_del_req(wrk, h2->req0);
+	h2->req0 = NULL;
+	sp->t_idle = t_idle;
+	AZ(h2->refcnt);
 
-	if (req->err_code == H2_OU_MARKER && !h2_ou_session(wrk, h2, req)) {
-		assert(h2->refcnt == 1);
-		h2_del_req(wrk, h2->req0);
-		h2_del_sess(wrk, h2, SC_RX_JUNK);
-		wrk->vsl = NULL;
+	/* Keep the session transaction open across the release */
+	TAKE_OBJ_NOTNULL(srq, &h2->srq, REQ_MAGIC);
+	h2->acct = srq->acct;
+	memset(&srq->acct, 0, sizeof srq->acct);
+	WS_Release(srq->ws, 0);
+	srq->htc->priv = NULL;
+	VSL_Flush(srq->vsl, 0);
+	srq->vsl->wid = NO_VXID;
+	Req_Release(srq);
+	h2->htc = NULL;
+	h2->ws = NULL;
+	h2->vsl = NULL;
+	h2->cond = NULL;
+	wrk->vsl = NULL;
+	THR_SetRequest(NULL);
+	wrk->stats->sess_herd++;
+
+	/* As SES_Wait(), with our own handler */
+	VTCP_nonblocking(sp->fd);
+	u = WS_ReserveAll(sp->ws);
+	if (u < sizeof *wp || u < sizeof (struct pool_task)) {
+		WS_MarkOverflow(sp->ws);
+		WS_Release(sp->ws, 0);
+		h2_fini_sess(&h2);
+		SES_Delete(sp, SC_OVERLOAD, NAN);
 		return;
 	}
-	assert(HTC_S_COMPLETE == H2_prism_complete(h2->htc));
-	HTC_RxPipeline(h2->htc, h2->htc->rxbuf_b + sizeof(H2_prism));
-	HTC_RxInit(h2->htc, h2->ws);
-	AN(WS_Reservation(h2->ws));
-	VSLb(h2->vsl, SLT_Debug, "H2: Got pu PRISM");
-
-	THR_SetRequest(h2->srq);
-	AN(WS_Reservation(h2->ws));
+	wp = WS_Reservation(sp->ws);
+	INIT_OBJ(wp, WAITED_MAGIC);
+	wp->fd = sp->fd;
+	wp->priv1 = h2;
+	wp->priv2 = &HTTP2_transport;
+	wp->idle = sp->t_idle;
+	wp->func = h2_sess_handle;
+	wp->tmo = SESS_TMO(sp, timeout_idle);
+	if (Wait_Enter(sp->pool->waiter, wp)) {
+		WS_Release(sp->ws, 0);
+		h2_fini_sess(&h2);
+		SES_Delete(sp, SC_PIPE_OVERFLOW, NAN);
+	}
+}
 
-	l = h2_enc_settings(&h2->local_settings, settings, sizeof (settings));
-	AN(WS_Reservation(h2->ws));
-	H2_Send_Get(wrk, h2, h2->req0);
-	AN(WS_Reservation(h2->ws));
-	H2_Send_Frame(wrk, h2,
-	    H2_F_SETTINGS, H2FF_NONE, l, 0, settings);
-	AN(WS_Reservation(h2->ws));
-	H2_Send_Rel(h2, h2->req0);
-	AN(WS_Reservation(h2->ws));
+/**********************************************************************
+ * Receive frames until the session fails, ends or goes idle, and
+ * clean up after the first two.
+ */
 
-	/* and off we go... */
-	h2->cond = &wrk->cond;
+static void
+h2_sess_run(struct worker *wrk, struct h2_sess *h2)
+{
+	struct h2_req *r2, *r22;
+	int again;
 
-	while (h2_rxframe(wrk, h2)) {
+	while (h2->error == NULL && h2_rxframe(wrk, h2)) {
 		HTC_RxInit(h2->htc, h2->ws);
 		if (WS_Overflowed(h2->ws)) {
 			VSLb(h2->vsl, SLT_Debug, "H2: Empty Rx Workspace");
@@ -410,12 +547,18 @@ h2_new_session(struct worker *wrk, void *arg)
 			break;
 		}
 		AN(WS_Reservation(h2->ws));
+		if (h2_idle(h2)) {
+			h2_park(wrk, h2);
+			return;
+		}
 	}
 
 	AN(h2->error);
 
 	/* Delete all idle streams */
 	VSLb(h2->vsl, SLT_Debug, "H2 CLEANUP %s", h2->error->name);
+	VSLb(h2->vsl, SLT_Debug, "H2 SCHED waits %ju reordered %ju",
+	    (uintmax_t)h2->sched_waits, (uintmax_t)h2->sched_reordered);
 	Lck_Lock(&h2->sess->mtx);
 	VTAILQ_FOREACH(r2, &h2->streams, list) {
 		if (r2->error == 0)
@@ -449,6 +592,103 @@ h2_new_session(struct worker *wrk, void *arg)
 	wrk->vsl = NULL;
 }
 
+static void v_matchproto_(task_func_t)
+h2_unwait(struct worker *wrk, void *arg)
+{
+	struct h2_sess *h2;
+	struct sess *sp;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(h2, arg, H2_SESS_MAGIC);
+	sp = h2->sess;
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+
+	/* The pool_task was on the session workspace */
+	WS_Release(sp->ws, 0);
+
+	if (wrk->wpriv->vcl)
+		VCL_Rel(&wrk->wpriv->vcl);
+
+	h2_sess_srq(h2, Req_New(sp));
+	h2->srq->acct = h2->acct;
+	memset(&h2->acct, 0, sizeof h2->acct);
+	AZ(h2->htc->priv);
+	h2->htc->priv = h2;
+	h2->req0 = h2_new_req(h2, 0, NULL);
+	AZ(wrk->vsl);
+	wrk->vsl = h2->vsl;
+	THR_SetRequest(h2->srq);
+	h2->cond = &wrk->cond;
+
+	VSLb(h2->vsl, SLT_Debug, "H2: back from the waiter");
+	/* Timed out or closed, h2_sess_run() only cleans up */
+	if (h2->error != NULL)
+		h2_tx_goaway(wrk, h2, h2->error);
+	else
+		HTC_RxInit(h2->htc, h2->ws);
+	h2_sess_run(wrk, h2);
+}
+
+static void v_matchproto_(task_func_t)
+h2_new_session(struct worker *wrk, void *arg)
+{
+	struct req *req;
+	struct sess *sp;
+	struct h2_sess *h2;
+	uint8_t settings[48];
+	size_t l;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(req, arg, REQ_MAGIC);
+	sp = req->sp;
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+
+	if (wrk->wpriv->vcl)
+		VCL_Rel(&wrk->wpriv->vcl);
+
+	assert(req->transport == &HTTP2_transport);
+
+	assert (req->err_code == H2_PU_MARKER || req->err_code == H2_OU_MARKER);
+
+	h2 = h2_init_sess(sp, req->err_code == H2_PU_MARKER ? req : NULL);
+	h2->req0 = h2_new_req(h2, 0, NULL);
+	AZ(h2->htc->priv);
+	h2->htc->priv = h2;
+
+	AZ(wrk->vsl);
+	wrk->vsl = h2->vsl;
+
+	if (req->err_code == H2_OU_MARKER && !h2_ou_session(wrk, h2, req)) {
+		assert(h2->refcnt == 1);
+		h2_del_req(wrk, h2->req0);
+		h2_del_sess(wrk, h2, SC_RX_JUNK);
+		wrk->vsl = NULL;
+		return;
+	}
+	assert(HTC_S_COMPLETE == H2_prism_complete(h2->htc));
+	HTC_RxPipeline(h2->htc, h2->htc->rxbuf_b + sizeof(H2_prism));
+	HTC_RxInit(h2->htc, h2->ws);
+	AN(WS_Reservation(h2->ws));
+	VSLb(h2->vsl, SLT_Debug, "H2: Got pu PRISM");
+
+	THR_SetRequest(h2->srq);
+	AN(WS_Reservation(h2->ws));
+
+	l = h2_enc_settings(&h2->local_settings, settings, sizeof (settings));
+	AN(WS_Reservation(h2->ws));
+	H2_Send_Get(wrk, h2, h2->req0);
+	AN(WS_Reservation(h2->ws));
+	H2_Send_Frame(wrk, h2,
+	    H2_F_SETTINGS, H2FF_NONE, l, 0, settings);
+	AN(WS_Reservation(h2->ws));
+	H2_Send_Rel(h2, h2->req0);
+	AN(WS_Reservation(h2->ws));
+
+	/* and off we go... */
+	h2->cond = &wrk->cond;
+	h2_sess_run(wrk, h2);
+}
+
 static int v_matchproto_(vtr_poll_f)
 h2_poll(struct req *req)
 {
@@ -63,6 +63,8 @@ struct listen_arg {
 	VTAILQ_HEAD(,listen_sock)	socks;
 	const struct transport		*transport;
 	const struct uds_perms		*perms;
+	unsigned			reuseport;
+	unsigned			reuseport_cpu;
 };
 
 struct uds_perms {
@@ -73,6 +75,8 @@ struct uds_perms {
 	gid_t		gid;
 };
 
+#define MAC_MAX_REUSEPORT	256
+
 static VTAILQ_HEAD(,listen_arg) listen_args =
     VTAILQ_HEAD_INITIALIZER(listen_args);
 
@@ -87,21 +91,36 @@ mac_opensocket(struct listen_sock *ls)
 {
 	int fail;
 	const char *err;
+#ifdef SO_INCOMING_CPU
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int cpu;
+#endif
 
 	CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
 	if (ls->sock > 0) {
 		MCH_Fd_Inherit(ls->sock, NULL);
 		closefd(&ls->sock);
 	}
-	if (!ls->uds)
-		ls->sock = VTCP_bind(ls->addr, NULL);
-	else
+	if (ls->uds)
 		ls->sock = VUS_resolver(ls->endpoint, mac_vus_bind, NULL, &err);
+	else if (ls->reuseport_n > 0)
+		ls->sock = VTCP_bind_reuseport(ls->addr, NULL);
+	else
+		ls->sock = VTCP_bind(ls->addr, NULL);
 	fail = errno;
 	if (ls->sock < 0) {
 		AN(fail);
 		return (fail);
 	}
+#ifdef SO_INCOMING_CPU
+	if (ls->reuseport_cpu) {
+		/* A hint for the kernel to pick this socket for
+		 * connections arriving on this CPU */
+		cpu = (int)(ls->reuseport_idx % vmax(ncpu, 1L));
+		(void)setsockopt(ls->sock, SOL_SOCKET, SO_INCOMING_CPU,
+		    &cpu, sizeof cpu);
+	}
+#endif
 	if (ls->perms != NULL) {
 		CHECK_OBJ(ls->perms, UDS_PERMS_MAGIC);
 		assert(ls->uds);
@@ -144,7 +163,8 @@ MAC_reopen_sockets(void)
 /*--------------------------------------------------------------------*/
 
 static struct listen_sock *
-mk_listen_sock(const struct listen_arg *la, const struct suckaddr *sa)
+mk_listen_sock(const struct listen_arg *la, const struct suckaddr *sa,
+    unsigned idx)
 {
 	struct listen_sock *ls;
 	int fail;
@@ -159,6 +179,9 @@ mk_listen_sock(const struct listen_arg *la, const struct suckaddr *sa)
 	ls->transport = la->transport;
 	ls->perms = la->perms;
 	ls->uds = VUS_is(la->endpoint);
+	ls->reuseport_n = la->reuseport;
+	ls->reuseport_idx = idx;
+	ls->reuseport_cpu = la->reuseport_cpu;
 	VJ_master(JAIL_MASTER_PRIVPORT);
 	fail = mac_opensocket(ls);
 	VJ_master(JAIL_MASTER_LOW);
@@ -178,9 +201,10 @@ static int v_matchproto_(vss_resolved_f)
 mac_tcp(void *priv, const struct suckaddr *sa)
 {
 	struct listen_arg *la;
-	struct listen_sock *ls;
+	struct listen_sock *ls, *ls2;
 	char abuf[VTCP_ADDRBUFSIZE], pbuf[VTCP_PORTBUFSIZE];
 	char nbuf[VTCP_ADDRBUFSIZE+VTCP_PORTBUFSIZE+2];
+	unsigned u;
 
 	CAST_OBJ_NOTNULL(la, priv, LISTEN_ARG_MAGIC);
 
@@ -189,7 +213,7 @@ mac_tcp(void *priv, const struct suckaddr *sa)
 			ARGV_ERR("-a arguments %s and %s have same address\n",
 			    ls->endpoint, la->endpoint);
 	}
-	ls = mk_listen_sock(la, sa);
+	ls = mk_listen_sock(la, sa, 0);
 	if (ls == NULL)
 		return (0);
 	AZ(ls->uds);
@@ -211,6 +235,17 @@ mac_tcp(void *priv, const struct suckaddr *sa)
 	}
 	VTAILQ_INSERT_TAIL(&la->socks, ls, arglist);
 	VTAILQ_INSERT_TAIL(&heritage.socks, ls, list);
+
+	/* The siblings bind to the port the first one got */
+	for (u = 1; u < la->reuseport; u++) {
+		ls2 = mk_listen_sock(la, ls->addr, u);
+		if (ls2 == NULL)
+			ARGV_ERR("Could not get reuseport socket %s\n",
+			    ls->endpoint);
+		REPLACE(ls2->endpoint, ls->endpoint);
+		VTAILQ_INSERT_TAIL(&la->socks, ls2, arglist);
+		VTAILQ_INSERT_TAIL(&heritage.socks, ls2, list);
+	}
 	return (0);
 }
 
@@ -228,7 +263,7 @@ mac_uds(void *priv, const struct sockaddr_un *uds)
 			ARGV_ERR("-a arguments %s and %s have same address\n",
 			    ls->endpoint, la->endpoint);
 	}
-	ls = mk_listen_sock(la, bogo_ip);
+	ls = mk_listen_sock(la, bogo_ip, 0);
 	if (ls == NULL)
 		return (0);
 	AN(ls->uds);
@@ -289,16 +324,49 @@ MAC_Arg(const char *spec)
 				ARGV_ERR("Unknown protocol '%s'\n", av[i]);
 			continue;
 		}
-		if (la->endpoint[0] != '/')
-			ARGV_ERR("Invalid sub-arg %s"
-			    " in -a\n", av[i]);
-
 		val = eq + 1;
 		len = eq - av[i];
 		assert(len >= 0);
 		if (len == 0)
 			ARGV_ERR("Invalid sub-arg %s in -a\n", av[i]);
 
+		if (strncmp(av[i], "reuseport", len) == 0) {
+			unsigned long u;
+			char *p;
+
+			if (VUS_is(la->endpoint))
+				ARGV_ERR("Invalid sub-arg %s"
+				    " in -a\n", av[i]);
+			if (la->reuseport != 0)
+				ARGV_ERR("Too many reuseport sub-args"
+				    " in -a (%s)\n", av[i]);
+			errno = 0;
+			u = strtoul(val, &p, 10);
+			if (*val == '\0' || *p != '\0' || errno ||
+			    u < 1 || u > MAC_MAX_REUSEPORT)
+				ARGV_ERR("Invalid reuseport sub-arg %s"
+				    " in -a (must be 1..%d)\n", val,
+				    MAC_MAX_REUSEPORT);
+			la->reuseport = u;
+			continue;
+		}
+
+		if (strncmp(av[i], "reuseport_cpu", len) == 0) {
+			if (VUS_is(la->endpoint))
+				ARGV_ERR("Invalid sub-arg %s"
+				    " in -a\n", av[i]);
+			if (!strcmp(val, "on"))
+				la->reuseport_cpu = 1;
+			else if (strcmp(val, "off"))
+				ARGV_ERR("Invalid reuseport_cpu sub-arg %s"
+				    " in -a (must be on or off)\n", val);
+			continue;
+		}
+
+		if (la->endpoint[0] != '/')
+			ARGV_ERR("Invalid sub-arg %s"
+			    " in -a\n", av[i]);
+
 		if (strncmp(av[i], "user", len) == 0) {
 			if (pwd != NULL)
 				ARGV_ERR("Too many user sub-args in -a (%s)\n",
@@ -346,6 +414,9 @@ MAC_Arg(const char *spec)
 		ARGV_ERR("Invalid sub-arg %s in -a\n", av[i]);
 	}
 
+	if (la->reuseport_cpu && la->reuseport == 0)
+		ARGV_ERR("reuseport_cpu sub-arg requires reuseport in -a\n");
+
 	if (xp == NULL)
 		xp = XPORT_Find("http");
 	AN(xp);
@@ -35,6 +35,7 @@
 
 #include "config.h"
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,6 +44,7 @@
 #include "mgt/mgt.h"
 #include "common/heritage.h"
 #include "vcli_serve.h"
+#include "vnum.h"
 
 #include "storage/storage.h"
 
@@ -250,6 +252,57 @@ STV_Config_Final(void)
 	STV_Config(TRANSIENT_STORAGE "=default");
 }
 
+/*--------------------------------------------------------------------
+ * Eviction options are not specific to any kind of storage, so we pick
+ * them out of the argument list before it is handed to ->init.
+ */
+
+#define LRU_SHARDS_MAX	256
+
+static const struct choice lru_choice[] = {
+	{ "lru",		&lru_policy_lru },
+	{ "clock",		&lru_policy_clock },
+	{ "s3fifo",		&lru_policy_s3fifo },
+	{ NULL,			NULL }
+};
+
+static int
+stv_lru_args(struct stevedore *stv, int ac, char **av)
+{
+	const char *p, *e;
+	ssize_t sz;
+	int i, n;
+
+	for (i = n = 0; i < ac; i++) {
+		p = av[i];
+		if (!strncmp(p, "lru_policy=", 11)) {
+			stv->lru_policy = MGT_Pick(lru_choice, p + 11,
+			    "lru_policy");
+			continue;
+		}
+		if (!strncmp(p, "lru_admit=", 10)) {
+			sz = VNUM_uint(p + 10, NULL, &e);
+			if (sz < 0 || sz > INT_MAX || *e != '\0')
+				ARGV_ERR("(-s %s) invalid lru_admit \"%s\"\n",
+				    stv->name, p + 10);
+			stv->lru_admit = (unsigned)sz;
+			continue;
+		}
+		if (strncmp(p, "lru_shards=", 11)) {
+			av[n++] = av[i];
+			continue;
+		}
+		p += 11;
+		sz = VNUM_uint(p, NULL, &e);
+		if (sz < 1 || sz > LRU_SHARDS_MAX || *e != '\0')
+			ARGV_ERR("(-s %s) lru_shards must be 1...%d\n",
+			    stv->name, LRU_SHARDS_MAX);
+		stv->lru_shards = (unsigned)sz;
+	}
+	av[n] = NULL;
+	return (n);
+}
+
 /*--------------------------------------------------------------------
  * Initialize configured stevedores in the worker process
  */
@@ -290,6 +343,7 @@ STV_Init(void)
 
 		stv->ident = ident;
 		stv->av = av;
+		ac = stv_lru_args(stv, ac, av);
 
 		if (stv->init != NULL)
 			stv->init(stv, ac, av);
@@ -100,6 +100,22 @@ STV_NewObject(struct worker *wrk, struct objcore *oc,
 	return (1);
 }
 
+/*-------------------------------------------------------------------
+ * Ask the admission filter of a stevedore if a new object may push
+ * existing objects out.  Unless count is set, the filter is not told.
+ */
+
+int
+STV_Admit(const struct stevedore *stv, const uint8_t *digest, int count)
+{
+
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	AN(digest);
+	if (stv->lru == NULL)
+		return (1);
+	return (LRU_Admit(stv->lru, digest, count));
+}
+
 /*-------------------------------------------------------------------*/
 
 struct stv_buffer {
@@ -38,6 +38,7 @@ struct sess;
 struct objcore;
 struct worker;
 struct lru;
+struct lru_policy;
 struct vsl_log;
 struct vfp_ctx;
 struct obj_methods;
@@ -69,6 +70,7 @@ struct storage;
 typedef struct object *sml_getobj_f(struct worker *, struct objcore *);
 typedef struct storage *sml_alloc_f(const struct stevedore *, size_t size);
 typedef void sml_free_f(struct storage *);
+typedef int sml_getfd_f(const struct storage *, int *fd, off_t *off);
 
 /* Prototypes for VCL variable responders */
 #define VRTSTVVAR(nm,vt,ct,def) \
@@ -101,11 +103,15 @@ struct stevedore {
 	sml_alloc_f			*sml_alloc;
 	sml_free_f			*sml_free;
 	sml_getobj_f			*sml_getobj;
+	sml_getfd_f			*sml_getfd;
 
 	const struct obj_methods	*methods;
 
 	/* Only if LRU is used */
 	struct lru			*lru;
+	unsigned			lru_shards;
+	const struct lru_policy		*lru_policy;
+	unsigned			lru_admit;
 
 #define VRTSTVVAR(nm, vtype, ctype, dval) stv_var_##nm *var_##nm;
 #include "tbl/vrt_stv_var.h"
@@ -136,12 +142,17 @@ uintmax_t STV_FileSize(int fd, const char *size, unsigned *granularity,
     const char *ctx);
 
 /*--------------------------------------------------------------------*/
-struct lru *LRU_Alloc(void);
+struct lru *LRU_Alloc(const struct stevedore *);
 void LRU_Free(struct lru **);
 void LRU_Add(struct objcore *, vtim_real now);
 void LRU_Remove(struct objcore *);
 int LRU_NukeOne(struct worker *, struct lru *);
 void LRU_Touch(struct worker *, struct objcore *, vtim_real now);
+int LRU_Admit(struct lru *, const uint8_t *digest, int count);
+
+extern const struct lru_policy lru_policy_lru;
+extern const struct lru_policy lru_policy_clock;
+extern const struct lru_policy lru_policy_s3fifo;
 
 /*--------------------------------------------------------------------*/
 extern const struct stevedore smu_stevedore;
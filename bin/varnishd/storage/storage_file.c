@@ -411,7 +411,7 @@ smf_open(struct stevedore *st)
 	off_t sum = 0;
 
 	ASSERT_CLI();
-	st->lru = LRU_Alloc();
+	st->lru = LRU_Alloc(st);
 	if (lck_smf == NULL)
 		lck_smf = Lck_CreateClass(NULL, "smf");
 	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
@@ -498,6 +498,22 @@ smf_free(struct storage *s)
 
 /*--------------------------------------------------------------------*/
 
+static int v_matchproto_(sml_getfd_f)
+smf_getfd(const struct storage *s, int *fd, off_t *off)
+{
+	struct smf *smf;
+
+	CHECK_OBJ_NOTNULL(s, STORAGE_MAGIC);
+	CAST_OBJ_NOTNULL(smf, s->priv, SMF_MAGIC);
+	CHECK_OBJ_NOTNULL(smf->sc, SMF_SC_MAGIC);
+	assert(s->ptr == smf->ptr);
+	*fd = smf->sc->fd;
+	*off = smf->offset;
+	return (0);
+}
+
+/*--------------------------------------------------------------------*/
+
 const struct stevedore smf_stevedore = {
 	.magic		=	STEVEDORE_MAGIC,
 	.name		=	"file",
@@ -505,6 +521,7 @@ const struct stevedore smf_stevedore = {
 	.open		=	smf_open,
 	.sml_alloc	=	smf_alloc,
 	.sml_free	=	smf_free,
+	.sml_getfd	=	smf_getfd,
 	.allocobj	=	SML_allocobj,
 	.panic		=	SML_panic,
 	.methods	=	&SML_methods,
@@ -38,14 +38,34 @@
 #include "cache/cache_objhead.h"
 
 #include "storage/storage.h"
+#include "storage/storage_lru.h"
+
+#include "VSC_lru.h"
+#include "vtim.h"
+
+/*
+ * The LRU list is split into a number of shards, each with its own lock,
+ * and an objcore always lives on the shard picked by its address.
+ * Nuking goes for the shard whose head is the oldest, so eviction order
+ * is only approximately global.
+ */
 
 struct lru {
 	unsigned		magic;
 #define LRU_MAGIC		0x3fec7bb0
-	VTAILQ_HEAD(,objcore)	lru_head;
-	struct lock		mtx;
+	const struct lru_policy	*policy;
+	unsigned		nshard;
+	struct lru_shard	*shard;
+	struct lru_sketch	*sketch;
+	vtim_real		t_nuke;
 };
 
+/*
+ * The admission filter only kicks in if we had to nuke within the
+ * last LRU_ADMIT_WINDOW seconds.
+ */
+#define LRU_ADMIT_WINDOW	1.0
+
 static struct lru *
 lru_get(const struct objcore *oc)
 {
@@ -55,15 +75,136 @@ lru_get(const struct objcore *oc)
 	return (oc->stobj->stevedore->lru);
 }
 
+static struct lru_shard *
+lru_shard(const struct lru *lru, const struct objcore *oc)
+{
+	struct lru_shard *sh;
+
+	sh = &lru->shard[((uintptr_t)oc / sizeof *oc) % lru->nshard];
+	CHECK_OBJ_NOTNULL(sh, LRU_SHARD_MAGIC);
+	return (sh);
+}
+
+/* Shard lock held, must be called whenever the head may have changed */
+
+static void
+lru_oldest(struct lru_shard *sh)
+{
+	struct objcore *oc;
+
+	Lck_AssertHeld(&sh->mtx);
+	oc = VTAILQ_FIRST(&sh->lru_head);
+	sh->oldest = (oc == NULL ? INFINITY : oc->last_lru);
+}
+
+/*--------------------------------------------------------------------
+ * The classic policy: touched objects move to the tail, nuke from the
+ * head.
+ */
+
+static void v_matchproto_(lru_add_f)
+lru_lru_add(struct lru_shard *sh, struct objcore *oc)
+{
+
+	VTAILQ_INSERT_TAIL(&sh->lru_head, oc, lru_list);
+}
+
+static void v_matchproto_(lru_remove_f)
+lru_lru_remove(struct lru_shard *sh, struct objcore *oc)
+{
+
+	VTAILQ_REMOVE(&sh->lru_head, oc, lru_list);
+}
+
+static void v_matchproto_(lru_touch_f)
+lru_lru_touch(struct lru_shard *sh, struct objcore *oc, vtim_real now)
+{
+
+	/*
+	 * To avoid the exphdl->mtx becoming a hotspot, we only
+	 * attempt to move objects if they have not been moved
+	 * recently and if the lock is available.  This optimization
+	 * obviously leaves the LRU list imperfectly sorted.
+	 */
+
+	if (now - oc->last_lru < cache_param->lru_interval)
+		return;
+
+	if (Lck_Trylock(&sh->mtx)) {
+		sh->stats->c_busy++;
+		return;
+	}
+
+	if (!isnan(oc->last_lru)) {
+		VTAILQ_REMOVE(&sh->lru_head, oc, lru_list);
+		VTAILQ_INSERT_TAIL(&sh->lru_head, oc, lru_list);
+		VSC_C_main->n_lru_moved++;
+		sh->stats->c_moved++;
+		oc->last_lru = now;
+		lru_oldest(sh);
+	}
+	Lck_Unlock(&sh->mtx);
+}
+
+static struct objcore * v_matchproto_(lru_nuke_f)
+lru_lru_nuke(struct worker *wrk, struct lru_shard *sh, vtim_real now)
+{
+	struct objcore *oc;
+
+	(void)now;
+
+	/* Find the first currently unused object on the LRU.  */
+	VTAILQ_FOREACH(oc, &sh->lru_head, lru_list) {
+		if (LRU_Cand(wrk, oc)) {
+			VTAILQ_REMOVE(&sh->lru_head, oc, lru_list);
+			VTAILQ_INSERT_TAIL(&sh->lru_head, oc, lru_list);
+			break;
+		}
+	}
+	return (oc);
+}
+
+const struct lru_policy lru_policy_lru = {
+	.magic	=	LRU_POLICY_MAGIC,
+	.name	=	"lru",
+	.add	=	lru_lru_add,
+	.remove	=	lru_lru_remove,
+	.touch	=	lru_lru_touch,
+	.nuke	=	lru_lru_nuke,
+};
+
+/*--------------------------------------------------------------------*/
+
 struct lru *
-LRU_Alloc(void)
+LRU_Alloc(const struct stevedore *stv)
 {
 	struct lru *lru;
+	struct lru_shard *sh;
+	unsigned u;
 
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
 	ALLOC_OBJ(lru, LRU_MAGIC);
 	AN(lru);
-	VTAILQ_INIT(&lru->lru_head);
-	Lck_New(&lru->mtx, lck_lru);
+	lru->policy = stv->lru_policy;
+	if (lru->policy == NULL)
+		lru->policy = &lru_policy_lru;
+	CHECK_OBJ(lru->policy, LRU_POLICY_MAGIC);
+	lru->nshard = stv->lru_shards > 0 ? stv->lru_shards : 1;
+	lru->shard = calloc(lru->nshard, sizeof *lru->shard);
+	AN(lru->shard);
+	for (u = 0; u < lru->nshard; u++) {
+		sh = &lru->shard[u];
+		INIT_OBJ(sh, LRU_SHARD_MAGIC);
+		VTAILQ_INIT(&sh->lru_head);
+		Lck_New(&sh->mtx, lck_lru);
+		sh->oldest = INFINITY;
+		sh->stats = VSC_lru_New(NULL, &sh->vsc_seg, "%s.%u",
+		    stv->ident, u);
+		if (lru->policy->init != NULL)
+			lru->policy->init(sh);
+	}
+	if (stv->lru_admit > 0)
+		lru->sketch = LRU_SketchNew(stv->lru_admit);
 	return (lru);
 }
 
@@ -71,12 +212,24 @@ void
 LRU_Free(struct lru **pp)
 {
 	struct lru *lru;
+	struct lru_shard *sh;
+	unsigned u;
 
 	TAKE_OBJ_NOTNULL(lru, pp, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
-	AN(VTAILQ_EMPTY(&lru->lru_head));
-	Lck_Unlock(&lru->mtx);
-	Lck_Delete(&lru->mtx);
+	for (u = 0; u < lru->nshard; u++) {
+		sh = &lru->shard[u];
+		CHECK_OBJ(sh, LRU_SHARD_MAGIC);
+		Lck_Lock(&sh->mtx);
+		AN(VTAILQ_EMPTY(&sh->lru_head));
+		Lck_Unlock(&sh->mtx);
+		if (lru->policy->fini != NULL)
+			lru->policy->fini(sh);
+		Lck_Delete(&sh->mtx);
+		VSC_lru_Destroy(&sh->vsc_seg);
+	}
+	free(lru->shard);
+	if (lru->sketch != NULL)
+		LRU_SketchFree(&lru->sketch);
 	FREE_OBJ(lru);
 }
 
@@ -84,6 +237,7 @@ void
 LRU_Add(struct objcore *oc, vtim_real now)
 {
 	struct lru *lru;
+	struct lru_shard *sh;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
@@ -94,18 +248,23 @@ LRU_Add(struct objcore *oc, vtim_real now)
 	AN(isnan(oc->last_lru));
 	AZ(isnan(now));
 	lru = lru_get(oc);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
-	VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
+	sh = lru_shard(lru, oc);
+	Lck_Lock(&sh->mtx);
 	oc->last_lru = now;
+	oc->lru_freq = 0;
+	lru->policy->add(sh, oc);
 	AZ(isnan(oc->last_lru));
-	Lck_Unlock(&lru->mtx);
+	sh->stats->g_objects++;
+	sh->stats->c_insert++;
+	lru_oldest(sh);
+	Lck_Unlock(&sh->mtx);
 }
 
 void
 LRU_Remove(struct objcore *oc)
 {
 	struct lru *lru;
+	struct lru_shard *sh;
 
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 
@@ -114,18 +273,21 @@ LRU_Remove(struct objcore *oc)
 
 	AZ(oc->boc);
 	lru = lru_get(oc);
-	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
-	Lck_Lock(&lru->mtx);
+	sh = lru_shard(lru, oc);
+	Lck_Lock(&sh->mtx);
 	AZ(isnan(oc->last_lru));
-	VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
+	lru->policy->remove(sh, oc);
 	oc->last_lru = NAN;
-	Lck_Unlock(&lru->mtx);
+	sh->stats->g_objects--;
+	lru_oldest(sh);
+	Lck_Unlock(&sh->mtx);
 }
 
 void v_matchproto_(objtouch_f)
 LRU_Touch(struct worker *wrk, struct objcore *oc, vtim_real now)
 {
 	struct lru *lru;
+	struct lru_shard *sh;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
@@ -133,41 +295,98 @@ LRU_Touch(struct worker *wrk, struct objcore *oc, vtim_real now)
 	if (oc->flags & OC_F_PRIVATE || isnan(oc->last_lru))
 		return;
 
-	/*
-	 * To avoid the exphdl->mtx becoming a hotspot, we only
-	 * attempt to move objects if they have not been moved
-	 * recently and if the lock is available.  This optimization
-	 * obviously leaves the LRU list imperfectly sorted.
-	 */
+	lru = lru_get(oc);
+	sh = lru_shard(lru, oc);
+	sh->stats->c_hit++;	/* unlocked, approximate */
+	lru->policy->touch(sh, oc, now);
+	if (lru->sketch != NULL) {
+		CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+		(void)LRU_SketchAdd(lru->sketch, oc->objhead->digest);
+	}
+}
 
-	if (now - oc->last_lru < cache_param->lru_interval)
-		return;
+/*--------------------------------------------------------------------
+ * Decide if a new object may push out existing ones.  With count set,
+ * the call counts as a request for the object in the admission filter,
+ * otherwise the verdict is what it would be if it did.
+ *
+ * Returns: 1: admit, 0: don't;
+ */
+
+int
+LRU_Admit(struct lru *lru, const uint8_t *digest, int count)
+{
+	struct lru_shard *sh;
+	struct objcore *oc;
+	unsigned u, n, f, fv;
 
-	lru = lru_get(oc);
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
+	AN(digest);
+
+	if (lru->sketch == NULL)
+		return (1);
+	if (count)
+		f = LRU_SketchAdd(lru->sketch, digest);
+	else
+		f = LRU_SketchEstimate(lru->sketch, digest) + 1;
+	if (VTIM_real() - lru->t_nuke > LRU_ADMIT_WINDOW)
+		return (1);
+
+	n = 0;
+	for (u = 1; u < lru->nshard; u++)
+		if (lru->shard[u].oldest < lru->shard[n].oldest)
+			n = u;
+	sh = &lru->shard[n];
+	CHECK_OBJ(sh, LRU_SHARD_MAGIC);
+
+	/* The victim is whoever is at the head of the oldest shard */
+	fv = 0;
+	Lck_Lock(&sh->mtx);
+	oc = VTAILQ_FIRST(&sh->lru_head);
+	if (oc != NULL) {
+		CHECK_OBJ(oc, OBJCORE_MAGIC);
+		CHECK_OBJ_NOTNULL(oc->objhead, OBJHEAD_MAGIC);
+		fv = LRU_SketchEstimate(lru->sketch, oc->objhead->digest);
+	}
+	Lck_Unlock(&sh->mtx);
+	return (f > fv);
+}
 
-	if (Lck_Trylock(&lru->mtx))
-		return;
+/*--------------------------------------------------------------------
+ * Log and try to snipe a nuke candidate, for the eviction policies.
+ */
 
-	if (!isnan(oc->last_lru)) {
-		VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-		VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
-		VSC_C_main->n_lru_moved++;
-		oc->last_lru = now;
-	}
-	Lck_Unlock(&lru->mtx);
+int
+LRU_Cand(struct worker *wrk, struct objcore *oc)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	AZ(isnan(oc->last_lru));
+
+	VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
+	    oc, oc->flags, oc->refcnt);
+
+	return (HSH_Snipe(wrk, oc));
 }
 
 /*--------------------------------------------------------------------
  * Attempt to make space by nuking the oldest object on the LRU list
  * which isn't in use.
+ *
+ * We start with the shard which has the oldest head and work our way
+ * around the other shards until the eviction policy finds a victim.
+ *
  * Returns: 1: did, 0: didn't;
  */
 
 int
 LRU_NukeOne(struct worker *wrk, struct lru *lru)
 {
-	struct objcore *oc, *oc2;
+	struct objcore *oc;
+	struct lru_shard *sh;
+	vtim_real now;
+	unsigned u, n;
 
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
 	CHECK_OBJ_NOTNULL(lru, LRU_MAGIC);
@@ -178,23 +397,27 @@ LRU_NukeOne(struct worker *wrk, struct lru *lru)
 		return (0);
 	}
 
-	/* Find the first currently unused object on the LRU.  */
-	Lck_Lock(&lru->mtx);
-	VTAILQ_FOREACH_SAFE(oc, &lru->lru_head, lru_list, oc2) {
-		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
-		AZ(isnan(oc->last_lru));
-
-		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Cand p=%p f=0x%x r=%d",
-		    oc, oc->flags, oc->refcnt);
-
-		if (HSH_Snipe(wrk, oc)) {
-			VSC_C_main->n_lru_nuked++; // XXX per lru ?
-			VTAILQ_REMOVE(&lru->lru_head, oc, lru_list);
-			VTAILQ_INSERT_TAIL(&lru->lru_head, oc, lru_list);
-			break;
+	n = 0;
+	for (u = 1; u < lru->nshard; u++)
+		if (lru->shard[u].oldest < lru->shard[n].oldest)
+			n = u;
+
+	now = VTIM_real();
+	oc = NULL;
+	for (u = 0; oc == NULL && u < lru->nshard; u++) {
+		sh = &lru->shard[(n + u) % lru->nshard];
+		CHECK_OBJ(sh, LRU_SHARD_MAGIC);
+
+		Lck_Lock(&sh->mtx);
+		oc = lru->policy->nuke(wrk, sh, now);
+		if (oc != NULL) {
+			VSC_C_main->n_lru_nuked++;
+			sh->stats->c_nuked++;
+			lru->t_nuke = now;
 		}
+		lru_oldest(sh);
+		Lck_Unlock(&sh->mtx);
 	}
-	Lck_Unlock(&lru->mtx);
 
 	if (oc == NULL) {
 		VSLb(wrk->vsl, SLT_ExpKill, "LRU_Fail");
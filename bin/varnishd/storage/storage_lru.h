@@ -0,0 +1,81 @@
+/*-
+ * Copyright (c) 2026 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Eviction policies for the LRU facility
+ *
+ * The LRU list of a stevedore is split into shards, each protected by
+ * its own lock.  The eviction policy decides how objects are ordered
+ * on a shard and which object to sacrifice when space is needed.
+ */
+
+struct lru_shard {
+	unsigned		magic;
+#define LRU_SHARD_MAGIC		0x1a0b5d2e
+	VTAILQ_HEAD(,objcore)	lru_head;
+	struct lock		mtx;
+	vtim_real		oldest;
+	struct VSC_lru		*stats;
+	struct vsc_seg		*vsc_seg;
+
+	/* private fields for the eviction policy */
+	void			*priv;
+};
+
+/*
+ * ->add, ->remove and ->nuke are called with the shard lock held.
+ * ->touch is called without it, and must be cheap.
+ * ->nuke returns a sniped objcore which is still on the shard.
+ */
+
+typedef void lru_init_f(struct lru_shard *);
+typedef void lru_fini_f(struct lru_shard *);
+typedef void lru_add_f(struct lru_shard *, struct objcore *);
+typedef void lru_remove_f(struct lru_shard *, struct objcore *);
+typedef void lru_touch_f(struct lru_shard *, struct objcore *, vtim_real now);
+typedef struct objcore *lru_nuke_f(struct worker *, struct lru_shard *,
+    vtim_real now);
+
+struct lru_policy {
+	unsigned		magic;
+#define LRU_POLICY_MAGIC	0x6e3f21d5
+	const char		*name;
+	lru_init_f		*init;
+	lru_fini_f		*fini;
+	lru_add_f		*add;
+	lru_remove_f		*remove;
+	lru_touch_f		*touch;
+	lru_nuke_f		*nuke;
+};
+
+int LRU_Cand(struct worker *, struct objcore *);
+
+/* storage_lru_tinylfu.c */
+struct lru_sketch;
+struct lru_sketch *LRU_SketchNew(unsigned entries);
+void LRU_SketchFree(struct lru_sketch **);
+unsigned LRU_SketchAdd(struct lru_sketch *, const uint8_t *digest);
+unsigned LRU_SketchEstimate(const struct lru_sketch *, const uint8_t *digest);
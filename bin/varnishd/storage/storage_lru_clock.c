@@ -0,0 +1,104 @@
+/*-
+ * Copyright (c) 2026 Varnish Software AS
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * CLOCK (second chance) eviction policy
+ *
+ * A hit only sets the reference bit of the object, without taking any
+ * lock.  The nuke path sweeps the hand (the head of the shard) forward,
+ * giving referenced objects a second chance by clearing their bit and
+ * moving them to the tail.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache/cache_varnishd.h"
+
+#include "storage/storage.h"
+#include "storage/storage_lru.h"
+
+#include "VSC_lru.h"
+
+static void v_matchproto_(lru_add_f)
+clock_add(struct lru_shard *sh, struct objcore *oc)
+{
+
+	VTAILQ_INSERT_TAIL(&sh->lru_head, oc, lru_list);
+}
+
+static void v_matchproto_(lru_remove_f)
+clock_remove(struct lru_shard *sh, struct objcore *oc)
+{
+
+	VTAILQ_REMOVE(&sh->lru_head, oc, lru_list);
+}
+
+static void v_matchproto_(lru_touch_f)
+clock_touch(struct lru_shard *sh, struct objcore *oc, vtim_real now)
+{
+
+	(void)sh;
+	(void)now;
+	if (!oc->lru_freq)
+		oc->lru_freq = 1;
+}
+
+static struct objcore * v_matchproto_(lru_nuke_f)
+clock_nuke(struct worker *wrk, struct lru_shard *sh, vtim_real now)
+{
+	struct objcore *oc;
+	uint64_t n;
+
+	/* Two turns of the hand clears every reference bit */
+	n = 2 * sh->stats->g_objects;
+	while (n-- > 0) {
+		oc = VTAILQ_FIRST(&sh->lru_head);
+		if (oc == NULL)
+			break;
+		CHECK_OBJ(oc, OBJCORE_MAGIC);
+		VTAILQ_REMOVE(&sh->lru_head, oc, lru_list);
+		VTAILQ_INSERT_TAIL(&sh->lru_head, oc, lru_list);
+		if (oc->lru_freq) {
+			oc->lru_freq = 0;
+			oc->last_lru = now;
+			sh->stats->c_moved++;
+			continue;
+		}
+		if (LRU_Cand(wrk, oc))
+			return (oc);
+	}
+	return (NULL);
+}
+
+const struct lru_policy lru_policy_clock = {
+	.magic	=	LRU_POLICY_MAGIC,
+	.name	=	"clock",
+	.add	=	clock_add,
+	.remove	=	clock_remove,
+	.touch	=	clock_touch,
+	.nuke	=	clock_nuke,
+};
@@ -0,0 +1,256 @@
+/*-
+ * Copyright (c) 2026 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * S3-FIFO eviction policy
+ *
+ * New objects go on a small FIFO queue (the head of the shard) and are
+ * promoted to the main queue only if they were hit while there.  Objects
+ * evicted from the small queue leave a fingerprint in a ghost table, and
+ * if they come back while it is still there, they go straight to the
+ * main queue.  The main queue is a CLOCK with a two bit frequency.
+ *
+ * One-hit wonders thus never get to push out anything on the main queue.
+ *
+ * Like CLOCK, a hit only increments a counter without taking any lock.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache/cache_varnishd.h"
+#include "cache/cache_objhead.h"
+
+#include "storage/storage.h"
+#include "storage/storage_lru.h"
+
+#include "VSC_lru.h"
+
+#define S3F_SMALL	0
+#define S3F_MAIN	1
+#define S3F_FREQ_MAX	3
+#define S3F_SMALL_PCT	10
+#define S3F_NGHOST	16384
+
+struct s3f {
+	unsigned		magic;
+#define S3F_MAGIC		0x27c3b9e0
+	VTAILQ_HEAD(,objcore)	main;
+	uint64_t		nsmall;
+	uint64_t		nmain;
+	uint32_t		ghost[S3F_NGHOST];
+};
+
+static struct s3f *
+s3f_get(const struct lru_shard *sh)
+{
+	struct s3f *s3f;
+
+	CHECK_OBJ_NOTNULL(sh, LRU_SHARD_MAGIC);
+	CAST_OBJ_NOTNULL(s3f, sh->priv, S3F_MAGIC);
+	return (s3f);
+}
+
+/* Zero means an empty ghost slot */
+
+static uint32_t
+s3f_fingerprint(const struct objcore *oc)
+{
+	uint32_t u;
+
+	if (oc->objhead == NULL)
+		return (0);
+	CHECK_OBJ(oc->objhead, OBJHEAD_MAGIC);
+	memcpy(&u, oc->objhead->digest + sizeof u, sizeof u);
+	return (u | 1);
+}
+
+static void v_matchproto_(lru_init_f)
+s3f_init(struct lru_shard *sh)
+{
+	struct s3f *s3f;
+
+	ALLOC_OBJ(s3f, S3F_MAGIC);
+	AN(s3f);
+	VTAILQ_INIT(&s3f->main);
+	sh->priv = s3f;
+}
+
+static void v_matchproto_(lru_fini_f)
+s3f_fini(struct lru_shard *sh)
+{
+	struct s3f *s3f;
+
+	s3f = s3f_get(sh);
+	assert(VTAILQ_EMPTY(&s3f->main));
+	sh->priv = NULL;
+	FREE_OBJ(s3f);
+}
+
+static void v_matchproto_(lru_add_f)
+s3f_add(struct lru_shard *sh, struct objcore *oc)
+{
+	struct s3f *s3f;
+	uint32_t fp, *gp;
+
+	s3f = s3f_get(sh);
+	fp = s3f_fingerprint(oc);
+	gp = &s3f->ghost[fp % S3F_NGHOST];
+	if (fp != 0 && *gp == fp) {
+		*gp = 0;
+		sh->stats->c_ghost++;
+		oc->lru_queue = S3F_MAIN;
+		VTAILQ_INSERT_TAIL(&s3f->main, oc, lru_list);
+		s3f->nmain++;
+	} else {
+		oc->lru_queue = S3F_SMALL;
+		VTAILQ_INSERT_TAIL(&sh->lru_head, oc, lru_list);
+		s3f->nsmall++;
+	}
+}
+
+static void v_matchproto_(lru_remove_f)
+s3f_remove(struct lru_shard *sh, struct objcore *oc)
+{
+	struct s3f *s3f;
+
+	s3f = s3f_get(sh);
+	if (oc->lru_queue == S3F_MAIN) {
+		VTAILQ_REMOVE(&s3f->main, oc, lru_list);
+		s3f->nmain--;
+	} else {
+		assert(oc->lru_queue == S3F_SMALL);
+		VTAILQ_REMOVE(&sh->lru_head, oc, lru_list);
+		s3f->nsmall--;
+	}
+}
+
+static void v_matchproto_(lru_touch_f)
+s3f_touch(struct lru_shard *sh, struct objcore *oc, vtim_real now)
+{
+
+	(void)sh;
+	(void)now;
+	if (oc->lru_freq < S3F_FREQ_MAX)
+		oc->lru_freq++;
+}
+
+/*
+ * Take one step on the small queue.  Nuked objects stay at the tail
+ * until they are removed.
+ */
+
+static struct objcore *
+s3f_nuke_small(struct worker *wrk, struct lru_shard *sh, struct s3f *s3f)
+{
+	struct objcore *oc;
+	uint32_t fp;
+
+	oc = VTAILQ_FIRST(&sh->lru_head);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	VTAILQ_REMOVE(&sh->lru_head, oc, lru_list);
+	if (oc->lru_freq) {
+		oc->lru_freq = 0;
+		oc->lru_queue = S3F_MAIN;
+		VTAILQ_INSERT_TAIL(&s3f->main, oc, lru_list);
+		s3f->nsmall--;
+		s3f->nmain++;
+		sh->stats->c_promoted++;
+		return (NULL);
+	}
+	VTAILQ_INSERT_TAIL(&sh->lru_head, oc, lru_list);
+	if (!LRU_Cand(wrk, oc))
+		return (NULL);
+	fp = s3f_fingerprint(oc);
+	if (fp != 0)
+		s3f->ghost[fp % S3F_NGHOST] = fp;
+	return (oc);
+}
+
+static struct objcore *
+s3f_nuke_main(struct worker *wrk, struct lru_shard *sh, struct s3f *s3f,
+    vtim_real now)
+{
+	struct objcore *oc;
+
+	oc = VTAILQ_FIRST(&s3f->main);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	VTAILQ_REMOVE(&s3f->main, oc, lru_list);
+	VTAILQ_INSERT_TAIL(&s3f->main, oc, lru_list);
+	if (oc->lru_freq) {
+		oc->lru_freq--;
+		oc->last_lru = now;
+		sh->stats->c_moved++;
+		return (NULL);
+	}
+	if (!LRU_Cand(wrk, oc))
+		return (NULL);
+	return (oc);
+}
+
+static struct objcore * v_matchproto_(lru_nuke_f)
+s3f_nuke(struct worker *wrk, struct lru_shard *sh, vtim_real now)
+{
+	struct objcore *oc;
+	struct s3f *s3f;
+	uint64_t n, ns;
+
+	s3f = s3f_get(sh);
+
+	/*
+	 * Enough steps to bring every frequency down to zero, and we go
+	 * for the main queue once we have been all around the small one.
+	 */
+	n = (S3F_FREQ_MAX + 1) * (s3f->nsmall + s3f->nmain);
+	ns = 0;
+	oc = NULL;
+	while (oc == NULL && n-- > 0) {
+		if (s3f->nsmall > 0 && (s3f->nmain == 0 ||
+		    (ns < s3f->nsmall && s3f->nsmall * 100 >
+		    (s3f->nsmall + s3f->nmain) * S3F_SMALL_PCT))) {
+			oc = s3f_nuke_small(wrk, sh, s3f);
+			ns++;
+		}
+		else if (s3f->nmain > 0)
+			oc = s3f_nuke_main(wrk, sh, s3f, now);
+		else
+			break;
+	}
+	return (oc);
+}
+
+const struct lru_policy lru_policy_s3fifo = {
+	.magic	=	LRU_POLICY_MAGIC,
+	.name	=	"s3fifo",
+	.init	=	s3f_init,
+	.fini	=	s3f_fini,
+	.add	=	s3f_add,
+	.remove	=	s3f_remove,
+	.touch	=	s3f_touch,
+	.nuke	=	s3f_nuke,
+};
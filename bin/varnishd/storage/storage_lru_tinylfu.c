@@ -0,0 +1,164 @@
+/*-
+ * Copyright (c) 2026 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * TinyLFU admission filter
+ *
+ * A count-min sketch estimates how often each object was asked for
+ * recently.  When a storage is under pressure, a new object is only
+ * admitted if it is more popular than the object which would be nuked
+ * to make room for it.
+ *
+ * The counters are four bits in spirit, saturating at 15, and are all
+ * halved every ten times the width additions, so old popularity fades.
+ * Additions are done without a lock and may occasionally get lost,
+ * which does not matter for an estimate.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache/cache_varnishd.h"
+
+#include "storage/storage.h"
+#include "storage/storage_lru.h"
+
+#define SKETCH_DEPTH		4
+#define SKETCH_MAX		15
+#define SKETCH_AGE		10
+
+struct lru_sketch {
+	unsigned		magic;
+#define LRU_SKETCH_MAGIC	0x4c8d0e71
+	unsigned		mask;
+	uint64_t		nadd;
+	struct lock		mtx;
+	uint8_t			*row[SKETCH_DEPTH];
+};
+
+struct lru_sketch *
+LRU_SketchNew(unsigned entries)
+{
+	struct lru_sketch *sk;
+	unsigned u, w;
+
+	assert(entries > 0);
+	for (w = 1; w < entries && w < (1U << 31); w <<= 1)
+		continue;
+	ALLOC_OBJ(sk, LRU_SKETCH_MAGIC);
+	AN(sk);
+	sk->mask = w - 1;
+	Lck_New(&sk->mtx, lck_lru);
+	for (u = 0; u < SKETCH_DEPTH; u++) {
+		sk->row[u] = calloc(w, sizeof *sk->row[u]);
+		AN(sk->row[u]);
+	}
+	return (sk);
+}
+
+void
+LRU_SketchFree(struct lru_sketch **pp)
+{
+	struct lru_sketch *sk;
+	unsigned u;
+
+	TAKE_OBJ_NOTNULL(sk, pp, LRU_SKETCH_MAGIC);
+	for (u = 0; u < SKETCH_DEPTH; u++)
+		free(sk->row[u]);
+	Lck_Delete(&sk->mtx);
+	FREE_OBJ(sk);
+}
+
+/* The digest is a SHA256, so every word of it is a fine hash */
+
+static unsigned
+sketch_idx(const struct lru_sketch *sk, const uint8_t *digest, unsigned row)
+{
+	uint32_t u;
+
+	assert(DIGEST_LEN >= sizeof u * SKETCH_DEPTH);
+	memcpy(&u, digest + row * sizeof u, sizeof u);
+	return (u & sk->mask);
+}
+
+unsigned
+LRU_SketchEstimate(const struct lru_sketch *sk, const uint8_t *digest)
+{
+	unsigned u, c, m;
+
+	CHECK_OBJ_NOTNULL(sk, LRU_SKETCH_MAGIC);
+	AN(digest);
+	m = SKETCH_MAX;
+	for (u = 0; u < SKETCH_DEPTH; u++) {
+		c = sk->row[u][sketch_idx(sk, digest, u)];
+		if (c < m)
+			m = c;
+	}
+	return (m);
+}
+
+static void
+sketch_age(struct lru_sketch *sk)
+{
+	unsigned u, v;
+
+	if (Lck_Trylock(&sk->mtx))
+		return;
+	if (sk->nadd > (uint64_t)SKETCH_AGE * (sk->mask + 1)) {
+		for (u = 0; u < SKETCH_DEPTH; u++)
+			for (v = 0; v <= sk->mask; v++)
+				sk->row[u][v] >>= 1;
+		sk->nadd = 0;
+	}
+	Lck_Unlock(&sk->mtx);
+}
+
+/*
+ * Conservative update: only the counters holding the minimum are
+ * incremented.  Returns the new estimate.
+ */
+
+unsigned
+LRU_SketchAdd(struct lru_sketch *sk, const uint8_t *digest)
+{
+	unsigned u, m;
+	uint8_t *c;
+
+	m = LRU_SketchEstimate(sk, digest);
+	if (m < SKETCH_MAX) {
+		for (u = 0; u < SKETCH_DEPTH; u++) {
+			c = &sk->row[u][sketch_idx(sk, digest, u)];
+			if (*c == m)
+				*c = m + 1;
+		}
+		m++;
+	}
+	if (++sk->nadd > (uint64_t)SKETCH_AGE * (sk->mask + 1))
+		sketch_age(sk);
+	return (m);
+}
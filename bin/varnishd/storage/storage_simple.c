@@ -722,6 +722,52 @@ sml_setattr(struct worker *wrk, struct objcore *oc, enum obj_attr attr,
 	return (retval);
 }
 
+/*--------------------------------------------------------------------
+ * Only for complete objects, where the list of segments will not
+ * change under us.
+ */
+
+static int v_matchproto_(objsendfiler_f)
+sml_sendfile(struct worker *wrk, struct objcore *oc,
+    void *priv, objsendfile_f *func)
+{
+	const struct stevedore *stv;
+	struct object *obj;
+	struct storage *st;
+	struct boc *boc;
+	off_t off;
+	int fd, ret = 0;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	stv = oc->stobj->stevedore;
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	if (stv->sml_getfd == NULL)
+		return (1);
+	boc = HSH_RefBoc(oc);
+	if (boc != NULL) {
+		HSH_DerefBoc(wrk, oc);
+		return (1);
+	}
+
+	obj = sml_getobj(wrk, oc);
+	CHECK_OBJ_NOTNULL(obj, OBJECT_MAGIC);
+
+	/* Check all segments first, we cannot fall back half way */
+	VTAILQ_FOREACH(st, &obj->list, list)
+		if (stv->sml_getfd(st, &fd, &off))
+			return (1);
+
+	VTAILQ_FOREACH_REVERSE(st, &obj->list, storagehead, list) {
+		if (st->len == 0)
+			continue;
+		AZ(stv->sml_getfd(st, &fd, &off));
+		ret = func(priv, fd, off, st->len);
+		if (ret)
+			break;
+	}
+	return (ret);
+}
+
 const struct obj_methods SML_methods = {
 	.objfree	= sml_objfree,
 	.objiterator	= sml_iterator,
@@ -733,6 +779,7 @@ const struct obj_methods SML_methods = {
 	.objgetattr	= sml_getattr,
 	.objsetattr	= sml_setattr,
 	.objtouch	= LRU_Touch,
+	.objsendfile	= sml_sendfile,
 };
 
 static void
@@ -402,7 +402,7 @@ smu_open(struct stevedore *st)
 	char ident[strlen(st->ident) + 1];
 
 	ASSERT_CLI();
-	st->lru = LRU_Alloc();
+	st->lru = LRU_Alloc(st);
 	if (lck_smu == NULL)
 		lck_smu = Lck_CreateClass(NULL, "smu");
 	CAST_OBJ_NOTNULL(smu_sc, st->priv, SMU_SC_MAGIC);
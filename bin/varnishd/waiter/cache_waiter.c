@@ -151,27 +151,49 @@ Waiter_GetName(void)
 		return ("(No Waiter?)");
 }
 
-struct waiter *
-Waiter_New(void)
+static struct waiter *
+waiter_new(const struct waiter_impl *impl)
 {
 	struct waiter *w;
 
-	AN(waiter);
-	AN(waiter->name);
-	AN(waiter->init);
-	AN(waiter->enter);
-	AN(waiter->fini);
+	AN(impl);
+	AN(impl->name);
+	AN(impl->init);
+	AN(impl->enter);
+	AN(impl->fini);
 
-	w = calloc(1, sizeof (struct waiter) + waiter->size);
+	w = calloc(1, sizeof (struct waiter) + impl->size);
 	AN(w);
 	INIT_OBJ(w, WAITER_MAGIC);
 	w->priv = (void*)(w + 1);
-	w->impl = waiter;
+	w->impl = impl;
 	VTAILQ_INIT(&w->waithead);
 	w->heap = VBH_new(w, waited_cmp, waited_update);
 
-	waiter->init(w);
+	if (impl->init(w)) {
+		VBH_destroy(&w->heap);
+		FREE_OBJ(w);
+	}
+	return (w);
+}
 
+struct waiter *
+Waiter_New(void)
+{
+	struct waiter *w;
+
+	w = waiter_new(waiter);
+	if (w == NULL) {
+		/* Only waiters which were probed by the manager may fail */
+		AN(waiter->probe);
+		AN(waiter_fallback);
+		VSL(SLT_Error, NO_VXID,
+		    "Waiter %s not usable (%s), falling back to %s",
+		    waiter->name, VAS_errtxt(errno), waiter_fallback->name);
+		waiter = waiter_fallback;
+		w = waiter_new(waiter);
+		AN(w);
+	}
 	return (w);
 }
 
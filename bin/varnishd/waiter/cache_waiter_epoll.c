@@ -139,7 +139,7 @@ vwe_thread(void *priv)
 			}
 			AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_DEL, wp->fd, NULL));
 			vwe->nwaited--;
-			if (ep->events & EPOLLIN)
+			if (ep->events & (EPOLLIN | EPOLLOUT))
 				Wait_Call(w, wp, WAITER_ACTION, now);
 			else if (ep->events & EPOLLERR)
 				Wait_Call(w, wp, WAITER_REMCLOSE, now);
@@ -167,7 +167,7 @@ vwe_enter(void *priv, struct waited *wp)
 	struct epoll_event ee;
 
 	CAST_OBJ_NOTNULL(vwe, priv, VWE_MAGIC);
-	ee.events = EPOLLIN | EPOLLRDHUP;
+	ee.events = wp->output ? EPOLLOUT : EPOLLIN | EPOLLRDHUP;
 	ee.data.ptr = wp;
 	Lck_Lock(&vwe->mtx);
 	vwe->nwaited++;
@@ -182,7 +182,7 @@ vwe_enter(void *priv, struct waited *wp)
 
 /*--------------------------------------------------------------------*/
 
-static void v_matchproto_(waiter_init_f)
+static int v_matchproto_(waiter_init_f)
 vwe_init(struct waiter *w)
 {
 	struct vwe *vwe;
@@ -202,6 +202,7 @@ vwe_init(struct waiter *w)
 	AZ(epoll_ctl(vwe->epfd, EPOLL_CTL_ADD, vwe->pipe[0], &ee));
 
 	PTOK(pthread_create(&vwe->thread, NULL, vwe_thread, vwe));
+	return (0);
 }
 
 /*--------------------------------------------------------------------
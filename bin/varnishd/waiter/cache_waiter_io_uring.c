@@ -0,0 +1,505 @@
+/*-
+ * Copyright (c) 2024 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Linux io_uring(7) waiter.
+ *
+ * Every waited fd is a one-shot IORING_OP_POLL_ADD, whose user_data
+ * points to the struct waited.  Each of them yields exactly one
+ * completion, so the struct waited stays ours until that completion
+ * has been reaped:  On timeout, we take the waited off the heap and
+ * cancel the poll, and when the completion comes back, the waited no
+ * longer being on the heap tells us that it timed out.
+ *
+ * The cancellations are queued in the submission ring and go to the
+ * kernel together with the next wait, in a single system call.
+ *
+ * Requests belong to the thread which submitted them, and the kernel
+ * cancels them when that thread exits.  Worker threads come and go,
+ * so they only put the waited on a list and wake our thread through
+ * an eventfd(2), which is itself polled on the ring.  Only our own
+ * thread ever submits.
+ *
+ * We talk to the kernel directly rather than through liburing, the
+ * little we need of it is not worth a dependency.
+ */
+
+#include "config.h"
+
+#if defined(HAVE_IO_URING)
+
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "cache/cache_varnishd.h"
+
+#include "waiter/waiter.h"
+#include "waiter/waiter_priv.h"
+#include "vmb.h"
+#include "vtim.h"
+
+#ifndef POLLRDHUP
+#  define POLLRDHUP 0
+#endif
+
+#define VWU_SQ_ENTRIES	4096
+#define VWU_CQ_ENTRIES	(16 * VWU_SQ_ENTRIES)
+
+/* user_data of completions we do not care about */
+#define VWU_NOP		0
+/* user_data of the poll on the eventfd */
+#define VWU_WAKE	1
+
+struct vwu {
+	unsigned		magic;
+#define VWU_MAGIC		0x2c6f4f1e
+	int			fd;
+	int			efd;
+	struct waiter		*waiter;
+	pthread_t		thread;
+	double			next;
+	unsigned		nwaited;
+	unsigned		nsubmit;
+	int			die;
+	int			woken;
+	struct lock		mtx;
+
+	struct waited		**pend;
+	unsigned		npend;
+	unsigned		lpend;
+
+	void			*sq_ptr;
+	size_t			sq_sz;
+	void			*cq_ptr;
+	size_t			cq_sz;
+	struct io_uring_sqe	*sqes;
+	size_t			sqes_sz;
+
+	volatile unsigned	*sq_head;
+	volatile unsigned	*sq_tail;
+	unsigned		sq_mask;
+	unsigned		sq_entries;
+	unsigned		*sq_array;
+
+	volatile unsigned	*cq_head;
+	volatile unsigned	*cq_tail;
+	unsigned		cq_mask;
+	struct io_uring_cqe	*cqes;
+};
+
+/*--------------------------------------------------------------------*/
+
+static int
+vwu_setup(unsigned entries, struct io_uring_params *p)
+{
+
+	return (syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int
+vwu_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+    const void *arg, size_t argsz)
+{
+
+	return (syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+	    flags, arg, argsz));
+}
+
+/*--------------------------------------------------------------------
+ * Submit what has been queued, only from our own thread
+ */
+
+static void
+vwu_submit(struct vwu *vwu)
+{
+	int i;
+
+	while (vwu->nsubmit > 0) {
+		i = vwu_enter(vwu->fd, vwu->nsubmit, 0, 0, NULL, 0);
+		if (i < 0 && (errno == EINTR || errno == EAGAIN ||
+		    errno == EBUSY))
+			continue;
+		assert(i > 0);
+		assert((unsigned)i <= vwu->nsubmit);
+		vwu->nsubmit -= i;
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Get a submission queue entry, only from our own thread
+ */
+
+static struct io_uring_sqe *
+vwu_sqe(struct vwu *vwu)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+
+	tail = *vwu->sq_tail;
+	VRMB();
+	if (tail - *vwu->sq_head >= vwu->sq_entries) {
+		vwu_submit(vwu);
+		VRMB();
+		assert(tail - *vwu->sq_head < vwu->sq_entries);
+	}
+	idx = tail & vwu->sq_mask;
+	sqe = &vwu->sqes[idx];
+	memset(sqe, 0, sizeof *sqe);
+	vwu->sq_array[idx] = idx;
+	return (sqe);
+}
+
+static void
+vwu_sqe_commit(struct vwu *vwu)
+{
+
+	VWMB();
+	*vwu->sq_tail = *vwu->sq_tail + 1;
+	vwu->nsubmit++;
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+vwu_reap(struct vwu *vwu, double now)
+{
+	struct waiter *w;
+	struct waited *wp;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+	uint64_t ud;
+	int res, active;
+
+	w = vwu->waiter;
+	head = *vwu->cq_head;
+	tail = *vwu->cq_tail;
+	VRMB();
+	for (; head != tail; head++) {
+		cqe = &vwu->cqes[head & vwu->cq_mask];
+		ud = cqe->user_data;
+		res = cqe->res;
+		VWMB();
+		*vwu->cq_head = head + 1;
+		if (ud == VWU_NOP)
+			continue;
+		if (ud == VWU_WAKE) {
+			vwu->woken = 1;
+			continue;
+		}
+		CAST_OBJ_NOTNULL(wp, (void *)(uintptr_t)ud, WAITED_MAGIC);
+		Lck_Lock(&vwu->mtx);
+		active = Wait_HeapDelete(w, wp);
+		assert(vwu->nwaited > 0);
+		vwu->nwaited--;
+		Lck_Unlock(&vwu->mtx);
+		if (!active)
+			Wait_Call(w, wp, WAITER_TIMEOUT, now);
+		else if (res > 0 && (res & (POLLIN | POLLOUT)))
+			Wait_Call(w, wp, WAITER_ACTION, now);
+		else
+			Wait_Call(w, wp, WAITER_REMCLOSE, now);
+	}
+}
+
+static void *
+vwu_thread(void *priv)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	struct io_uring_sqe *sqe;
+	struct waited *wp;
+	struct waiter *w;
+	struct vwu *vwu;
+	double now, then;
+	eventfd_t ev;
+	unsigned u;
+	int i;
+
+	CAST_OBJ_NOTNULL(vwu, priv, VWU_MAGIC);
+	w = vwu->waiter;
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	THR_SetName("cache-io_uring");
+	THR_Init();
+
+	now = VTIM_real();
+	vwu->woken = 1;
+	while (1) {
+		if (vwu->woken) {
+			(void)eventfd_read(vwu->efd, &ev);
+			sqe = vwu_sqe(vwu);
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = vwu->efd;
+			sqe->poll_events = POLLIN;
+			sqe->user_data = VWU_WAKE;
+			vwu_sqe_commit(vwu);
+			vwu->woken = 0;
+		}
+		Lck_Lock(&vwu->mtx);
+		for (u = 0; u < vwu->npend; u++) {
+			wp = vwu->pend[u];
+			CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+			sqe = vwu_sqe(vwu);
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = wp->fd;
+			sqe->poll_events =
+			    wp->output ? POLLOUT : POLLIN | POLLRDHUP;
+			sqe->user_data = (uintptr_t)wp;
+			vwu_sqe_commit(vwu);
+		}
+		vwu->npend = 0;
+		while (1) {
+			then = Wait_HeapDue(w, &wp);
+			if (wp == NULL) {
+				vwu->next = now + 100;
+				break;
+			} else if (then > now) {
+				vwu->next = then;
+				break;
+			}
+			CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
+			AN(Wait_HeapDelete(w, wp));
+			sqe = vwu_sqe(vwu);
+			sqe->opcode = IORING_OP_POLL_REMOVE;
+			sqe->fd = -1;
+			sqe->addr = (uintptr_t)wp;
+			sqe->user_data = VWU_NOP;
+			vwu_sqe_commit(vwu);
+		}
+		then = vwu->next - now;
+		Lck_Unlock(&vwu->mtx);
+		vwu_submit(vwu);
+
+		ts.tv_sec = (long long)floor(then);
+		ts.tv_nsec = (long long)(1e9 * (then - ts.tv_sec));
+		memset(&arg, 0, sizeof arg);
+		arg.ts = (uintptr_t)&ts;
+		i = vwu_enter(vwu->fd, 0, 1,
+		    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+		    &arg, sizeof arg);
+		assert(i >= 0 || errno == EINTR || errno == ETIME ||
+		    errno == EAGAIN || errno == EBUSY);
+		now = VTIM_real();
+		vwu_reap(vwu, now);
+		if (vwu->nwaited == 0 && vwu->die)
+			break;
+	}
+	return (NULL);
+}
+
+/*--------------------------------------------------------------------*/
+
+static int v_matchproto_(waiter_enter_f)
+vwu_enter_f(void *priv, struct waited *wp)
+{
+	struct vwu *vwu;
+
+	CAST_OBJ_NOTNULL(vwu, priv, VWU_MAGIC);
+	Lck_Lock(&vwu->mtx);
+	if (vwu->npend == vwu->lpend) {
+		vwu->lpend += vwu->lpend + 64;
+		vwu->pend = realloc(vwu->pend, vwu->lpend * sizeof *vwu->pend);
+		AN(vwu->pend);
+	}
+	vwu->nwaited++;
+	Wait_HeapInsert(vwu->waiter, wp);
+	vwu->pend[vwu->npend++] = wp;
+	/* The first one since the waiter last looked, poke it */
+	if (vwu->npend == 1)
+		AZ(eventfd_write(vwu->efd, 1));
+	Lck_Unlock(&vwu->mtx);
+	return (0);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+vwu_unmap(struct vwu *vwu)
+{
+
+	if (vwu->cq_ptr != vwu->sq_ptr)
+		AZ(munmap(vwu->cq_ptr, vwu->cq_sz));
+	AZ(munmap(vwu->sq_ptr, vwu->sq_sz));
+}
+
+static int
+vwu_ring(struct vwu *vwu)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof p);
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = VWU_CQ_ENTRIES;
+	vwu->fd = vwu_setup(VWU_SQ_ENTRIES, &p);
+	if (vwu->fd < 0)
+		return (-1);
+	if (!(p.features & IORING_FEAT_EXT_ARG) ||
+	    !(p.features & IORING_FEAT_NODROP)) {
+		closefd(&vwu->fd);
+		errno = ENOTSUP;
+		return (-1);
+	}
+
+	vwu->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	vwu->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		vwu->sq_sz = vmax(vwu->sq_sz, vwu->cq_sz);
+		vwu->cq_sz = vwu->sq_sz;
+	}
+	vwu->sq_ptr = mmap(NULL, vwu->sq_sz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, vwu->fd, IORING_OFF_SQ_RING);
+	if (vwu->sq_ptr == MAP_FAILED) {
+		closefd(&vwu->fd);
+		return (-1);
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		vwu->cq_ptr = vwu->sq_ptr;
+	} else {
+		vwu->cq_ptr = mmap(NULL, vwu->cq_sz, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, vwu->fd, IORING_OFF_CQ_RING);
+		if (vwu->cq_ptr == MAP_FAILED) {
+			AZ(munmap(vwu->sq_ptr, vwu->sq_sz));
+			closefd(&vwu->fd);
+			return (-1);
+		}
+	}
+	vwu->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	vwu->sqes = mmap(NULL, vwu->sqes_sz, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, vwu->fd, IORING_OFF_SQES);
+	if (vwu->sqes == MAP_FAILED) {
+		vwu_unmap(vwu);
+		closefd(&vwu->fd);
+		return (-1);
+	}
+
+#define SQ(fld) (void *)((char *)vwu->sq_ptr + p.sq_off.fld)
+#define CQ(fld) (void *)((char *)vwu->cq_ptr + p.cq_off.fld)
+	vwu->sq_head = SQ(head);
+	vwu->sq_tail = SQ(tail);
+	vwu->sq_mask = *(unsigned *)SQ(ring_mask);
+	vwu->sq_entries = *(unsigned *)SQ(ring_entries);
+	vwu->sq_array = SQ(array);
+	vwu->cq_head = CQ(head);
+	vwu->cq_tail = CQ(tail);
+	vwu->cq_mask = *(unsigned *)CQ(ring_mask);
+	vwu->cqes = CQ(cqes);
+#undef SQ
+#undef CQ
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Called from the manager, so that we can fall back to another waiter
+ * if the kernel does not support io_uring or it is not permitted.
+ */
+
+static int v_matchproto_(waiter_probe_f)
+vwu_probe(void)
+{
+	struct io_uring_params p;
+	int fd;
+
+	memset(&p, 0, sizeof p);
+	fd = vwu_setup(1, &p);
+	if (fd < 0)
+		return (-1);
+	closefd(&fd);
+	if (!(p.features & IORING_FEAT_EXT_ARG) ||
+	    !(p.features & IORING_FEAT_NODROP)) {
+		errno = ENOTSUP;
+		return (-1);
+	}
+	return (0);
+}
+
+/*--------------------------------------------------------------------*/
+
+static int v_matchproto_(waiter_init_f)
+vwu_init(struct waiter *w)
+{
+	struct vwu *vwu;
+
+	CHECK_OBJ_NOTNULL(w, WAITER_MAGIC);
+	vwu = w->priv;
+	INIT_OBJ(vwu, VWU_MAGIC);
+	vwu->waiter = w;
+	vwu->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (vwu->efd < 0)
+		return (-1);
+	if (vwu_ring(vwu)) {
+		closefd(&vwu->efd);
+		return (-1);
+	}
+	Lck_New(&vwu->mtx, lck_waiter);
+
+	PTOK(pthread_create(&vwu->thread, NULL, vwu_thread, vwu));
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * It is the callers responsibility to trigger all fd's waited on to
+ * fail somehow.
+ */
+
+static void v_matchproto_(waiter_fini_f)
+vwu_fini(struct waiter *w)
+{
+	struct vwu *vwu;
+	void *vp;
+
+	CAST_OBJ_NOTNULL(vwu, w->priv, VWU_MAGIC);
+
+	Lck_Lock(&vwu->mtx);
+	vwu->die = 1;
+	AZ(eventfd_write(vwu->efd, 1));
+	Lck_Unlock(&vwu->mtx);
+	PTOK(pthread_join(vwu->thread, &vp));
+	Lck_Delete(&vwu->mtx);
+
+	AZ(munmap(vwu->sqes, vwu->sqes_sz));
+	vwu_unmap(vwu);
+	closefd(&vwu->fd);
+	closefd(&vwu->efd);
+	free(vwu->pend);
+}
+
+/*--------------------------------------------------------------------*/
+
+#include "waiter/mgt_waiter.h"
+
+const struct waiter_impl waiter_io_uring = {
+	.name =		"io_uring",
+	.init =		vwu_init,
+	.fini =		vwu_fini,
+	.enter =	vwu_enter_f,
+	.probe =	vwu_probe,
+	.size =		sizeof(struct vwu),
+};
+
+#endif /* defined(HAVE_IO_URING) */
@@ -96,7 +96,9 @@ vwk_thread(void *priv)
 				break;
 			}
 			CHECK_OBJ_NOTNULL(wp, WAITED_MAGIC);
-			EV_SET(ke, wp->fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+			EV_SET(ke, wp->fd,
+			    wp->output ? EVFILT_WRITE : EVFILT_READ,
+			    EV_DELETE, 0, 0, NULL);
 			AZ(kevent(vwk->kq, ke, 1, NULL, 0, NULL));
 			AN(Wait_HeapDelete(w, wp));
 			Lck_Unlock(&vwk->mtx);
@@ -110,7 +112,8 @@ vwk_thread(void *priv)
 		assert(n <= NKEV);
 		now = VTIM_real();
 		for (kp = ke, j = 0; j < n; j++, kp++) {
-			assert(kp->filter == EVFILT_READ);
+			assert(kp->filter == EVFILT_READ ||
+			    kp->filter == EVFILT_WRITE);
 			if ((uintptr_t)ke[j].udata == (uintptr_t)vwk) {
 				assert(read(vwk->pipe[0], &c, 1) == 1);
 				continue;
@@ -143,7 +146,8 @@ vwk_enter(void *priv, struct waited *wp)
 	struct kevent ke;
 
 	CAST_OBJ_NOTNULL(vwk, priv, VWK_MAGIC);
-	EV_SET(&ke, wp->fd, EVFILT_READ, EV_ADD|EV_ONESHOT, 0, 0, wp);
+	EV_SET(&ke, wp->fd, wp->output ? EVFILT_WRITE : EVFILT_READ,
+	    EV_ADD|EV_ONESHOT, 0, 0, wp);
 	Lck_Lock(&vwk->mtx);
 	vwk->nwaited++;
 	Wait_HeapInsert(vwk->waiter, wp);
@@ -159,7 +163,7 @@ vwk_enter(void *priv, struct waited *wp)
 
 /*--------------------------------------------------------------------*/
 
-static void v_matchproto_(waiter_init_f)
+static int v_matchproto_(waiter_init_f)
 vwk_init(struct waiter *w)
 {
 	struct vwk *vwk;
@@ -178,6 +182,7 @@ vwk_init(struct waiter *w)
 	AZ(kevent(vwk->kq, &ke, 1, NULL, 0, NULL));
 
 	PTOK(pthread_create(&vwk->thread, NULL, vwk_thread, vwk));
+	return (0);
 }
 
 /*--------------------------------------------------------------------
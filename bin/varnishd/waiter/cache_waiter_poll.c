@@ -106,7 +106,7 @@ vwp_add(struct vwp *vwp, struct waited *wp)
 	assert(vwp->pollfd[vwp->hpoll].fd == -1);
 	AZ(vwp->idx[vwp->hpoll]);
 	vwp->pollfd[vwp->hpoll].fd = wp->fd;
-	vwp->pollfd[vwp->hpoll].events = POLLIN;
+	vwp->pollfd[vwp->hpoll].events = wp->output ? POLLOUT : POLLIN;
 	vwp->idx[vwp->hpoll] = wp;
 	vwp->hpoll++;
 	Wait_HeapInsert(vwp->waiter, wp);
@@ -194,7 +194,7 @@ vwp_main(void *priv)
 				AN(Wait_HeapDelete(w, wp));
 				Wait_Call(w, wp, WAITER_TIMEOUT, now);
 				vwp_del(vwp, z);
-			} else if (vwp->pollfd[z].revents & POLLIN) {
+			} else if (vwp->pollfd[z].revents & (POLLIN|POLLOUT)) {
 				assert(wp->fd > 0);
 				assert(wp->fd == vwp->pollfd[z].fd);
 				AN(Wait_HeapDelete(w, wp));
@@ -226,7 +226,7 @@ vwp_enter(void *priv, struct waited *wp)
 
 /*--------------------------------------------------------------------*/
 
-static void v_matchproto_(waiter_init_f)
+static int v_matchproto_(waiter_init_f)
 vwp_init(struct waiter *w)
 {
 	struct vwp *vwp;
@@ -243,6 +243,7 @@ vwp_init(struct waiter *w)
 	vwp->pollfd[0].fd = vwp->pipes[0];
 	vwp->pollfd[0].events = POLLIN;
 	PTOK(pthread_create(&vwp->thread, NULL, vwp_main, vwp));
+	return (0);
 }
 
 /*--------------------------------------------------------------------
@@ -95,10 +95,11 @@ struct vws {
 };
 
 static inline void
-vws_add(struct vws *vws, int fd, void *data)
+vws_add(struct vws *vws, struct waited *wp)
 {
-	// POLLIN should be all we need here
-	AZ(port_associate(vws->dport, PORT_SOURCE_FD, fd, POLLIN, data));
+	// POLLIN should be all we need here, unless asked for output
+	AZ(port_associate(vws->dport, PORT_SOURCE_FD, wp->fd,
+	    wp->output ? POLLOUT : POLLIN, wp));
 }
 
 static inline void
@@ -116,7 +117,7 @@ vws_port_ev(struct vws *vws, struct waiter *w, port_event_t *ev, double now)
 		assert(wp->fd >= 0);
 		vws->nwaited++;
 		Wait_HeapInsert(vws->waiter, wp);
-		vws_add(vws, wp->fd, wp);
+		vws_add(vws, wp);
 	} else {
 		assert(ev->portev_source == PORT_SOURCE_FD);
 		CAST_OBJ_NOTNULL(wp, ev->portev_user, WAITED_MAGIC);
@@ -232,7 +233,7 @@ vws_enter(void *priv, struct waited *wp)
 
 /*--------------------------------------------------------------------*/
 
-static void v_matchproto_(waiter_init_f)
+static int v_matchproto_(waiter_init_f)
 vws_init(struct waiter *w)
 {
 	struct vws *vws;
@@ -245,6 +246,7 @@ vws_init(struct waiter *w)
 	assert(vws->dport >= 0);
 
 	PTOK(pthread_create(&vws->thread, NULL, vws_thread, vws));
+	return (0);
 }
 
 /*--------------------------------------------------------------------*/
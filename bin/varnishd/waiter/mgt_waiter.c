@@ -31,9 +31,12 @@
  */
 
 #include "config.h"
+#include <string.h>
 #include <unistd.h>
 
 #include "mgt/mgt.h"
+#include "waiter/waiter.h"
+#include "waiter/waiter_priv.h"
 #include "waiter/mgt_waiter.h"
 #include "common/heritage.h"
 
@@ -44,6 +47,7 @@ static const struct choice waiter_choice[] = {
 };
 
 struct waiter_impl const *waiter;
+struct waiter_impl const *waiter_fallback;
 
 void
 Wait_config(const char *arg)
@@ -55,4 +59,19 @@ Wait_config(const char *arg)
 		waiter = MGT_Pick(waiter_choice, arg, "waiter");
 	else
 		waiter = waiter_choice[0].ptr;
+
+	AN(waiter);
+	if (waiter->probe != NULL && waiter->probe()) {
+		MGT_Complain(C_ERR,
+		    "Waiter %s not usable (%s), falling back to %s",
+		    waiter->name, strerror(errno),
+		    waiter_choice[0].name);
+		waiter = waiter_choice[0].ptr;
+		AZ(waiter->probe);
+	}
+	if (waiter->probe != NULL) {
+		/* The child can still fail to set it up */
+		waiter_fallback = waiter_choice[0].ptr;
+		AZ(waiter_fallback->probe);
+	}
 }
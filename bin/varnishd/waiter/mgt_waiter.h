@@ -35,6 +35,7 @@ struct waiter_impl;
 
 /* mgt_waiter.c */
 extern struct waiter_impl const * waiter;
+extern struct waiter_impl const * waiter_fallback;
 
 #define WAITER(nm) extern const struct waiter_impl waiter_##nm;
 #include "tbl/waiters.h"
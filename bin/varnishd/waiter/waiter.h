@@ -66,6 +66,7 @@ struct waited {
 	waiter_handle_f		*func;
 	vtim_dur		tmo;
 	vtim_real		idle;
+	unsigned		output;	/* wait for fd to be writable */
 };
 
 /* cache_waiter.c */
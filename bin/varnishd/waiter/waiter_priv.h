@@ -45,11 +45,12 @@ struct waiter {
 	struct vbh			*heap;
 };
 
-typedef void waiter_init_f(struct waiter *);
+typedef int waiter_init_f(struct waiter *);
 typedef void waiter_fini_f(struct waiter *);
 typedef int waiter_enter_f(void *priv, struct waited *);
 typedef void waiter_inject_f(const struct waiter *, struct waited *);
 typedef void waiter_evict_f(const struct waiter *, struct waited *);
+typedef int waiter_probe_f(void);
 
 struct waiter_impl {
 	const char			*name;
@@ -57,6 +58,7 @@ struct waiter_impl {
 	waiter_fini_f			*fini;
 	waiter_enter_f			*enter;
 	waiter_inject_f			*inject;
+	waiter_probe_f			*probe;
 	size_t				size;
 };
 
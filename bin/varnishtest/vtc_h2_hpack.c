@@ -312,6 +312,7 @@ HPK_DecHdr(struct hpk_iter *iter, struct hpk_hdr *header)
 {
 	int pref = 0;
 	const struct hpk_txt *t;
+	enum hpk_result r;
 	uint32_t num;
 	int must_index = 0;
 	assert(iter);
@@ -363,9 +364,13 @@ HPK_DecHdr(struct hpk_iter *iter, struct hpk_hdr *header)
 	/* Dynamic Table Size Update */
 	/* XXX if under max allowed value */
 	else if (*iter->buf >> 5 == 1) {
-		if (hpk_done != num_decode(&num, iter, 5))
+		r = num_decode(&num, iter, 5);
+		if (r == hpk_err || HPK_ResizeTbl(iter->ctx, num) != hpk_done)
 			return (hpk_err);
-		return (HPK_ResizeTbl(iter->ctx, num));
+		/* Not a header field itself, the block goes on (RFC7541 4.2) */
+		if (r != hpk_more)
+			return (hpk_err);
+		return (HPK_DecHdr(iter, header));
 	} else {
 		return (hpk_err);
 	}
@@ -36,6 +36,7 @@ LOCK(busyobj)
 LOCK(cli)
 LOCK(director)
 LOCK(exp)
+LOCK(h2fetch)
 LOCK(hcb)
 LOCK(lru)
 LOCK(mempool)
@@ -44,6 +45,7 @@ LOCK(perpool)
 LOCK(pipestat)
 LOCK(probe)
 LOCK(sess)
+LOCK(tag)
 LOCK(conn_pool)
 LOCK(vbe)
 LOCK(vcapace)
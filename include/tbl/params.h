@@ -150,6 +150,21 @@ PARAM_SIMPLE(
 	"identical."
 )
 
+PARAM_SIMPLE(
+	/* name */	ban_index,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Keep bans which consist of a single obj.http.* == test in an "
+	"index, so objects can be checked against all of them with a "
+	"single lookup per header, both at lookup time and by the "
+	"ban-lurker. Only affects bans added while it is enabled.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	ban_cutoff,
 	/* type */	uint,
@@ -223,6 +238,21 @@ PARAM_SIMPLE(
 	"A value of zero will disable the ban lurker entirely."
 )
 
+PARAM_SIMPLE(
+	/* name */	ban_lurker_threads,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* def */	"1",
+	/* units */	"threads",
+	/* descr */
+	"Number of threads the ban lurker uses to test objects.  The bans "
+	"to lurk are shared out among them, the objects of any one ban are "
+	"tested by a single thread.\n"
+	"${ban_lurker_batch} and ${ban_lurker_sleep} apply to each thread.",
+	/* flags */	MUST_RESTART | EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	ban_lurker_holdoff,
 	/* type */	duration,
@@ -345,6 +375,22 @@ PARAM_SIMPLE(
 	/* flags */	EXPERIMENTAL
 )
 
+PARAM_SIMPLE(
+	/* name */	backend_h2_max_streams,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	NULL,
+	/* def */	"100",
+	/* units */	"streams",
+	/* descr */
+	"Maximum number of concurrent fetches multiplexed over one HTTP/2 "
+	"connection to a backend with the .http2 attribute.  The backend's "
+	"own SETTINGS_MAX_CONCURRENT_STREAMS lowers this further.  When all "
+	"connections are full, a new one is opened, subject to the "
+	"backend's max_connections.",
+	/* flags */	EXPERIMENTAL
+)
+
 
 PARAM_SIMPLE(
 	/* name */	cli_limit,
@@ -428,8 +474,8 @@ PARAM_SIMPLE(
 	/* def */	"180.000",
 	/* units */	"seconds",
 	/* descr */
-	"How long the critbit hasher keeps deleted objheads on the cooloff "
-	"list.",
+	"How long the critbit and classic hashers keep deleted objheads on "
+	"the cooloff list.",
 	/* flags */	WIZARD
 )
 
@@ -484,6 +530,70 @@ PARAM_SIMPLE(
 	/* dyn_def_reason */	"2m"
 )
 
+PARAM_SIMPLE(
+	/* name */	expiry_shards,
+	/* type */	uint,
+	/* min */	"1",
+	/* max */	"64",
+	/* def */	"1",
+	/* units */	"shards",
+	/* descr */
+	"Number of shards the object expiry work is split into. Each shard "
+	"has its own binary heap, lock and thread, objects are assigned to "
+	"a shard by their address.\n"
+	"Consider raising this if MAIN.exp_mailed runs away from "
+	"MAIN.exp_received, which means a single expiry thread cannot keep "
+	"up with the insert rate.",
+	/* flags */	MUST_RESTART | EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	expiry_wheel,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Keep the expiry timers on a hierarchical timing wheel instead of a "
+	"binary heap. Inserting and rearming an object is O(1) rather than "
+	"O(log n), which helps with many objects with short TTLs, but "
+	"objects expire with a resolution of 10 milliseconds.",
+	/* flags */	MUST_RESTART | EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	http1_sendfile,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Use sendfile(2) to deliver HTTP1 response bodies from file "
+	"storage, when no delivery processor (gunzip, ESI, range, ...) needs "
+	"to see them and the object is completely fetched.  Other bodies are "
+	"delivered as usual.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	http1_zerocopy,
+	/* type */	bytes,
+	/* min */	"0",
+	/* max */	NULL,
+	/* def */	"0",
+	/* units */	"bytes",
+	/* descr */
+	"Send HTTP1 response bodies of at least this size with "
+	"MSG_ZEROCOPY, when the object is completely fetched and no "
+	"delivery processor needs to see the body.  The kernel then "
+	"transmits straight from storage, and the worker waits for the "
+	"completion notifications before finishing the delivery.  "
+	"Zero disables.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	http1_iovs,
 	/* type */	uint,
@@ -516,6 +626,23 @@ PARAM_SIMPLE(
 	/* flags */	EXPERIMENTAL
 )
 
+PARAM_SIMPLE(
+	/* name */	fetch_evented,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Park backend fetches on the waiter while waiting for the first "
+	"byte of the backend response, instead of holding a worker thread. "
+	"The fetch resumes on a new worker thread when the response starts "
+	"to arrive, or first_byte_timeout expires.\n"
+	"This only applies to backend connections which are not already "
+	"readable once the backend request has been sent.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	fetch_maxchunksize,
 	/* type */	bytes,
@@ -808,6 +935,24 @@ PARAM_SIMPLE(
 	/* flags */	MUST_RESTART
 )
 
+PARAM_SIMPLE(
+	/* name */	pipe_evented,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Hand PIPE sessions to the waiter once the backend request has "
+	"been sent, instead of keeping a worker thread for the lifetime "
+	"of the tunnel.  Data is moved by short worker tasks whenever "
+	"either side has something to say.\n"
+	"The bytes moved after the handoff are only accounted in the "
+	"global pipe counters, not in the PipeAcct log record or the "
+	"backend counters.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	pipe_sess_max,
 	/* type */	uint,
@@ -819,6 +964,20 @@ PARAM_SIMPLE(
 	"Maximum number of sessions dedicated to pipe transactions."
 )
 
+PARAM_SIMPLE(
+	/* name */	pipe_splice,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Move the data of PIPE sessions with splice(2) through a pipe, "
+	"rather than copying it through userspace.  Where splice(2) is not "
+	"available or fails to set up, the data is copied as usual.",
+	/* flags */	EXPERIMENTAL
+)
+
 PARAM_SIMPLE(
 	/* name */	pipe_task_deadline,
 	/* type */	timeout,
@@ -997,6 +1156,30 @@ PARAM_SIMPLE(
 )
 #undef PLATFORM_FLAGS
 
+#if defined(HAVE_TCP_NOTSENT_LOWAT)
+#  define PLATFORM_FLAGS EXPERIMENTAL
+#else
+#  define PLATFORM_FLAGS NOT_IMPLEMENTED
+#endif
+PARAM_SIMPLE(
+	/* name */	tcp_notsent_lowat,
+	/* type */	bytes,
+	/* min */	"0",
+	/* max */	"1G",
+	/* def */	"0",
+	/* units */	"bytes",
+	/* descr */
+	"Set TCP_NOTSENT_LOWAT on client connections, limiting how much "
+	"unsent response data the kernel buffers for a client.  Streaming "
+	"HTTP1 and HTTP2 deliveries then wait for the socket to drain below "
+	"this mark before writing more, rather than filling the send "
+	"buffer as fast as the backend delivers.  "
+	"Zero leaves the system default.  "
+	"Ignored for Unix domain sockets.",
+	/* flags */	PLATFORM_FLAGS
+)
+#undef PLATFORM_FLAGS
+
 PARAM_SIMPLE(
 	/* name */	timeout_idle,
 	/* type */	duration,
@@ -1272,6 +1455,37 @@ PARAM_SIMPLE(
 	/* flags */	WIZARD
 )
 
+PARAM_SIMPLE(
+	/* name */	h2_encoder_table_size,
+	/* type */	bytes_u,
+	/* min */	"0b",
+	/* max */	"64k",
+	/* def */	"0b",
+	/* units */	"bytes",
+	/* descr */
+	"HTTP2 HPACK encoder table size.\n"
+	"The size of the dynamic table used to compress response headers, "
+	"further limited by the SETTINGS_HEADER_TABLE_SIZE announced by "
+	"the client.  Response headers seen before on the same session "
+	"are then sent as a single index.\n"
+	"Zero disables the dynamic table and only the static table is "
+	"used.  Only affects new sessions.",
+	/* flags */	EXPERIMENTAL
+)
+
+PARAM_SIMPLE(
+	/* name */	h2_huffman,
+	/* type */	boolean,
+	/* min */	NULL,
+	/* max */	NULL,
+	/* def */	"off",
+	/* units */	"bool",
+	/* descr */
+	"Huffman encode HTTP2 response header literals whenever this "
+	"makes them shorter.",
+	/* flags */	EXPERIMENTAL
+)
+
 #define H2_SETTING_NAME(nm) "SETTINGS_" #nm
 #define H2_SETTING_DESCR(nm)						\
 	"\n\nThe value of this parameter defines " H2_SETTING_NAME(nm)	\
@@ -0,0 +1,8 @@
+/* ee88fc1569f566a64c12e99764498fe1b6ec0cab */
+/*
+ * NB:  This file is machine generated, DO NOT EDIT!
+ *
+ * Edit and run include/generate.py instead.
+ */
+
+#define VCS_Version "ee88fc1569f566a64c12e99764498fe1b6ec0cab"
@@ -0,0 +1,7 @@
+/*
+ * NB:  This file is machine generated, DO NOT EDIT!
+ *
+ * Edit and run include/generate.py instead.
+ */
+
+#define VMOD_ABI_Version "Varnish trunk ee88fc1569f566a64c12e99764498fe1b6ec0cab"
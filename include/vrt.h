@@ -60,6 +60,9 @@
  * NEXT (2024-09-15)
  *	struct vrt_backend.backend_wait_timeout added
  *	struct vrt_backend.backend_wait_limit  added
+ *	VRT_tag() added
+ *	VRT_purge_tag() added
+ *	struct vrt_backend.http2 added
  * 19.1 (2024-05-27)
  *	[cache_varnishd.h] ObjWaitExtend() gained statep argument
  * 19.0 (2024-03-18)
@@ -595,7 +598,8 @@ struct vrt_endpoint {
 	vtim_dur			backend_wait_timeout;	\
 	unsigned			max_connections;	\
 	unsigned			proxy_header;		\
-	unsigned			backend_wait_limit;
+	unsigned			backend_wait_limit;	\
+	unsigned			http2;
 
 #define VRT_BACKEND_INIT(be)					\
 	do {							\
@@ -618,6 +622,7 @@ struct vrt_endpoint {
 		DN(max_connections);		\
 		DN(proxy_header);		\
 		DN(backend_wait_limit);		\
+		DN(http2);			\
 	} while(0)
 
 struct vrt_backend {
@@ -704,6 +709,9 @@ VCL_BYTES VRT_CacheReqBody(VRT_CTX, VCL_BYTES maxsize);
 
 VCL_STRING VRT_ban_string(VRT_CTX, VCL_STRING);
 VCL_INT VRT_purge(VRT_CTX, VCL_DURATION, VCL_DURATION, VCL_DURATION);
+VCL_VOID VRT_tag(VRT_CTX, VCL_STRING);
+VCL_INT VRT_purge_tag(VRT_CTX, VCL_STRING, VCL_DURATION, VCL_DURATION,
+    VCL_DURATION);
 VCL_VOID VRT_synth(VRT_CTX, VCL_INT, VCL_STRING);
 VCL_VOID VRT_hit_for_pass(VRT_CTX, VCL_DURATION);
 
@@ -51,6 +51,7 @@ void VTCP_blocking(int sock);
 void VTCP_nonblocking(int sock);
 int VTCP_linger(int sock, int linger);
 int VTCP_check_hup(int sock);
+int VTCP_wait_writable(int sock, vtim_dur tmo);
 
 // #ifdef SOL_SOCKET
 void VTCP_name(const struct suckaddr *addr, char *abuf, unsigned alen,
@@ -61,6 +62,7 @@ int VTCP_open(const char *addr, const char *def_port, vtim_dur timeout,
     const char **err);
 void VTCP_close(int *s);
 int VTCP_bind(const struct suckaddr *addr, const char **errp);
+int VTCP_bind_reuseport(const struct suckaddr *addr, const char **errp);
 int VTCP_listen(const struct suckaddr *addr, int depth, const char **errp);
 int VTCP_listen_on(const char *addr, const char *def_port, int depth,
     const char **errp);
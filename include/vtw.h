@@ -0,0 +1,92 @@
+/*-
+ * Copyright (c) 2026 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Hierarchical Timing Wheel API
+ *
+ * Items are kept in slots by the tick they are due, so insert, reorder
+ * and delete are O(1).  Items further out than the first level are
+ * cascaded into finer slots as time passes.  Nothing is ever returned
+ * by VTW_root() before the tick it is due, but items in the same tick
+ * are not ordered.
+ *
+ * XXX: doesn't scale back the slot arrays when items are deleted.
+ */
+
+/* Public Interface --------------------------------------------------*/
+
+struct vtw;
+
+typedef void vtw_update_t(void *priv, void *a, unsigned slot, unsigned idx);
+	/*
+	 * Update function
+	 * When items move in the wheel, this function gets called to
+	 * notify the item of its new slot and index, both are needed
+	 * to reorder or delete it.
+	 * When an item is deleted, idx is VTW_NOIDX.
+	 */
+
+struct vtw *VTW_new(void *priv, double tick, double now, vtw_update_t *);
+	/*
+	 * Create a Timing Wheel with the given tick length in seconds,
+	 * starting at 'now'.
+	 * 'priv' is passed to the update function.
+	 */
+
+void VTW_destroy(struct vtw **);
+	/*
+	 * Destroy an empty Timing Wheel
+	 */
+
+void VTW_insert(struct vtw *, void *, double when);
+	/*
+	 * Insert an item due at 'when'
+	 */
+
+void VTW_reorder(struct vtw *, unsigned slot, unsigned idx, double when);
+	/*
+	 * Move an item to a new due time
+	 */
+
+void VTW_delete(struct vtw *, unsigned slot, unsigned idx);
+	/*
+	 * Delete an item
+	 */
+
+void *VTW_root(struct vtw *, double now, double *next);
+	/*
+	 * Advance the wheel to 'now' and return an item in the current
+	 * tick or earlier.  If there is none, return NULL and set 'next'
+	 * to the earliest time it is worth calling again, INFINITY if
+	 * the wheel is empty.
+	 */
+
+unsigned VTW_count(const struct vtw *);
+	/*
+	 * Number of items in the wheel
+	 */
+
+#define VTW_NOIDX	0
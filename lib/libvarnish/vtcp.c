@@ -416,10 +416,13 @@ VTCP_open(const char *addr, const char *def_port, vtim_dur timeout,
  *
  * If the address is an IPv6 address, the IPV6_V6ONLY option is set to
  * avoid conflicts between INADDR_ANY and IN6ADDR_ANY.
+ *
+ * With reuseport, SO_REUSEPORT is set, so that several sockets can be
+ * bound to the same address and the kernel spreads connections over them.
  */
 
-int
-VTCP_bind(const struct suckaddr *sa, const char **errp)
+static int
+vtcp_bind(const struct suckaddr *sa, int reuseport, const char **errp)
 {
 	int sd, val, e;
 	socklen_t sl;
@@ -445,6 +448,26 @@ VTCP_bind(const struct suckaddr *sa, const char **errp)
 		errno = e;
 		return (-1);
 	}
+	if (reuseport) {
+#ifdef SO_REUSEPORT
+		val = 1;
+		if (setsockopt(sd, SOL_SOCKET, SO_REUSEPORT,
+		    &val, sizeof val) != 0) {
+			if (errp != NULL)
+				*errp = "setsockopt(SO_REUSEPORT, 1)";
+			e = errno;
+			closefd(&sd);
+			errno = e;
+			return (-1);
+		}
+#else
+		if (errp != NULL)
+			*errp = "SO_REUSEPORT";
+		closefd(&sd);
+		errno = ENOPROTOOPT;
+		return (-1);
+#endif
+	}
 #ifdef IPV6_V6ONLY
 	/* forcibly use separate sockets for IPv4 and IPv6 */
 	val = 1;
@@ -470,6 +493,20 @@ VTCP_bind(const struct suckaddr *sa, const char **errp)
 	return (sd);
 }
 
+int
+VTCP_bind(const struct suckaddr *sa, const char **errp)
+{
+
+	return (vtcp_bind(sa, 0, errp));
+}
+
+int
+VTCP_bind_reuseport(const struct suckaddr *sa, const char **errp)
+{
+
+	return (vtcp_bind(sa, 1, errp));
+}
+
 /*--------------------------------------------------------------------
  * Given a struct suckaddr, open a socket of the appropriate type, bind it
  * to the requested address, and start listening.
@@ -572,6 +609,28 @@ VTCP_check_hup(int sock)
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * Wait up to tmo for the socket to become writable.  With
+ * TCP_NOTSENT_LOWAT, that is when the unsent data has drained below
+ * the mark.  Returns zero on timeout.
+ */
+
+int
+VTCP_wait_writable(int sock, vtim_dur tmo)
+{
+	struct pollfd pfd[1];
+	int i;
+
+	assert(sock >= 0);
+	pfd->fd = sock;
+	pfd->events = POLLOUT;
+	do {
+		pfd->revents = 0;
+		i = poll(pfd, 1, VTIM_poll_tmo(tmo));
+	} while (i < 0 && errno == EINTR);
+	return (i != 0);
+}
+
 /*--------------------------------------------------------------------
  * Check if a TCP syscall return value is fatal
  */
@@ -0,0 +1,555 @@
+/*-
+ * Copyright (c) 2026 Varnish Software AS
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Implementation of a hierarchical timing wheel, after:
+ *	Varghese & Lauck, "Hashed and Hierarchical Timing Wheels"
+ *	(SOSP '87)
+ *
+ * Each level has VTW_SIZE slots, a slot on level n spans VTW_SIZE^n
+ * ticks.  Every time the tick counter rolls over the slots of a level,
+ * the due slot of the level above is cascaded down.  Items due further
+ * out than the top level covers are parked in its farthest slot and
+ * re-cascaded until they get in range.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "miniobj.h"
+#include "vdef.h"
+#include "vas.h"
+#include "vtw.h"
+
+#define VTW_BITS	6
+#define VTW_SIZE	(1U << VTW_BITS)
+#define VTW_MASK	(VTW_SIZE - 1)
+#define VTW_LEVELS	4
+#define VTW_NSLOT	(VTW_LEVELS * VTW_SIZE)
+#define VTW_RANGE	((uint64_t)1 << (VTW_BITS * VTW_LEVELS))
+
+/* Far enough in the future, but without overflowing the tick counter */
+#define VTW_TICK_MAX	((uint64_t)1 << 60)
+
+struct vtw_ent {
+	void			*item;
+	uint64_t		due;
+};
+
+struct vtw_slot {
+	struct vtw_ent		*ent;
+	unsigned		n;
+	unsigned		len;
+};
+
+struct vtw {
+	unsigned		magic;
+#define VTW_MAGIC		0x5b4a1e0d
+	unsigned		count;
+	unsigned		lcount[VTW_LEVELS];
+	void			*priv;
+	vtw_update_t		*update;
+	double			tick;
+	uint64_t		cur;	/* next tick to process */
+	struct vtw_slot		slot[VTW_NSLOT];
+};
+
+static uint64_t
+vtw_ticks(const struct vtw *vtw, double t)
+{
+	double d;
+
+	d = floor(t / vtw->tick);
+	if (!(d > 0.))		/* also catches NAN */
+		return (0);
+	if (d >= (double)VTW_TICK_MAX)
+		return (VTW_TICK_MAX);
+	return ((uint64_t)d);
+}
+
+static unsigned
+vtw_slotno(const struct vtw *vtw, uint64_t due)
+{
+	uint64_t d;
+	unsigned l;
+
+	if (due < vtw->cur)
+		due = vtw->cur;
+	d = due - vtw->cur;
+	if (d >= VTW_RANGE)
+		due = vtw->cur + VTW_RANGE - 1;
+	for (l = 0; l < VTW_LEVELS - 1; l++)
+		if (d < (uint64_t)1 << (VTW_BITS * (l + 1)))
+			break;
+	return (l * VTW_SIZE + ((due >> (VTW_BITS * l)) & VTW_MASK));
+}
+
+static void
+vtw_add(struct vtw *vtw, void *item, uint64_t due)
+{
+	struct vtw_slot *s;
+	unsigned u;
+
+	u = vtw_slotno(vtw, due);
+	s = &vtw->slot[u];
+	if (s->n == s->len) {
+		s->len = s->len ? s->len * 2 : 16;
+		s->ent = realloc(s->ent, s->len * sizeof *s->ent);
+		AN(s->ent);
+	}
+	s->ent[s->n].item = item;
+	s->ent[s->n].due = due;
+	s->n++;
+	vtw->lcount[u / VTW_SIZE]++;
+	vtw->update(vtw->priv, item, u, s->n);
+}
+
+static struct vtw_ent
+vtw_take(struct vtw *vtw, unsigned slot, unsigned idx)
+{
+	struct vtw_slot *s;
+	struct vtw_ent e;
+
+	assert(slot < VTW_NSLOT);
+	s = &vtw->slot[slot];
+	assert(idx != VTW_NOIDX);
+	assert(idx <= s->n);
+	e = s->ent[idx - 1];
+	s->n--;
+	vtw->lcount[slot / VTW_SIZE]--;
+	if (idx - 1 != s->n) {
+		s->ent[idx - 1] = s->ent[s->n];
+		vtw->update(vtw->priv, s->ent[idx - 1].item, slot, idx);
+	}
+	return (e);
+}
+
+/*
+ * Move the slot of level 'l' which is due now down to the finer levels.
+ * Nothing can land in the slot being emptied: what is in there is due
+ * within its span, except parked items, which go to the far end again.
+ */
+
+static void
+vtw_cascade(struct vtw *vtw, unsigned l)
+{
+	struct vtw_slot *s;
+	struct vtw_ent e;
+	unsigned u;
+
+	assert(l > 0 && l < VTW_LEVELS);
+	u = l * VTW_SIZE + ((vtw->cur >> (VTW_BITS * l)) & VTW_MASK);
+	s = &vtw->slot[u];
+	while (s->n > 0) {
+		e = vtw_take(vtw, u, s->n);
+		vtw_add(vtw, e.item, e.due);
+		assert(vtw_slotno(vtw, e.due) != u);
+	}
+}
+
+/*
+ * Return how many ticks from cur the next cascade is due, going straight
+ * to the coarsest one if the finer levels are empty.
+ */
+
+static uint64_t
+vtw_skip(const struct vtw *vtw)
+{
+	unsigned l;
+
+	for (l = 0; l < VTW_LEVELS - 1; l++)
+		if (vtw->lcount[l] > 0)
+			break;
+	if (l == 0)
+		return (1);
+	l *= VTW_BITS;
+	return ((((vtw->cur >> l) + 1) << l) - vtw->cur);
+}
+
+static void
+vtw_advance(struct vtw *vtw, uint64_t t)
+{
+	uint64_t d;
+	unsigned l;
+
+	d = vtw_skip(vtw);
+	if (vtw->cur + d > t + 1) {
+		/* No cascade before t */
+		vtw->cur = t + 1;
+		return;
+	}
+	vtw->cur += d;
+	for (l = 1; l < VTW_LEVELS; l++)
+		if (vtw->cur & (((uint64_t)1 << (VTW_BITS * l)) - 1))
+			break;
+	/* Coarsest first, so the finer slots can pick up the pieces */
+	while (--l > 0)
+		vtw_cascade(vtw, l);
+}
+
+/* Public API ---------------------------------------------------------*/
+
+struct vtw *
+VTW_new(void *priv, double tick, double now, vtw_update_t *update_f)
+{
+	struct vtw *vtw;
+
+	assert(tick > 0.);
+	AN(update_f);
+	ALLOC_OBJ(vtw, VTW_MAGIC);
+	if (vtw == NULL)
+		return (NULL);
+	vtw->priv = priv;
+	vtw->update = update_f;
+	vtw->tick = tick;
+	vtw->cur = vtw_ticks(vtw, now);
+	return (vtw);
+}
+
+void
+VTW_destroy(struct vtw **vtwp)
+{
+	struct vtw *vtw;
+	unsigned u;
+
+	TAKE_OBJ_NOTNULL(vtw, vtwp, VTW_MAGIC);
+	AZ(vtw->count);
+	for (u = 0; u < VTW_NSLOT; u++) {
+		AZ(vtw->slot[u].n);
+		free(vtw->slot[u].ent);
+	}
+	FREE_OBJ(vtw);
+}
+
+void
+VTW_insert(struct vtw *vtw, void *item, double when)
+{
+
+	CHECK_OBJ_NOTNULL(vtw, VTW_MAGIC);
+	AN(item);
+	vtw_add(vtw, item, vtw_ticks(vtw, when));
+	vtw->count++;
+	AN(vtw->count);
+}
+
+void
+VTW_reorder(struct vtw *vtw, unsigned slot, unsigned idx, double when)
+{
+	struct vtw_ent e;
+
+	CHECK_OBJ_NOTNULL(vtw, VTW_MAGIC);
+	e = vtw_take(vtw, slot, idx);
+	vtw_add(vtw, e.item, vtw_ticks(vtw, when));
+}
+
+void
+VTW_delete(struct vtw *vtw, unsigned slot, unsigned idx)
+{
+	struct vtw_ent e;
+
+	CHECK_OBJ_NOTNULL(vtw, VTW_MAGIC);
+	e = vtw_take(vtw, slot, idx);
+	vtw->update(vtw->priv, e.item, slot, VTW_NOIDX);
+	AN(vtw->count);
+	vtw->count--;
+}
+
+void *
+VTW_root(struct vtw *vtw, double now, double *next)
+{
+	const struct vtw_slot *s;
+	uint64_t t, u;
+
+	CHECK_OBJ_NOTNULL(vtw, VTW_MAGIC);
+	AN(next);
+	t = vtw_ticks(vtw, now);
+
+	if (vtw->count == 0) {
+		/* Nothing to cascade, just catch up */
+		if (vtw->cur < t)
+			vtw->cur = t;
+		*next = INFINITY;
+		return (NULL);
+	}
+
+	while (vtw->cur <= t) {
+		s = &vtw->slot[vtw->cur & VTW_MASK];
+		if (s->n > 0)
+			return (s->ent[s->n - 1].item);
+		vtw_advance(vtw, t);
+	}
+
+	/* Find the next busy slot before the next cascade */
+	u = vtw->cur + vtw_skip(vtw);
+	if (vtw->lcount[0] > 0) {
+		for (u = vtw->cur; u & VTW_MASK; u++)
+			if (vtw->slot[u & VTW_MASK].n > 0)
+				break;
+	}
+	*next = u * vtw->tick;
+	return (NULL);
+}
+
+unsigned
+VTW_count(const struct vtw *vtw)
+{
+
+	CHECK_OBJ_NOTNULL(vtw, VTW_MAGIC);
+	return (vtw->count);
+}
+
+#ifdef TEST_DRIVER
+
+#include <stdio.h>
+
+#include "vbh.h"
+#include "vrnd.h"
+#include "vtim.h"
+
+/* Test driver -------------------------------------------------------*/
+
+struct foo {
+	unsigned	magic;
+#define FOO_MAGIC	0x1a4c9b37
+	unsigned	slot;
+	unsigned	idx;
+	unsigned	n;
+	double		when;
+};
+
+#define N 131101	/* Number of items */
+#define M 500083	/* Number of operations */
+#define TICK 0.01
+
+static struct foo *ff[N];
+
+static void v_matchproto_(vtw_update_t)
+update(void *priv, void *a, unsigned slot, unsigned idx)
+{
+	struct foo *fa;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(fa, a, FOO_MAGIC);
+	fa->slot = slot;
+	fa->idx = idx;
+}
+
+static int v_matchproto_(vbh_cmp_t)
+bh_cmp(void *priv, const void *a, const void *b)
+{
+	const struct foo *fa, *fb;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(fa, a, FOO_MAGIC);
+	CAST_OBJ_NOTNULL(fb, b, FOO_MAGIC);
+	return (fa->when < fb->when);
+}
+
+static void v_matchproto_(vbh_update_t)
+bh_update(void *priv, void *a, unsigned u)
+{
+	struct foo *fa;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(fa, a, FOO_MAGIC);
+	fa->idx = u;
+}
+
+static void
+vrnd_lock(void)
+{
+}
+
+static double
+rnd(double lo, double hi)
+{
+
+	return (lo + (hi - lo) * VRND_RandomTestableDouble());
+}
+
+/* Expire everything in the wheel, checking nothing comes early or late */
+static void
+drain(struct vtw *vtw, double now)
+{
+	struct foo *fp;
+	double next;
+	unsigned u, v;
+
+	for (v = 0; VTW_count(vtw) > 0; v++) {
+		while (1) {
+			fp = VTW_root(vtw, now, &next);
+			if (fp == NULL)
+				break;
+			CHECK_OBJ_NOTNULL(fp, FOO_MAGIC);
+			assert(floor(fp->when / TICK) <= floor(now / TICK));
+			VTW_delete(vtw, fp->slot, fp->idx);
+			assert(fp->idx == VTW_NOIDX);
+			ff[fp->n] = NULL;
+			FREE_OBJ(fp);
+		}
+		assert(next > now);
+		if (v % 1024 == 0) {
+			for (u = 0; u < N; u++)
+				if (ff[u] != NULL)
+					assert(floor(ff[u]->when / TICK) >
+					    floor(now / TICK));
+		}
+		now += TICK * .37;
+		if (next > now)
+			now = next;
+	}
+}
+
+static void
+check(void)
+{
+	struct vtw *vtw;
+	struct foo *fp;
+	double now = 1e9;
+	unsigned u, v;
+
+	vtw = VTW_new(NULL, TICK, now, update);
+	AN(vtw);
+
+	for (u = 0; u < N; u++) {
+		ALLOC_OBJ(ff[u], FOO_MAGIC);
+		AN(ff[u]);
+		ff[u]->n = u;
+		switch (u % 4) {
+		case 0: ff[u]->when = now - rnd(0, 10); break;
+		case 1: ff[u]->when = now + rnd(0, 1); break;
+		case 2: ff[u]->when = now + rnd(1, 3600); break;
+		default: ff[u]->when = now + rnd(0, 86400 * 400); break;
+		}
+		VTW_insert(vtw, ff[u], ff[u]->when);
+		AN(ff[u]->idx);
+	}
+	for (u = 0; u < M; u++) {
+		v = VRND_RandomTestable() % N;
+		fp = ff[v];
+		CHECK_OBJ_NOTNULL(fp, FOO_MAGIC);
+		fp->when = now + rnd(-1, 100);
+		VTW_reorder(vtw, fp->slot, fp->idx, fp->when);
+	}
+	fprintf(stderr, "%d inserts, %d reorders OK\n", N, M);
+	drain(vtw, now);
+	fprintf(stderr, "%d expiries OK\n", N);
+	VTW_destroy(&vtw);
+	AZ(vtw);
+}
+
+/*
+ * Benchmark against vbh with a short TTL workload: insert, rearm each
+ * object once, then run the clock until everything expired.
+ */
+
+static void
+bench(unsigned n)
+{
+	struct vtw *vtw;
+	struct vbh *bh;
+	struct foo *fp, **fa;
+	double now = 1e9, t0, t1, t2, t3, next;
+	unsigned u;
+	int wheel;
+
+	fa = calloc(n, sizeof *fa);
+	AN(fa);
+	for (wheel = 0; wheel < 2; wheel++) {
+		vtw = VTW_new(NULL, TICK, now, update);
+		bh = VBH_new(NULL, bh_cmp, bh_update);
+		for (u = 0; u < n; u++) {
+			ALLOC_OBJ(fa[u], FOO_MAGIC);
+			AN(fa[u]);
+			fa[u]->when = now + rnd(1, 10);
+		}
+		t0 = VTIM_mono();
+		for (u = 0; u < n; u++) {
+			if (wheel)
+				VTW_insert(vtw, fa[u], fa[u]->when);
+			else
+				VBH_insert(bh, fa[u]);
+		}
+		t1 = VTIM_mono();
+		for (u = 0; u < n; u++) {
+			fp = fa[VRND_RandomTestable() % n];
+			fp->when = now + rnd(1, 10);
+			if (wheel)
+				VTW_reorder(vtw, fp->slot, fp->idx, fp->when);
+			else
+				VBH_reorder(bh, fp->idx);
+		}
+		t2 = VTIM_mono();
+		for (u = 0; u < n; now += TICK) {
+			while (1) {
+				if (wheel) {
+					fp = VTW_root(vtw, now, &next);
+					if (fp == NULL)
+						break;
+					VTW_delete(vtw, fp->slot, fp->idx);
+				} else {
+					fp = VBH_root(bh);
+					if (fp == NULL || fp->when > now)
+						break;
+					VBH_delete(bh, fp->idx);
+				}
+				FREE_OBJ(fp);
+				u++;
+			}
+		}
+		t3 = VTIM_mono();
+		fprintf(stderr,
+		    "%s n=%u insert %.0f ns, rearm %.0f ns, expire %.0f ns\n",
+		    wheel ? "vtw" : "vbh", n,
+		    (t1 - t0) * 1e9 / n, (t2 - t1) * 1e9 / n,
+		    (t3 - t2) * 1e9 / n);
+		VTW_destroy(&vtw);
+		VBH_destroy(&bh);
+	}
+	free(fa);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned n = N;
+
+	VRND_SeedAll();
+	VRND_SeedTestable(1);
+	VRND_Lock = vrnd_lock;
+	VRND_Unlock = vrnd_lock;
+
+	check();
+	if (argc > 1)
+		n = strtoul(argv[1], NULL, 0);
+	bench(n);
+	return (0);
+}
+#endif
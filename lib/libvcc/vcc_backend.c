@@ -429,6 +429,7 @@ vcc_ParseHostDef(struct vcc *tl, struct symbol *sym,
 	    "?authority",
 	    "?wait_timeout",
 	    "?wait_limit",
+	    "?http2",
 	    NULL);
 
 	tl->fb = VSB_new_auto();
@@ -586,6 +587,11 @@ vcc_ParseHostDef(struct vcc *tl, struct symbol *sym,
 			ERRCHK(tl);
 			SkipToken(tl, ';');
 			Fb(tl, 0, "\t.backend_wait_limit = %u,\n", u);
+		} else if (vcc_IdIs(t_field, "http2")) {
+			u = vcc_BoolVal(tl);
+			ERRCHK(tl);
+			SkipToken(tl, ';');
+			Fb(tl, 0, "\t.http2 = %u,\n", u);
 		} else {
 			ErrInternal(tl);
 			VSB_destroy(&tl->fb);
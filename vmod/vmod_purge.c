@@ -59,3 +59,24 @@ vmod_soft(VRT_CTX, VCL_DURATION ttl, VCL_DURATION grace, VCL_DURATION keep)
 		keep = NAN;
 	return (VRT_purge(ctx, ttl, grace, keep));
 }
+
+VCL_VOID v_matchproto_(td_purge_tags)
+vmod_tags(VRT_CTX, VCL_STRING tags)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	VRT_tag(ctx, tags);
+}
+
+VCL_INT v_matchproto_(td_purge_tag)
+vmod_tag(VRT_CTX, VCL_STRING tag, VCL_DURATION ttl, VCL_DURATION grace,
+    VCL_DURATION keep)
+{
+
+	CHECK_OBJ_NOTNULL(ctx, VRT_CTX_MAGIC);
+	if (grace < 0)
+		grace = NAN;
+	if (keep < 0)
+		keep = NAN;
+	return (VRT_purge_tag(ctx, tag, ttl, grace, keep));
+}